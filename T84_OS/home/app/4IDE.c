@@ -6,18 +6,29 @@
 #include "../../../kernel/kernel.h"
 #include "../../../kernel/ramfs.h"
 #include "../../../kernel/string_utils.h"
+#include "../../../kernel/sched.h"
 #include <stdbool.h>
 
 #define IDE_WIDTH 70
 #define IDE_HEIGHT 18
-#define MAX_LINES 50
 #define MAX_LINE_LEN 80
+#define IDE_TEXT_MAX 65536
+#define IDE_MAX_LINES 8192
+#define IDE_LINE_VIEW 128
+#define IDE_VIEW_COLS 69
+#define HL_CACHE_SLOTS 64
+#define UNDO_OPS 256
+#define UNDO_TEXT 8192
 
 #define KEY_ESC 0x01
 #define KEY_ENTER 0x1C
 #define KEY_BACKSPACE 0x0E
 #define KEY_LCTRL 0x1D
 #define KEY_S 0x1F
+#define KEY_Z 0x2C
+#define KEY_Y 0x15
+#define KEY_F 0x21
+#define KEY_H 0x23
 #define KEY_UP 0x48
 #define KEY_DOWN 0x50
 #define KEY_LEFT 0x4B
@@ -38,15 +49,36 @@
 #define COLOR_OPERATION 0x0C
 #define COLOR_MISC 0x0C
 #define COLOR_EXTERNAL VGA_COLOR_BLUE
+#define COLOR_MATCH 0x70
 
 static char ide_clipboard[256] = "";
 static bool ide_clipboard_has_content = false;
 
+/*
+ * The text is a gap buffer: what comes before the last edit sits at the
+ * start of text[], the rest at the end, and typing fills the gap between
+ * them.  Line starts are split the same way around the line being
+ * edited, with those after the gap stored as distances from the end of
+ * the text, so an edit leaves every other line's entry alone.  Moving
+ * either gap costs only the distance it moves.  Each line also carries
+ * an id that changes whenever its text does.
+ */
+typedef struct
+{
+    char text[IDE_TEXT_MAX];
+    int gap_start;
+    int gap_end;
+    int line_starts[IDE_MAX_LINES];
+    uint32_t line_ids[IDE_MAX_LINES];
+    int line_gap;
+    int line_gap_end;
+    uint32_t next_id;
+} IDE_Buffer;
+
 typedef struct
 {
     char filename[32];
-    char lines[MAX_LINES][MAX_LINE_LEN];
-    int line_count;
+    IDE_Buffer buf;
     int cursor_line;
     int cursor_col;
     bool modified;
@@ -55,6 +87,7 @@ typedef struct
     bool shift_pressed;
     bool caps_lock;
     bool insert_mode;
+    bool crlf; /* lines end in CR LF in the file, LF in the buffer */
     int scroll_offset;
 } IDE_Editor;
 
@@ -79,31 +112,478 @@ static void str_copy(char *dest, const char *src)
     dest[i] = '\0';
 }
 
-void overwrite_char(char c)
+static int text_length(void)
 {
-    if (editor.cursor_line >= editor.line_count)
-        return;
+    return editor.buf.gap_start + IDE_TEXT_MAX - editor.buf.gap_end;
+}
 
-    char *line = editor.lines[editor.cursor_line];
-    int len = str_len(line);
+static char text_at(int pos)
+{
+    const IDE_Buffer *b = &editor.buf;
+    return pos < b->gap_start ? b->text[pos] : b->text[pos + b->gap_end - b->gap_start];
+}
 
-    if (editor.cursor_col < len)
+static int line_count(void)
+{
+    return editor.buf.line_gap + IDE_MAX_LINES - editor.buf.line_gap_end;
+}
+
+static int line_start(int line)
+{
+    const IDE_Buffer *b = &editor.buf;
+
+    if (line < b->line_gap)
+        return b->line_starts[line];
+    return text_length() - b->line_starts[line - b->line_gap + b->line_gap_end];
+}
+
+static uint32_t line_id(int line)
+{
+    const IDE_Buffer *b = &editor.buf;
+    return b->line_ids[line < b->line_gap ? line : line - b->line_gap + b->line_gap_end];
+}
+
+static int line_len(int line)
+{
+    int end = line + 1 < line_count() ? line_start(line + 1) - 1 : text_length();
+    return end - line_start(line);
+}
+
+/* The line holding text position pos. */
+static int line_of(int pos)
+{
+    int lo = 0;
+    int hi = line_count() - 1;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (line_start(mid) <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Copies the line, cut to max - 1 characters, into out. */
+static int line_copy(int line, char *out, int max)
+{
+    int start = line_start(line);
+    int len = line_len(line);
+
+    if (len > max - 1)
+        len = max - 1;
+    for (int i = 0; i < len; i++)
+        out[i] = text_at(start + i);
+    out[len] = '\0';
+    return len;
+}
+
+static void gap_move(int pos)
+{
+    IDE_Buffer *b = &editor.buf;
+
+    if (pos < b->gap_start)
+    {
+        int n = b->gap_start - pos;
+        memmove(&b->text[b->gap_end - n], &b->text[pos], n);
+        b->gap_start -= n;
+        b->gap_end -= n;
+    }
+    else if (pos > b->gap_start)
+    {
+        int n = pos - b->gap_start;
+        memmove(&b->text[b->gap_start], &b->text[b->gap_end], n);
+        b->gap_start += n;
+        b->gap_end += n;
+    }
+}
+
+/* Moves the line gap so that the first line entries come before it. */
+static void line_gap_move(int line)
+{
+    IDE_Buffer *b = &editor.buf;
+    int len = text_length();
+
+    while (b->line_gap > line)
+    {
+        b->line_gap--;
+        b->line_gap_end--;
+        b->line_starts[b->line_gap_end] = len - b->line_starts[b->line_gap];
+        b->line_ids[b->line_gap_end] = b->line_ids[b->line_gap];
+    }
+    while (b->line_gap < line)
+    {
+        b->line_starts[b->line_gap] = len - b->line_starts[b->line_gap_end];
+        b->line_ids[b->line_gap] = b->line_ids[b->line_gap_end];
+        b->line_gap++;
+        b->line_gap_end++;
+    }
+}
+
+static void buffer_clear(void)
+{
+    IDE_Buffer *b = &editor.buf;
+
+    b->gap_start = 0;
+    b->gap_end = IDE_TEXT_MAX;
+    b->line_starts[0] = 0;
+    b->line_ids[0] = ++b->next_id;
+    b->line_gap = 1;
+    b->line_gap_end = IDE_MAX_LINES;
+}
+
+/* Inserts len characters at col in line.  Fails, leaving the text as it
+   was, when the text or the line index is full. */
+static bool buffer_insert(int line, int col, const char *s, int len)
+{
+    IDE_Buffer *b = &editor.buf;
+    int newlines = 0;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (s[i] == '\n')
+            newlines++;
+    }
+    if (len > b->gap_end - b->gap_start || newlines > b->line_gap_end - b->line_gap)
+        return false;
+
+    int pos = line_start(line) + col;
+    line_gap_move(line + 1);
+    gap_move(pos);
+    b->line_ids[line] = ++b->next_id;
+
+    for (int i = 0; i < len; i++)
+    {
+        b->text[b->gap_start++] = s[i];
+        if (s[i] == '\n')
+        {
+            b->line_ids[b->line_gap] = ++b->next_id;
+            b->line_starts[b->line_gap++] = b->gap_start;
+        }
+    }
+    return true;
+}
+
+/* Removes len characters from col in line on, newlines included. */
+static void buffer_delete(int line, int col, int len)
+{
+    IDE_Buffer *b = &editor.buf;
+    int pos = line_start(line) + col;
+
+    if (len > text_length() - pos)
+        len = text_length() - pos;
+
+    line_gap_move(line + 1);
+    gap_move(pos);
+    b->line_ids[line] = ++b->next_id;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (b->text[b->gap_end + i] == '\n')
+            b->line_gap_end++;
+    }
+    b->gap_end += len;
+}
+
+/*
+ * The screen is repainted a row at a time.  Edits mark the file lines
+ * they change, scrolling moves the rows already on screen and repaints
+ * only the ones it uncovers, and the rows the cursor leaves and enters
+ * are repainted to move it.  Only the first draw after opening a file
+ * clears the screen.
+ */
+static bool frame_drawn = false;
+static int drawn_scroll;
+static int drawn_cursor_line;
+static int drawn_cursor_col;
+static int dirty_first = IDE_MAX_LINES;
+static int dirty_last = -1;
+
+/* Marks file lines first to last for repainting. */
+static void mark_lines(int first, int last)
+{
+    if (first < dirty_first)
+        dirty_first = first;
+    if (last > dirty_last)
+        dirty_last = last;
+}
+
+static void scroll_to_cursor(void)
+{
+    if (editor.cursor_line < editor.scroll_offset)
+        editor.scroll_offset = editor.cursor_line;
+    else if (editor.cursor_line >= editor.scroll_offset + IDE_HEIGHT)
+        editor.scroll_offset = editor.cursor_line - IDE_HEIGHT + 1;
+}
+
+static void cursor_to(int pos)
+{
+    editor.cursor_line = line_of(pos);
+    editor.cursor_col = pos - line_start(editor.cursor_line);
+    scroll_to_cursor();
+}
+
+/*
+ * Undo journal.  Each entry is a run of text inserted or deleted at a
+ * position, with the text kept in a ring of its own.  Typing extends
+ * the last insert and backspacing the last delete, so a word typed or
+ * rubbed out undoes in one step; moving the cursor, a new line, saving
+ * or undoing starts a new entry.  A replace-all is a group of joined
+ * entries that undo and redo together.  When either ring is full the
+ * oldest entries are dropped, a group as a whole.  Entry and text
+ * counters only grow and are reduced modulo the ring sizes.
+ */
+typedef struct
+{
+    bool insert;
+    bool backward; /* a run of backspaces, text stored last char first */
+    bool joined;   /* undone and redone with the entry before it */
+    int pos;
+    int len;
+    uint32_t text;
+} UndoOp;
+
+static UndoOp undo_ops[UNDO_OPS];
+static char undo_text[UNDO_TEXT];
+static uint32_t undo_first;
+static uint32_t undo_next;
+static uint32_t undo_end;
+static uint32_t undo_text_end;
+static bool undo_sealed;
+
+static UndoOp *undo_op(uint32_t index)
+{
+    return &undo_ops[index % UNDO_OPS];
+}
+
+static void journal_reset(void)
+{
+    undo_first = undo_next = undo_end = 0;
+    undo_text_end = 0;
+    undo_sealed = true;
+}
+
+/* Forgets whatever could be redone, then drops the oldest entries until
+   len more characters fit, and a new entry when new_entry is set. */
+static void journal_room(int len, bool new_entry)
+{
+    undo_end = undo_next;
+    if (undo_next > undo_first)
+        undo_text_end = undo_op(undo_next - 1)->text + undo_op(undo_next - 1)->len;
+
+    while (undo_first < undo_next &&
+           (undo_text_end + len - undo_op(undo_first)->text > UNDO_TEXT ||
+            (new_entry && undo_next - undo_first == UNDO_OPS)))
     {
+        undo_first++;
+        while (undo_first < undo_next && undo_op(undo_first)->joined)
+            undo_first++;
+    }
+}
+
+static UndoOp *journal_push(bool insert, int pos, bool joined)
+{
+    UndoOp *op = undo_op(undo_next++);
+
+    op->insert = insert;
+    op->backward = false;
+    op->joined = joined;
+    op->pos = pos;
+    op->len = 0;
+    op->text = undo_text_end;
+    undo_end = undo_next;
+    return op;
+}
+
+/* Records len characters at pos: after they went in for an insert,
+   before they go for a delete. */
+static void journal_add(bool insert, int pos, int len)
+{
+    if (len > UNDO_TEXT)
+    {
+        journal_reset();
+        return;
+    }
+
+    UndoOp *last = undo_next > undo_first ? undo_op(undo_next - 1) : NULL;
+    bool merge = last && !undo_sealed && last->insert == insert &&
+                 (insert ? pos == last->pos + last->len
+                         : pos + len == last->pos && (last->backward || last->len == 1));
+
+    journal_room(len, !merge);
 
-        line[editor.cursor_col] = c;
+    if (undo_first == undo_next)
+        merge = false;
+
+    if (merge)
+    {
+        if (!insert)
+        {
+            last->backward = true;
+            last->pos = pos;
+        }
     }
     else
     {
+        last = journal_push(insert, pos, false);
+    }
+
+    bool newline = false;
+
+    for (int i = 0; i < len; i++)
+    {
+        char c = text_at(last->backward ? pos + len - 1 - i : pos + i);
+
+        undo_text[undo_text_end++ % UNDO_TEXT] = c;
+        newline |= c == '\n';
+    }
+    last->len += len;
+    undo_sealed = insert && newline;
+}
+
+/* Records the text s, which has already gone in or out at pos, as an
+   entry of its own; joined ties it to the entry before. */
+static void journal_add_text(bool insert, int pos, const char *s, int len, bool joined)
+{
+    journal_room(len, true);
+
+    UndoOp *op = journal_push(insert, pos, joined && undo_next > undo_first);
+
+    for (int i = 0; i < len; i++)
+        undo_text[undo_text_end++ % UNDO_TEXT] = s[i];
+    op->len = len;
+    undo_sealed = true;
+}
+
+/* Inserts text at col in line, noting it in the journal when record is
+   set. */
+static bool edit_insert(int line, int col, const char *s, int len, bool record)
+{
+    if (!buffer_insert(line, col, s, len))
+        return false;
+
+    bool newline = false;
+    for (int i = 0; i < len; i++)
+        newline |= s[i] == '\n';
+
+    if (record)
+        journal_add(true, line_start(line) + col, len);
+    mark_lines(line, newline ? IDE_MAX_LINES : line);
+    editor.modified = true;
+    return true;
+}
+
+static void edit_delete(int line, int col, int len, bool record)
+{
+    int pos = line_start(line) + col;
+    bool newline = false;
+
+    for (int i = 0; i < len && pos + i < text_length(); i++)
+        newline |= text_at(pos + i) == '\n';
+
+    if (record)
+        journal_add(false, pos, len);
+    buffer_delete(line, col, len);
+    mark_lines(line, newline ? IDE_MAX_LINES : line);
+    editor.modified = true;
+}
+
+/* Puts an entry's text back in at its position. */
+static void journal_put_back(const UndoOp *op)
+{
+    char chunk[64];
+    int done = 0;
+
+    while (done < op->len)
+    {
+        int n = op->len - done < (int)sizeof(chunk) ? op->len - done : (int)sizeof(chunk);
+
+        for (int i = 0; i < n; i++)
+        {
+            int index = op->backward ? op->len - 1 - (done + i) : done + i;
+            chunk[i] = undo_text[(op->text + index) % UNDO_TEXT];
+        }
+
+        int line = line_of(op->pos + done);
+        edit_insert(line, op->pos + done - line_start(line), chunk, n, false);
+        done += n;
+    }
+}
+
+static void journal_take_out(const UndoOp *op)
+{
+    int line = line_of(op->pos);
+    edit_delete(line, op->pos - line_start(line), op->len, false);
+}
+
+static void undo(void)
+{
+    const UndoOp *op;
+
+    do
+    {
+        if (undo_next == undo_first)
+            return;
+
+        op = undo_op(--undo_next);
+        undo_sealed = true;
 
-        if (len < MAX_LINE_LEN - 1)
+        if (op->insert)
         {
-            line[len] = c;
-            line[len + 1] = '\0';
+            journal_take_out(op);
+            cursor_to(op->pos);
         }
+        else
+        {
+            journal_put_back(op);
+            cursor_to(op->pos + op->len);
+        }
+    } while (op->joined);
+}
+
+static void redo(void)
+{
+    do
+    {
+        if (undo_next == undo_end)
+            return;
+
+        const UndoOp *op = undo_op(undo_next++);
+        undo_sealed = true;
+
+        if (op->insert)
+        {
+            journal_put_back(op);
+            cursor_to(op->pos + op->len);
+        }
+        else
+        {
+            journal_take_out(op);
+            cursor_to(op->pos);
+        }
+    } while (undo_next < undo_end && undo_op(undo_next)->joined);
+}
+
+void overwrite_char(char c)
+{
+    if (editor.cursor_line >= line_count())
+        return;
+
+    int len = line_len(editor.cursor_line);
+
+    if (editor.cursor_col < len)
+    {
+        edit_delete(editor.cursor_line, editor.cursor_col, 1, true);
+        edit_insert(editor.cursor_line, editor.cursor_col, &c, 1, true);
+    }
+    else if (len >= MAX_LINE_LEN - 1 || !edit_insert(editor.cursor_line, len, &c, 1, true))
+    {
+        return;
     }
 
     editor.cursor_col++;
-    editor.modified = true;
 }
 
 static uint8_t read_scancode(void)
@@ -153,6 +633,16 @@ static void write_char_at(int x, int y, char c, uint8_t color)
     }
 }
 
+/* Writes value right-aligned in width columns. */
+static void write_number(int x, int y, int value, int width, uint8_t color)
+{
+    char digits[12];
+    int len = str_len(itoa(value, digits, 10));
+
+    for (int i = 0; i < width; i++)
+        write_char_at(x + i, y, i < width - len ? ' ' : digits[i - (width - len)], color);
+}
+
 static void clear_memory(void *ptr, int size)
 {
     char *p = (char *)ptr;
@@ -162,11 +652,12 @@ static void clear_memory(void *ptr, int size)
     }
 }
 
-void ide_open_file(const char *filename)
+/* Loads the file, or fails if it holds a NUL or does not fit in the
+   buffer, so that a cut-down copy is never saved over it. */
+bool ide_open_file(const char *filename)
 {
 
     str_copy(editor.filename, filename);
-    editor.line_count = 1;
     editor.cursor_line = 0;
     editor.cursor_col = 0;
     editor.modified = false;
@@ -175,96 +666,70 @@ void ide_open_file(const char *filename)
     editor.shift_pressed = false;
     editor.caps_lock = false;
     editor.scroll_offset = 0;
+    editor.crlf = false;
+    frame_drawn = false;
 
-    for (int i = 0; i < MAX_LINES; i++)
-    {
-        for (int j = 0; j < MAX_LINE_LEN; j++)
-        {
-            editor.lines[i][j] = '\0';
-        }
-    }
+    buffer_clear();
+    journal_reset();
 
     File *file = fs_find_file(filename);
 
     if (file && file->type == 'F')
     {
-        char *content = file->content;
-        int size = file->size;
-        int line = 0;
-        int col = 0;
+        IDE_Buffer *b = &editor.buf;
+        char chunk[FS_BLOCK_SIZE];
         int pos = 0;
+        int n;
 
-        int last_valid_line = 0;
-        int last_valid_col = 0;
-
-        while (pos < size && line < MAX_LINES)
+        /* The gaps start out at the end, so loading is appending. */
+        while ((n = fs_read(file, pos, chunk, sizeof(chunk))) > 0)
         {
-            char c = content[pos];
-
-            if (c == '\n')
+            for (int i = 0; i < n; i++)
             {
+                char c = chunk[i];
 
-                if (col < MAX_LINE_LEN)
+                if (c == '\0' || b->gap_start == b->gap_end)
+                    return false;
+                if (c == '\n')
                 {
-                    editor.lines[line][col] = '\0';
+                    if (b->line_gap == b->line_gap_end)
+                        return false;
+                    b->line_ids[b->line_gap] = ++b->next_id;
+                    b->line_starts[b->line_gap++] = b->gap_start + 1;
                 }
-
-                if (col > 0)
-                {
-                    last_valid_line = line;
-                    last_valid_col = col;
-                }
-
-                line++;
-                col = 0;
-                pos++;
-            }
-            else if (c == '\r')
-            {
-
-                pos++;
-            }
-            else if (c == '\0')
-            {
-
-                break;
-            }
-            else
-            {
-
-                if (col < MAX_LINE_LEN - 1)
-                {
-                    editor.lines[line][col] = c;
-                    col++;
-                    last_valid_line = line;
-                    last_valid_col = col;
-                }
-                pos++;
+                b->text[b->gap_start++] = c;
             }
+            pos += n;
         }
 
-        if (col > 0 && line < MAX_LINES)
-        {
-            editor.lines[line][col] = '\0';
-            last_valid_line = line;
-            last_valid_col = col;
-            line++;
-        }
+        /* If every line ends in CR LF, the CRs come out here and go back
+           in on save; otherwise they stay in the text as they are. */
+        editor.crlf = line_count() > 1;
+        for (int line = 1; line < line_count() && editor.crlf; line++)
+            editor.crlf = line_start(line) >= 2 && b->text[line_start(line) - 2] == '\r';
 
-        if (line > 0)
+        if (editor.crlf)
         {
-            editor.line_count = line;
-        }
-
-        editor.cursor_line = last_valid_line;
-        editor.cursor_col = last_valid_col;
+            int write = 0;
+            int line = 1;
 
-        if (editor.line_count == 1 && editor.lines[0][0] == '\0')
-        {
-            editor.cursor_line = 0;
-            editor.cursor_col = 0;
+            for (int read = 0; read < b->gap_start; read++)
+            {
+                if (b->text[read] == '\r' && read + 1 < b->gap_start && b->text[read + 1] == '\n')
+                    continue;
+                b->text[write++] = b->text[read];
+                if (b->text[read] == '\n')
+                    b->line_starts[line++] = write;
+            }
+            b->gap_start = write;
         }
+
+        editor.cursor_line = line_count() - 1;
+        editor.cursor_col = line_len(editor.cursor_line);
+        if (editor.cursor_line >= IDE_HEIGHT)
+            editor.scroll_offset = editor.cursor_line - IDE_HEIGHT + 1;
     }
+    return true;
 }
 
 static bool has_t_extension(const char *filename)
@@ -288,23 +753,24 @@ static bool has_t_extension(const char *filename)
     return false;
 }
 
-static void draw_line_with_highlight(int x, int y, const char *line, int line_num)
+/* Colours the start of a line into cells, as VGA character and attribute
+   pairs.  Returns how many cells it filled. */
+static int highlight_line(const char *line, uint16_t *cells)
 {
     int i = 0;
-    int col = x;
+    int col = 0;
     bool in_comment = false;
 
-    while (line[i] && col < 77)
+    while (line[i] && col < IDE_VIEW_COLS)
     {
         char current_char = line[i];
 
         if (current_char == '#')
         {
 
-            for (int j = i; line[j] && col < 77; j++)
+            for (int j = i; line[j] && col < IDE_VIEW_COLS; j++)
             {
-                write_char_at(col, y, line[j], COLOR_COMMENT);
-                col++;
+                cells[col++] = (uint16_t)(uint8_t)line[j] | (uint16_t)COLOR_COMMENT << 8;
             }
             break;
         }
@@ -325,18 +791,16 @@ static void draw_line_with_highlight(int x, int y, const char *line, int line_nu
 
             if (string_end > string_start)
             {
-                for (int j = i; j <= string_end && col < 77; j++)
+                for (int j = i; j <= string_end && col < IDE_VIEW_COLS; j++)
                 {
-                    write_char_at(col, y, line[j], COLOR_STRING);
-                    col++;
+                    cells[col++] = (uint16_t)(uint8_t)line[j] | (uint16_t)COLOR_STRING << 8;
                 }
                 i = string_end + 1;
                 continue;
             }
             else
             {
-                write_char_at(col, y, current_char, COLOR_NORMAL);
-                col++;
+                cells[col++] = (uint16_t)(uint8_t)current_char | (uint16_t)COLOR_NORMAL << 8;
                 i++;
                 continue;
             }
@@ -394,10 +858,9 @@ static void draw_line_with_highlight(int x, int y, const char *line, int line_nu
                 color = COLOR_EXTERNAL;
             }
 
-            for (int j = 0; j < word_len && col < 77; j++)
+            for (int j = 0; j < word_len && col < IDE_VIEW_COLS; j++)
             {
-                write_char_at(col, y, word[j], color);
-                col++;
+                cells[col++] = (uint16_t)(uint8_t)word[j] | (uint16_t)color << 8;
             }
 
             continue;
@@ -410,27 +873,94 @@ static void draw_line_with_highlight(int x, int y, const char *line, int line_nu
             current_char == '%' || current_char == '&')
         {
 
-            write_char_at(col, y, current_char, COLOR_OPERATION);
-            col++;
+            cells[col++] = (uint16_t)(uint8_t)current_char | (uint16_t)COLOR_OPERATION << 8;
             i++;
             continue;
         }
 
         if (current_char == '@')
         {
-            write_char_at(col, y, current_char, COLOR_MISC);
-            col++;
+            cells[col++] = (uint16_t)(uint8_t)current_char | (uint16_t)COLOR_MISC << 8;
             i++;
             continue;
         }
 
-        write_char_at(col, y, current_char, COLOR_NORMAL);
-        col++;
+        cells[col++] = (uint16_t)(uint8_t)current_char | (uint16_t)COLOR_NORMAL << 8;
         i++;
     }
+
+    return col;
 }
 
-void draw_editor(void)
+/* Highlighted lines, found by line id, so a line is lexed again only
+   after its text changes.  Nothing in TLANG spans lines, so every line
+   is lexed from the same starting state. */
+typedef struct
+{
+    uint32_t id;
+    int len;
+    uint16_t cells[IDE_VIEW_COLS];
+} HL_Line;
+
+static HL_Line hl_cache[HL_CACHE_SLOTS];
+
+static const HL_Line *highlighted(int line)
+{
+    uint32_t id = line_id(line);
+    HL_Line *entry = &hl_cache[id % HL_CACHE_SLOTS];
+
+    if (entry->id != id)
+    {
+        char text[IDE_LINE_VIEW];
+
+        line_copy(line, text, sizeof(text));
+        entry->len = highlight_line(text, entry->cells);
+        entry->id = id;
+    }
+    return entry;
+}
+
+/*
+ * Search uses Boyer-Moore-Horspool: the pattern is compared last
+ * character first, and on a mismatch slides along by how far the text
+ * character under its last position is from the pattern's end, or by
+ * its whole length when that character is not in it.  While a search
+ * is shown its matches are coloured on the rows being drawn.
+ */
+static char find_text[MAX_LINE_LEN];
+static int find_len;
+static int find_skip[256];
+static bool find_shown;
+
+static void find_prepare(void)
+{
+    for (int c = 0; c < 256; c++)
+        find_skip[c] = find_len;
+    for (int i = 0; i < find_len - 1; i++)
+        find_skip[(uint8_t)find_text[i]] = find_len - 1 - i;
+}
+
+/* The first match in text[from..len), or -1. */
+static int find_in(const char *text, int len, int from)
+{
+    int last = find_len - 1;
+
+    if (find_len == 0)
+        return -1;
+
+    for (int pos = from; pos + find_len <= len; pos += find_skip[(uint8_t)text[pos + last]])
+    {
+        int i = last;
+
+        while (i >= 0 && text[pos + i] == find_text[i])
+            i--;
+        if (i < 0)
+            return pos;
+    }
+    return -1;
+}
+
+static void draw_frame(void)
 {
     clear_screen();
 
@@ -449,150 +979,84 @@ void draw_editor(void)
     write_at(4, 1, "T84 IDE - ", 0x1F);
     write_at(14, 1, editor.filename, 0x1F);
 
-    for (int i = 0; i < IDE_HEIGHT; i++)
-    {
-        int line_y = i + 2;
-        int file_line = i + editor.scroll_offset;
-
-        char line_num[6];
-        if (file_line + 1 < 10)
-        {
-            line_num[0] = ' ';
-            line_num[1] = '0' + (file_line + 1);
-            line_num[2] = ' ';
-            line_num[3] = ' ';
-            line_num[4] = '\0';
-        }
-        else
-        {
-            line_num[0] = '0' + ((file_line + 1) / 10);
-            line_num[1] = '0' + ((file_line + 1) % 10);
-            line_num[2] = ' ';
-            line_num[3] = ' ';
-            line_num[4] = '\0';
-        }
-        write_at(4, line_y, line_num, 0x0B);
-
-        if (file_line < editor.line_count)
-        {
-
-            if (has_t_extension(editor.filename))
-            {
-                draw_line_with_highlight(8, line_y, editor.lines[file_line], file_line);
-            }
-            else
-            {
-
-                write_at(8, line_y, editor.lines[file_line], 0x07);
-            }
-
-            if (file_line == editor.cursor_line)
-            {
-                write_char_at(8 + editor.cursor_col, line_y, '_', 0x0F);
-            }
-        }
-    }
-
-    write_at(4, IDE_HEIGHT + 3, "ESC:Exit  ENTER:NewLine  CTRL+S:Save  BACKSPACE:Delete", 0x1F);
-
-    char status[60];
-    str_copy(status, "Line: ");
-
-    char line_num[4];
-    if (editor.cursor_line + 1 < 10)
-    {
-        line_num[0] = '0' + (editor.cursor_line + 1);
-        line_num[1] = '\0';
-    }
-    else
-    {
-        line_num[0] = '0' + ((editor.cursor_line + 1) / 10);
-        line_num[1] = '0' + ((editor.cursor_line + 1) % 10);
-        line_num[2] = '\0';
-    }
-    str_copy(status + str_len(status), line_num);
+    write_at(4, IDE_HEIGHT + 3, "ESC:Exit  ^S:Save  ^Z:Undo ^Y:Redo  ^F:Find ^H:Replace", 0x1F);
+}
 
-    str_copy(status + str_len(status), " Col: ");
+static void draw_row(int row)
+{
+    int line_y = row + 2;
+    int file_line = row + editor.scroll_offset;
 
-    char col_num[4];
-    if (editor.cursor_col + 1 < 10)
-    {
-        col_num[0] = '0' + (editor.cursor_col + 1);
-        col_num[1] = '\0';
-    }
-    else
-    {
-        col_num[0] = '0' + ((editor.cursor_col + 1) / 10);
-        col_num[1] = '0' + ((editor.cursor_col + 1) % 10);
-        col_num[2] = '\0';
-    }
-    str_copy(status + str_len(status), col_num);
+    for (int x = 3; x < 80; x++)
+        write_char_at(x, line_y, ' ', 0x07);
+    write_char_at(77, line_y, '|', 0x1F);
 
-    str_copy(status + str_len(status), " [");
+    write_number(3, line_y, file_line + 1, 4, 0x0B);
 
-    char scroll_info[10];
-    if (editor.line_count <= IDE_HEIGHT)
-    {
-        str_copy(scroll_info, "ALL");
-    }
-    else
+    if (file_line < line_count())
     {
-        char scroll_start[4], scroll_end[4];
-
-        if (editor.scroll_offset + 1 < 10)
+        if (has_t_extension(editor.filename))
         {
-            scroll_start[0] = '0' + (editor.scroll_offset + 1);
-            scroll_start[1] = '\0';
+            uint16_t *vga = (uint16_t *)0xB8000;
+            const HL_Line *hl = highlighted(file_line);
+
+            memcpy(&vga[line_y * 80 + 8], hl->cells, hl->len * sizeof(uint16_t));
         }
         else
         {
-            scroll_start[0] = '0' + ((editor.scroll_offset + 1) / 10);
-            scroll_start[1] = '0' + ((editor.scroll_offset + 1) % 10);
-            scroll_start[2] = '\0';
-        }
+            char line[IDE_LINE_VIEW];
 
-        int last_visible = editor.scroll_offset + IDE_HEIGHT;
-        if (last_visible > editor.line_count)
-            last_visible = editor.line_count;
+            line_copy(file_line, line, sizeof(line));
+            write_at(8, line_y, line, 0x07);
+        }
 
-        if (last_visible < 10)
+        if (find_shown)
         {
-            scroll_end[0] = '0' + last_visible;
-            scroll_end[1] = '\0';
+            uint16_t *vga = (uint16_t *)0xB8000;
+            char line[IDE_LINE_VIEW];
+            int len = line_copy(file_line, line, sizeof(line));
+
+            for (int pos = find_in(line, len, 0); pos >= 0; pos = find_in(line, len, pos + find_len))
+            {
+                for (int i = pos; i < pos + find_len && i < IDE_VIEW_COLS; i++)
+                    vga[line_y * 80 + 8 + i] = (vga[line_y * 80 + 8 + i] & 0xFF) | COLOR_MATCH << 8;
+            }
         }
-        else
+
+        if (file_line == editor.cursor_line)
         {
-            scroll_end[0] = '0' + (last_visible / 10);
-            scroll_end[1] = '0' + (last_visible % 10);
-            scroll_end[2] = '\0';
+            write_char_at(8 + editor.cursor_col, line_y, '_', 0x0F);
         }
-
-        str_copy(scroll_info, scroll_start);
-        str_copy(scroll_info + str_len(scroll_info), "-");
-        str_copy(scroll_info + str_len(scroll_info), scroll_end);
     }
+}
 
-    str_copy(status + str_len(status), scroll_info);
-    str_copy(status + str_len(status), "/");
+/* Moves the rows on screen up by delta rows, or down when it is
+   negative. */
+static void scroll_rows(int delta)
+{
+    uint16_t *vga = (uint16_t *)0xB8000;
+    int keep = IDE_HEIGHT - (delta > 0 ? delta : -delta);
 
-    char total_lines[6];
-    if (editor.line_count < 10)
-    {
-        total_lines[0] = '0' + editor.line_count;
-        total_lines[1] = '\0';
-    }
-    else if (editor.line_count < 100)
-    {
-        total_lines[0] = '0' + (editor.line_count / 10);
-        total_lines[1] = '0' + (editor.line_count % 10);
-        total_lines[2] = '\0';
-    }
+    if (delta > 0)
+        memmove(&vga[2 * 80], &vga[(2 + delta) * 80], keep * 80 * sizeof(uint16_t));
     else
-    {
-        str_copy(total_lines, "99+");
-    }
-    str_copy(status + str_len(status), total_lines);
-    str_copy(status + str_len(status), "] ");
+        memmove(&vga[(2 - delta) * 80], &vga[2 * 80], keep * 80 * sizeof(uint16_t));
+}
+
+static void draw_status(void)
+{
+    char status[80];
+    int total = line_count();
+    int last_visible = editor.scroll_offset + IDE_HEIGHT;
+
+    if (last_visible > total)
+        last_visible = total;
+
+    if (total <= IDE_HEIGHT)
+        sprintf(status, "Line: %d Col: %d [ALL/%d] ", editor.cursor_line + 1, editor.cursor_col + 1, total);
+    else
+        sprintf(status, "Line: %d Col: %d [%d-%d/%d] ", editor.cursor_line + 1, editor.cursor_col + 1,
+                editor.scroll_offset + 1, last_visible, total);
 
     str_copy(status + str_len(status), editor.modified ? "[MODIFIED]" : "[SAVED]");
 
@@ -610,161 +1074,160 @@ void draw_editor(void)
     else
         str_copy(status + str_len(status), " [NO-HL]");
 
+    for (int x = 4; x < 80; x++)
+        write_char_at(x, IDE_HEIGHT + 4, ' ', 0x07);
     write_at(4, IDE_HEIGHT + 4, status, 0x1F);
 }
 
-void insert_char(char c)
-{
-    if (editor.cursor_line >= MAX_LINES)
-        return;
 
-    char *line = editor.lines[editor.cursor_line];
-    int len = str_len(line);
+void draw_editor(void)
+{
+    int delta = editor.scroll_offset - drawn_scroll;
+    bool cursor_moved = editor.cursor_line != drawn_cursor_line || editor.cursor_col != drawn_cursor_col;
+    bool all = !frame_drawn || delta >= IDE_HEIGHT || delta <= -IDE_HEIGHT;
 
-    if (len >= MAX_LINE_LEN - 1)
-        return;
+    if (!frame_drawn)
+    {
+        draw_frame();
+        frame_drawn = true;
+    }
+    else if (!all && delta)
+    {
+        scroll_rows(delta);
+    }
 
-    for (int i = len; i >= editor.cursor_col; i--)
+    for (int row = 0; row < IDE_HEIGHT; row++)
     {
-        line[i + 1] = line[i];
+        int file_line = row + editor.scroll_offset;
+        bool uncovered = delta > 0 ? row >= IDE_HEIGHT - delta : row < -delta;
+
+        if (all || uncovered || (file_line >= dirty_first && file_line <= dirty_last) ||
+            (cursor_moved && (file_line == editor.cursor_line || file_line == drawn_cursor_line)))
+        {
+            draw_row(row);
+        }
     }
 
-    line[editor.cursor_col] = c;
+    draw_status();
+
+    drawn_scroll = editor.scroll_offset;
+    drawn_cursor_line = editor.cursor_line;
+    drawn_cursor_col = editor.cursor_col;
+    dirty_first = IDE_MAX_LINES;
+    dirty_last = -1;
+}
+
+void insert_char(char c)
+{
+    if (line_len(editor.cursor_line) >= MAX_LINE_LEN - 1)
+        return;
+    if (!edit_insert(editor.cursor_line, editor.cursor_col, &c, 1, true))
+        return;
+
     editor.cursor_col++;
-    editor.modified = true;
 }
 
 void delete_char(void)
 {
-    if (editor.cursor_line >= editor.line_count)
+    if (editor.cursor_line >= line_count())
         return;
 
-    char *line = editor.lines[editor.cursor_line];
-    int len = str_len(line);
-
     if (editor.cursor_col > 0)
     {
-
-        for (int i = editor.cursor_col - 1; i < len; i++)
-        {
-            line[i] = line[i + 1];
-        }
+        edit_delete(editor.cursor_line, editor.cursor_col - 1, 1, true);
         editor.cursor_col--;
-        editor.modified = true;
     }
     else if (editor.cursor_line > 0)
     {
+        int prev_len = line_len(editor.cursor_line - 1);
 
-        char *prev_line = editor.lines[editor.cursor_line - 1];
-        int prev_len = str_len(prev_line);
-
-        if (prev_len + len < MAX_LINE_LEN - 1)
+        if (prev_len + line_len(editor.cursor_line) < MAX_LINE_LEN - 1)
         {
-
-            for (int i = 0; i < len; i++)
-            {
-                prev_line[prev_len + i] = line[i];
-            }
-            prev_line[prev_len + len] = '\0';
-
-            for (int i = editor.cursor_line; i < editor.line_count - 1; i++)
-            {
-                str_copy(editor.lines[i], editor.lines[i + 1]);
-            }
-            editor.line_count--;
+            edit_delete(editor.cursor_line - 1, prev_len, 1, true);
 
             editor.cursor_line--;
             editor.cursor_col = prev_len;
-            editor.modified = true;
         }
     }
 }
 
 void new_line(void)
 {
-    if (editor.line_count >= MAX_LINES - 1)
+    if (!edit_insert(editor.cursor_line, editor.cursor_col, "\n", 1, true))
         return;
 
-    char *current_line = editor.lines[editor.cursor_line];
-    int len = str_len(current_line);
-
-    if (editor.cursor_col < len)
-    {
-        for (int i = editor.line_count; i > editor.cursor_line + 1; i--)
-        {
-            str_copy(editor.lines[i], editor.lines[i - 1]);
-        }
-
-        char *new_line = editor.lines[editor.cursor_line + 1];
-        int j = 0;
-        for (int i = editor.cursor_col; i < len; i++)
-        {
-            new_line[j++] = current_line[i];
-        }
-        new_line[j] = '\0';
-
-        current_line[editor.cursor_col] = '\0';
-
-        editor.line_count++;
-    }
-    else
-    {
-        if (editor.line_count < MAX_LINES - 1)
-        {
-            for (int i = editor.line_count; i > editor.cursor_line + 1; i--)
-            {
-                str_copy(editor.lines[i], editor.lines[i - 1]);
-            }
-            editor.lines[editor.cursor_line + 1][0] = '\0';
-            editor.line_count++;
-        }
-    }
-
     editor.cursor_line++;
     editor.cursor_col = 0;
-    editor.modified = true;
-
-    if (editor.cursor_line >= editor.scroll_offset + IDE_HEIGHT)
-    {
-        editor.scroll_offset = editor.cursor_line - IDE_HEIGHT + 1;
-    }
+    scroll_to_cursor();
 
     draw_editor();
 }
 
-void save_file(void)
+/* Writes text out, putting the CR back before each LF in a CR LF file.
+   Returns the bytes written, or -1 if the file system took fewer. */
+static int save_span(int fd, const char *text, int len)
 {
+    char chunk[FS_BLOCK_SIZE];
+    int n = 0;
+    int total = 0;
 
-    char content[2048];
-    int pos = 0;
+    if (!editor.crlf)
+        return fs_fwrite(fd, text, len) == len ? len : -1;
 
-    for (int i = 0; i < editor.line_count && pos < 2047; i++)
+    for (int i = 0; i < len; i++)
     {
-        int len = str_len(editor.lines[i]);
-
-        for (int j = 0; j < len && pos < 2047; j++)
-        {
-            content[pos++] = editor.lines[i][j];
-        }
-
-        if (i < editor.line_count - 1 && pos < 2047)
+        if (n >= (int)sizeof(chunk) - 1)
         {
-            content[pos++] = '\n';
+            if (fs_fwrite(fd, chunk, n) != n)
+                return -1;
+            total += n;
+            n = 0;
         }
+        if (text[i] == '\n')
+            chunk[n++] = '\r';
+        chunk[n++] = text[i];
     }
+    if (fs_fwrite(fd, chunk, n) != n)
+        return -1;
+    return total + n;
+}
 
-    content[pos] = '\0';
-
-    fs_write(editor.filename, content);
+/* Writes the text over the file and only then cuts it to the new
+   length, so a failed save never leaves it truncated.  The buffer stays
+   marked modified unless every write went through. */
+bool save_file(void)
+{
+    const IDE_Buffer *b = &editor.buf;
+    int fd = fs_open(editor.filename, FS_O_WRITE | FS_O_CREATE);
+    int first = -1;
+    int second = -1;
+    bool ok = false;
 
-    editor.modified = false;
+    if (fd >= 0)
+    {
+        first = save_span(fd, b->text, b->gap_start);
+        if (first >= 0)
+            second = save_span(fd, &b->text[b->gap_end], IDE_TEXT_MAX - b->gap_end);
+        ok = second >= 0 && fs_ftruncate(fd, first + second);
+        fs_close(fd);
+    }
 
-    write_at(4, IDE_HEIGHT + 5, "File saved successfully!", 0x0A);
+    if (ok)
+    {
+        editor.modified = false;
+        undo_sealed = true;
+        write_at(4, IDE_HEIGHT + 5, "File saved successfully!", 0x0A);
+    }
+    else
+    {
+        write_at(4, IDE_HEIGHT + 5, "Save failed!", 0x0C);
+    }
 
     for (volatile int i = 0; i < 500000; i++)
         ;
 
     write_at(4, IDE_HEIGHT + 5, "                       ", 0x07);
+    return ok;
 }
 
 static char scancode_to_char(uint8_t scancode, bool shift_pressed, bool caps_lock)
@@ -803,6 +1266,257 @@ static char scancode_to_char(uint8_t scancode, bool shift_pressed, bool caps_loc
     return base_char;
 }
 
+/* Takes one key for a line being typed on the message row.  Returns
+   KEY_ENTER or KEY_ESC for those keys, 1 when text changed, else 0. */
+static int prompt_key(char *text, int *len, int max)
+{
+    static bool got_e0 = false;
+
+    if (!keyboard_available())
+    {
+        sched_wait_input(0);
+        return 0;
+    }
+
+    uint8_t scancode = get_key_scancode();
+
+    if (scancode == 0xE0 || got_e0)
+    {
+        got_e0 = scancode == 0xE0;
+        return 0;
+    }
+
+    if (scancode & 0x80)
+    {
+        uint8_t key = scancode & 0x7F;
+
+        if (key == KEY_LCTRL)
+            editor.ctrl_pressed = false;
+        else if (key == KEY_LSHIFT || key == KEY_RSHIFT)
+            editor.shift_pressed = false;
+        return 0;
+    }
+
+    switch (scancode)
+    {
+    case KEY_ESC:
+    case KEY_ENTER:
+        return scancode;
+
+    case KEY_BACKSPACE:
+        if (*len == 0)
+            return 0;
+        text[--*len] = '\0';
+        return 1;
+
+    case KEY_LCTRL:
+        editor.ctrl_pressed = true;
+        return 0;
+
+    case KEY_LSHIFT:
+    case KEY_RSHIFT:
+        editor.shift_pressed = true;
+        return 0;
+
+    case KEY_CAPSLOCK:
+        editor.caps_lock = !editor.caps_lock;
+        return 0;
+    }
+
+    char c = scancode_to_char(scancode, editor.shift_pressed, editor.caps_lock);
+
+    if (!c || editor.ctrl_pressed || *len >= max - 1)
+        return 0;
+    text[(*len)++] = c;
+    text[*len] = '\0';
+    return 1;
+}
+
+static void show_prompt(const char *label, const char *text, uint8_t color)
+{
+    for (int x = 4; x < 80; x++)
+        write_char_at(x, IDE_HEIGHT + 5, ' ', 0x07);
+    write_at(4, IDE_HEIGHT + 5, label, color);
+    write_at(4 + str_len(label), IDE_HEIGHT + 5, text, 0x0F);
+}
+
+/* Reads a line on the message row; false if ESC cancels it. */
+static bool prompt(const char *label, char *text, int max)
+{
+    int len = 0;
+    int key;
+
+    text[0] = '\0';
+    show_prompt(label, text, 0x0E);
+
+    while ((key = prompt_key(text, &len, max)) != KEY_ENTER && key != KEY_ESC)
+    {
+        if (key)
+            show_prompt(label, text, 0x0E);
+    }
+
+    show_prompt("", "", 0x07);
+    return key == KEY_ENTER;
+}
+
+/* Moves the cursor to the next match at or after from, wrapping round
+   to the top.  The text is first gathered at the start of the buffer so
+   it can be scanned in one piece. */
+static bool find_next(int from)
+{
+    IDE_Buffer *b = &editor.buf;
+    int len = text_length();
+
+    gap_move(len);
+
+    int pos = find_in(b->text, len, from);
+    if (pos < 0)
+        pos = find_in(b->text, len, 0);
+    if (pos < 0)
+        return false;
+
+    cursor_to(pos);
+    undo_sealed = true;
+    return true;
+}
+
+/* Ctrl+F: searches as the pattern is typed, from the cursor or the
+   match it is on; ENTER goes on to the next match and ESC leaves the
+   cursor on the current one. */
+static void find(void)
+{
+    const char *label = "Find (ENTER:Next ESC:Done): ";
+    int origin = line_start(editor.cursor_line) + editor.cursor_col;
+    int key;
+
+    find_len = 0;
+    find_text[0] = '\0';
+    find_shown = true;
+    show_prompt(label, find_text, 0x0E);
+
+    while ((key = prompt_key(find_text, &find_len, sizeof(find_text))) != KEY_ESC)
+    {
+        if (!key)
+            continue;
+
+        find_prepare();
+
+        bool found = find_len == 0 || find_next(key == KEY_ENTER ? origin + 1 : origin);
+
+        if (found)
+            origin = line_start(editor.cursor_line) + editor.cursor_col;
+
+        mark_lines(0, IDE_MAX_LINES);
+        draw_editor();
+        show_prompt(label, find_text, found ? 0x0E : 0x0C);
+    }
+
+    find_shown = false;
+    mark_lines(0, IDE_MAX_LINES);
+    show_prompt("", "", 0x07);
+    draw_editor();
+}
+
+/* Replaces every match of the find pattern with the len characters of
+   with, all in one pass: the text is gathered at the end of the buffer
+   and copied forward to its start, matches swapped on the way.  Neither
+   side holds a newline, so lines keep their number and their starts
+   move by the change in length before them.  Returns the number
+   replaced, or -1 when the result would not fit. */
+static int replace_all(const char *with, int len)
+{
+    IDE_Buffer *b = &editor.buf;
+    int total = text_length();
+    int lines = line_count();
+    int diff = len - find_len;
+    int count = 0;
+
+    gap_move(0);
+    line_gap_move(lines);
+
+    const char *src = &b->text[b->gap_end];
+
+    for (int pos = find_in(src, total, 0); pos >= 0; pos = find_in(src, total, pos + find_len))
+        count++;
+
+    if (count == 0 || total + count * diff > IDE_TEXT_MAX)
+        return count ? -1 : 0;
+
+    bool record = 2 * count <= UNDO_OPS && count * (find_len + len) <= UNDO_TEXT;
+    if (!record)
+        journal_reset();
+
+    int read = 0;
+    int write = 0;
+    int line = 0;
+    int shift = 0;
+
+    for (int pos = find_in(src, total, 0); pos >= 0; pos = find_in(src, total, pos + find_len))
+    {
+        while (line + 1 < lines && b->line_starts[line + 1] <= pos)
+            b->line_starts[++line] += shift;
+        b->line_ids[line] = ++b->next_id;
+
+        memmove(&b->text[write], &src[read], pos - read);
+        write += pos - read;
+        memmove(&b->text[write], with, len);
+
+        if (record)
+        {
+            journal_add_text(false, write, find_text, find_len, read > 0);
+            if (len)
+                journal_add_text(true, write, with, len, true);
+        }
+
+        write += len;
+        read = pos + find_len;
+        shift += diff;
+    }
+
+    while (++line < lines)
+        b->line_starts[line] += shift;
+
+    memmove(&b->text[write], &src[read], total - read);
+    b->gap_start = write + total - read;
+    b->gap_end = IDE_TEXT_MAX;
+
+    int line_length = line_len(editor.cursor_line);
+    if (editor.cursor_col > line_length)
+        editor.cursor_col = line_length;
+
+    mark_lines(0, IDE_MAX_LINES);
+    editor.modified = true;
+    return count;
+}
+
+/* Ctrl+H: asks for a pattern and its replacement and replaces all. */
+static void replace(void)
+{
+    char with[MAX_LINE_LEN];
+    char message[80];
+
+    if (!prompt("Replace: ", find_text, sizeof(find_text)) || !find_text[0] ||
+        !prompt("With: ", with, sizeof(with)))
+        return;
+
+    find_len = str_len(find_text);
+    find_prepare();
+
+    int count = replace_all(with, str_len(with));
+
+    draw_editor();
+    if (count < 0)
+        sprintf(message, "Replace would not fit in the buffer");
+    else
+        sprintf(message, "Replaced %d", count);
+    show_prompt(message, "", count < 0 ? 0x0C : 0x0A);
+
+    for (volatile int i = 0; i < 500000; i++)
+        ;
+
+    show_prompt("", "", 0x07);
+}
+
 void handle_scancode(uint8_t scancode)
 {
     static bool got_e0 = false;
@@ -834,16 +1548,16 @@ void handle_scancode(uint8_t scancode)
                         editor.scroll_offset = editor.cursor_line;
                     }
 
-                    int line_len = str_len(editor.lines[editor.cursor_line]);
-                    if (editor.cursor_col > line_len)
+                    int line_length = line_len(editor.cursor_line);
+                    if (editor.cursor_col > line_length)
                     {
-                        editor.cursor_col = line_len;
+                        editor.cursor_col = line_length;
                     }
                 }
                 break;
 
             case KEY_DOWN:
-                if (editor.cursor_line < editor.line_count - 1)
+                if (editor.cursor_line < line_count() - 1)
                 {
                     editor.cursor_line++;
 
@@ -852,10 +1566,10 @@ void handle_scancode(uint8_t scancode)
                         editor.scroll_offset = editor.cursor_line - IDE_HEIGHT + 1;
                     }
 
-                    int line_len = str_len(editor.lines[editor.cursor_line]);
-                    if (editor.cursor_col > line_len)
+                    int line_length = line_len(editor.cursor_line);
+                    if (editor.cursor_col > line_length)
                     {
-                        editor.cursor_col = line_len;
+                        editor.cursor_col = line_length;
                     }
                 }
                 break;
@@ -868,7 +1582,7 @@ void handle_scancode(uint8_t scancode)
                 else if (editor.cursor_line > 0)
                 {
                     editor.cursor_line--;
-                    editor.cursor_col = str_len(editor.lines[editor.cursor_line]);
+                    editor.cursor_col = line_len(editor.cursor_line);
 
                     if (editor.cursor_line < editor.scroll_offset)
                     {
@@ -878,11 +1592,11 @@ void handle_scancode(uint8_t scancode)
                 break;
 
             case KEY_RIGHT:
-                if (editor.cursor_col < str_len(editor.lines[editor.cursor_line]))
+                if (editor.cursor_col < line_len(editor.cursor_line))
                 {
                     editor.cursor_col++;
                 }
-                else if (editor.cursor_line < editor.line_count - 1)
+                else if (editor.cursor_line < line_count() - 1)
                 {
                     editor.cursor_line++;
                     editor.cursor_col = 0;
@@ -897,6 +1611,7 @@ void handle_scancode(uint8_t scancode)
 
             if (editor.cursor_line != old_line || editor.cursor_col != old_col)
             {
+                undo_sealed = true;
                 draw_editor();
             }
         }
@@ -939,9 +1654,13 @@ void handle_scancode(uint8_t scancode)
                     {
                         if (resp == 0x15)
                         {
-                            save_file();
-                            editor.should_exit = true;
+                            editor.should_exit = save_file();
                             got_response = true;
+                            if (!editor.should_exit)
+                            {
+                                write_at(4, IDE_HEIGHT + 5, "                         ", 0x07);
+                                draw_editor();
+                            }
                         }
                         else if (resp == 0x31)
                         {
@@ -993,17 +1712,8 @@ void handle_scancode(uint8_t scancode)
         if (editor.ctrl_pressed)
         {
 
-            char *current_line = editor.lines[editor.cursor_line];
-            int len = str_len(current_line);
-
-            if (len > 0)
+            if (line_copy(editor.cursor_line, ide_clipboard, sizeof(ide_clipboard)) > 0)
             {
-                int copy_len = (len < 255) ? len : 255;
-                for (int i = 0; i < copy_len; i++)
-                {
-                    ide_clipboard[i] = current_line[i];
-                }
-                ide_clipboard[copy_len] = '\0';
                 ide_clipboard_has_content = true;
 
                 write_at(4, IDE_HEIGHT + 5, "Line copied to clipboard!", 0x0A);
@@ -1030,10 +1740,12 @@ void handle_scancode(uint8_t scancode)
 
             if (ide_clipboard_has_content)
             {
+                undo_sealed = true;
                 for (int i = 0; ide_clipboard[i]; i++)
                 {
                     insert_char(ide_clipboard[i]);
                 }
+                undo_sealed = true;
 
                 write_at(4, IDE_HEIGHT + 5, "Pasted from clipboard!", 0x0A);
                 for (volatile int i = 0; i < 200000; i++)
@@ -1064,6 +1776,47 @@ void handle_scancode(uint8_t scancode)
         editor.caps_lock = !editor.caps_lock;
         break;
 
+    case KEY_Z:
+    case KEY_Y:
+        if (editor.ctrl_pressed)
+        {
+            if (scancode == KEY_Z)
+                undo();
+            else
+                redo();
+            draw_editor();
+        }
+        else
+        {
+            char c = scancode_to_char(scancode, editor.shift_pressed, editor.caps_lock);
+            if (c)
+            {
+                insert_char(c);
+                draw_editor();
+            }
+        }
+        break;
+
+    case KEY_F:
+    case KEY_H:
+        if (editor.ctrl_pressed)
+        {
+            if (scancode == KEY_F)
+                find();
+            else
+                replace();
+        }
+        else
+        {
+            char c = scancode_to_char(scancode, editor.shift_pressed, editor.caps_lock);
+            if (c)
+            {
+                insert_char(c);
+                draw_editor();
+            }
+        }
+        break;
+
     case KEY_S:
         if (editor.ctrl_pressed)
         {
@@ -1104,9 +1857,10 @@ void ide_run(void)
             uint8_t scancode = get_key_scancode();
             handle_scancode(scancode);
         }
-
-        for (volatile int i = 0; i < 1000; i++)
-            ;
+        else
+        {
+            sched_wait_input(0);
+        }
     }
 
     clear_screen();
@@ -1176,7 +1930,11 @@ void cmd_open_ide(const char *args)
     for (volatile int i = 0; i < 1000000; i++)
         ;
 
-    ide_open_file(filename);
+    if (!ide_open_file(filename))
+    {
+        terminal_writeall("Error: %s is not a text file that fits in 4IDE (64 KB, 8192 lines)\n", filename);
+        return;
+    }
     ide_run();
 }
 
@@ -3,6 +3,13 @@
 #include "../../../kernel/vga.h"
 #include "../../../kernel/keyboard.h"
 #include "../../../kernel/kernel.h"
+#include "../../../kernel/sched.h"
+#include "../../../kernel/smp.h"
+#include "../../../kernel/timer.h"
+#include "../../../kernel/cpu.h"
+#include "../../../kernel/string_utils.h"
+#include "../../../kernel/ramfs.h"
+#include "../../../kernel/bcache.h"
 #include <stdbool.h>
 
 #define STAT_WIDTH 60
@@ -24,10 +31,7 @@ static void clear_screen_area(int x, int y, int w, int h, uint8_t color)
 
     for (int row = 0; row < h; row++)
     {
-        for (int col = 0; col < w; col++)
-        {
-            vga[(y + row) * 80 + (x + col)] = blank;
-        }
+        memset16(vga + (y + row) * 80 + x, blank, w);
     }
 }
 
@@ -79,9 +83,18 @@ static void draw_bar(int x, int y, int width, int percent, uint8_t color)
     }
 
     char percent_str[8];
-    percent_str[0] = ' ';
-    percent_str[1] = '0' + (percent / 10);
-    percent_str[2] = '0' + (percent % 10);
+    if (percent >= 100)
+    {
+        percent_str[0] = '1';
+        percent_str[1] = '0';
+        percent_str[2] = '0';
+    }
+    else
+    {
+        percent_str[0] = ' ';
+        percent_str[1] = '0' + (percent / 10);
+        percent_str[2] = '0' + (percent % 10);
+    }
     percent_str[3] = '%';
     percent_str[4] = '\0';
 
@@ -102,26 +115,41 @@ static int get_used_memory(void)
 
 static int get_cpu_count(void)
 {
-
-    return 1;
+    return smp_cpu_count();
 }
 
 static int get_cpu_usage(void)
 {
+    return sched_cpu_usage();
+}
+
+static uint32_t get_disk_space(void)
+{
+    uint32_t total_kb, used_kb;
 
-    return 15;
+    return fs_disk_usage(&total_kb, &used_kb) ? total_kb : 0;
 }
 
-static int get_disk_space(void)
+static uint32_t get_used_disk(void)
 {
+    uint32_t total_kb, used_kb;
 
-    return 20;
+    return fs_disk_usage(&total_kb, &used_kb) ? used_kb : 0;
 }
 
-static int get_used_disk(void)
+static void format_size(char *out, uint32_t kb)
 {
+    if (kb >= 10 * 1024)
+        sprintf(out, "%u MB", kb / 1024);
+    else
+        sprintf(out, "%u KB", kb);
+}
 
-    return 8;
+static int percent_of(uint32_t part, uint32_t total)
+{
+    if (!total)
+        return 0;
+    return total >= 100 ? part / (total / 100) : part * 100 / total;
 }
 
 static const char *get_system_name(void)
@@ -131,13 +159,52 @@ static const char *get_system_name(void)
 
 static const char *get_cpu_name(void)
 {
-    return "Intel 8086/286 Compatible";
+    static char name[43];
+    const char *brand = cpu_get_info()->brand;
+    int i = 0;
+
+    while (brand[i] && i < (int)sizeof(name) - 1)
+    {
+        name[i] = brand[i];
+        i++;
+    }
+    name[i] = '\0';
+
+    return name;
 }
 
-static const char *get_uptime(void)
+static const char *get_cpu_speed(void)
 {
+    static char speed[16];
+    uint32_t khz = timer_get_tsc_khz();
+
+    if (!khz)
+        return "Unknown";
 
-    return "00:15:32";
+    sprintf(speed, "%u MHz", (khz + 500) / 1000);
+    return speed;
+}
+
+static const char *get_uptime(void)
+{
+    static char uptime[9];
+    uint32_t seconds = timer_get_uptime_seconds();
+    uint32_t hours = (seconds / 3600) % 100;
+    uint32_t minutes = (seconds / 60) % 60;
+
+    seconds %= 60;
+
+    uptime[0] = '0' + hours / 10;
+    uptime[1] = '0' + hours % 10;
+    uptime[2] = ':';
+    uptime[3] = '0' + minutes / 10;
+    uptime[4] = '0' + minutes % 10;
+    uptime[5] = ':';
+    uptime[6] = '0' + seconds / 10;
+    uptime[7] = '0' + seconds % 10;
+    uptime[8] = '\0';
+
+    return uptime;
 }
 
 void show_system_stats(void)
@@ -164,7 +231,7 @@ void show_system_stats(void)
     y++;
 
     write_at_color(STAT_START_X + 4, y, "Architecture: ", STAT_LABEL_COLOR);
-    write_at_color(STAT_START_X + 18, y, "x86 16-bit", STAT_VALUE_COLOR);
+    write_at_color(STAT_START_X + 18, y, "x86 32-bit (i386)", STAT_VALUE_COLOR);
 }
 
 void show_memory_stats(void)
@@ -240,7 +307,47 @@ void show_cpu_stats(void)
     y++;
 
     write_at_color(STAT_START_X + 34, y, "Speed:   ", STAT_LABEL_COLOR);
-    write_at_color(STAT_START_X + 43, y, "4.77 MHz", STAT_VALUE_COLOR);
+    write_at_color(STAT_START_X + 43, y, get_cpu_speed(), STAT_VALUE_COLOR);
+}
+
+void show_task_stats(void)
+{
+    int x = STAT_START_X + 40;
+    int y = STAT_START_Y + 8;
+
+    write_at_color(x, y, "Tasks:", STAT_HEADER_COLOR);
+    y += 2;
+
+    int shown = 0;
+    for (int i = 0; i < MAX_TASKS && shown < 5; i++)
+    {
+        Task *task = sched_get_task(i);
+        if (!task)
+            continue;
+
+        char line[20];
+        int pos = 0;
+
+        for (int j = 0; task->name[j] && pos < 12; j++)
+        {
+            line[pos++] = task->name[j];
+        }
+        while (pos < 13)
+        {
+            line[pos++] = ' ';
+        }
+
+        uint32_t usage = task->usage > 100 ? 100 : task->usage;
+        line[pos++] = usage >= 100 ? '1' : ' ';
+        line[pos++] = usage >= 10 ? '0' + (usage / 10) % 10 : ' ';
+        line[pos++] = '0' + usage % 10;
+        line[pos++] = '%';
+        line[pos] = '\0';
+
+        write_at_color(x + 2, y, line, STAT_VALUE_COLOR);
+        y++;
+        shown++;
+    }
 }
 
 void show_disk_stats(void)
@@ -250,43 +357,32 @@ void show_disk_stats(void)
     write_at_color(STAT_START_X + 2, y, "Disk Usage:", STAT_HEADER_COLOR);
     y += 2;
 
-    int total_disk = get_disk_space();
-    int used_disk = get_used_disk();
-    int free_disk = total_disk - used_disk;
-    int percent_used = (used_disk * 100) / total_disk;
+    uint32_t total_disk = get_disk_space();
+    uint32_t used_disk = get_used_disk();
+
+    if (!total_disk)
+    {
+        write_at_color(STAT_START_X + 4, y, "No disk", STAT_LABEL_COLOR);
+        return;
+    }
+
+    uint32_t free_disk = total_disk - used_disk;
+    int percent_used = percent_of(used_disk, total_disk);
 
     char disk_str[32];
 
     write_at_color(STAT_START_X + 4, y, "Total:  ", STAT_LABEL_COLOR);
-    int pos = 0;
-    disk_str[pos++] = '0' + (total_disk / 10);
-    disk_str[pos++] = '0' + (total_disk % 10);
-    disk_str[pos++] = ' ';
-    disk_str[pos++] = 'M';
-    disk_str[pos++] = 'B';
-    disk_str[pos] = '\0';
+    format_size(disk_str, total_disk);
     write_at_color(STAT_START_X + 13, y, disk_str, STAT_VALUE_COLOR);
     y++;
 
     write_at_color(STAT_START_X + 4, y, "Used:   ", STAT_LABEL_COLOR);
-    pos = 0;
-    disk_str[pos++] = '0' + (used_disk / 10);
-    disk_str[pos++] = '0' + (used_disk % 10);
-    disk_str[pos++] = ' ';
-    disk_str[pos++] = 'M';
-    disk_str[pos++] = 'B';
-    disk_str[pos] = '\0';
+    format_size(disk_str, used_disk);
     write_at_color(STAT_START_X + 13, y, disk_str, STAT_VALUE_COLOR);
     y++;
 
     write_at_color(STAT_START_X + 4, y, "Free:   ", STAT_LABEL_COLOR);
-    pos = 0;
-    disk_str[pos++] = '0' + (free_disk / 10);
-    disk_str[pos++] = '0' + (free_disk % 10);
-    disk_str[pos++] = ' ';
-    disk_str[pos++] = 'M';
-    disk_str[pos++] = 'B';
-    disk_str[pos] = '\0';
+    format_size(disk_str, free_disk);
     write_at_color(STAT_START_X + 13, y, disk_str, STAT_VALUE_COLOR);
     y++;
 
@@ -294,18 +390,169 @@ void show_disk_stats(void)
     draw_bar(STAT_START_X + 13, y, 20, percent_used, STAT_BAR_COLOR);
 }
 
+void show_cpu_details(void)
+{
+    const CpuInfo *info = cpu_get_info();
+    int y = STAT_START_Y + 2;
+    char line[64];
+
+    write_at_color(STAT_START_X + 2, y, "CPU Details:", STAT_HEADER_COLOR);
+    y += 2;
+
+    write_at_color(STAT_START_X + 4, y, "Vendor:       ", STAT_LABEL_COLOR);
+    write_at_color(STAT_START_X + 18, y, info->vendor, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Brand:        ", STAT_LABEL_COLOR);
+    write_at_color(STAT_START_X + 18, y, get_cpu_name(), STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Signature:    ", STAT_LABEL_COLOR);
+    sprintf(line, "family %u model %u stepping %u", info->family, info->model, info->stepping);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Clock:        ", STAT_LABEL_COLOR);
+    write_at_color(STAT_START_X + 18, y, get_cpu_speed(), STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "L1 cache:     ", STAT_LABEL_COLOR);
+    sprintf(line, "%uK data, %uK code, %u byte lines", info->l1d_kb, info->l1i_kb, info->line_size);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "L2/L3 cache:  ", STAT_LABEL_COLOR);
+    sprintf(line, "%uK / %uK", info->l2_kb, info->l3_kb);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y += 2;
+
+    write_at_color(STAT_START_X + 4, y, "Features:", STAT_LABEL_COLOR);
+    y++;
+
+    int x = STAT_START_X + 6;
+    for (int bit = 0; bit < CPU_FEATURE_COUNT; bit++)
+    {
+        if (!(info->features & (1u << bit)))
+            continue;
+
+        const char *name = cpu_feature_name(bit);
+        int len = strlen(name);
+
+        if (x + len > STAT_START_X + STAT_WIDTH)
+        {
+            x = STAT_START_X + 6;
+            y++;
+        }
+        write_at_color(x, y, name, STAT_VALUE_COLOR);
+        x += len + 1;
+    }
+    y += 2;
+
+    write_at_color(STAT_START_X + 4, y, "mem*:         ", STAT_LABEL_COLOR);
+    write_at_color(STAT_START_X + 18, y, string_impl_name(), STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Timer:        ", STAT_LABEL_COLOR);
+    write_at_color(STAT_START_X + 18, y, timer_mode_name(), STAT_VALUE_COLOR);
+}
+
+void show_disk_details(void)
+{
+    BcacheStats cache;
+    int y = STAT_START_Y + 2;
+    char line[64];
+
+    write_at_color(STAT_START_X + 2, y, "Disk Details:", STAT_HEADER_COLOR);
+    y += 2;
+
+    if (!ata_drive_count())
+    {
+        write_at_color(STAT_START_X + 4, y, "No ATA disks", STAT_LABEL_COLOR);
+        y++;
+    }
+
+    for (int i = 0; i < ata_drive_count(); i++)
+    {
+        const AtaDrive *d = ata_drive(i);
+
+        sprintf(line, "hd%d:", i);
+        write_at_color(STAT_START_X + 4, y, line, STAT_LABEL_COLOR);
+        sprintf(line, "%s, %u MB, %s", d->model, d->sectors / 2048, d->dma ? "DMA" : "PIO");
+        write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+        y++;
+    }
+    y++;
+
+    bcache_get_stats(&cache);
+
+    write_at_color(STAT_START_X + 2, y, "Block Cache:", STAT_HEADER_COLOR);
+    y += 2;
+
+    write_at_color(STAT_START_X + 4, y, "Size:         ", STAT_LABEL_COLOR);
+    sprintf(line, "%u x %u KB blocks", BCACHE_BLOCKS, BCACHE_BLOCK_SIZE / 1024);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Hits/misses:  ", STAT_LABEL_COLOR);
+    sprintf(line, "%u / %u", cache.hits, cache.misses);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Hit rate:     ", STAT_LABEL_COLOR);
+    draw_bar(STAT_START_X + 18, y, 20, percent_of(cache.hits, cache.hits + cache.misses), STAT_BAR_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Evictions:    ", STAT_LABEL_COLOR);
+    sprintf(line, "%u", cache.evictions);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Read-ahead:   ", STAT_LABEL_COLOR);
+    sprintf(line, "%u blocks", cache.readahead);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+    y++;
+
+    write_at_color(STAT_START_X + 4, y, "Write-backs:  ", STAT_LABEL_COLOR);
+    sprintf(line, "%u, %u dirty", cache.writebacks, cache.dirty);
+    write_at_color(STAT_START_X + 18, y, line, STAT_VALUE_COLOR);
+}
+
+typedef enum
+{
+    PAGE_OVERVIEW,
+    PAGE_CPU,
+    PAGE_DISK
+} StatPage;
+
+static StatPage page = PAGE_OVERVIEW;
+
 void show_all_stats(void)
 {
 
     clear_screen_area(STAT_START_X + 1, STAT_START_Y + 1, STAT_WIDTH, STAT_HEIGHT, 0x07);
 
-    show_system_stats();
-    show_memory_stats();
-    show_cpu_stats();
-    show_disk_stats();
+    if (page == PAGE_CPU)
+    {
+        show_cpu_details();
+    }
+    else if (page == PAGE_DISK)
+    {
+        show_disk_details();
+    }
+    else
+    {
+        show_system_stats();
+        show_memory_stats();
+        show_cpu_stats();
+        show_task_stats();
+        show_disk_stats();
+    }
 
+    clear_screen_area(STAT_START_X, STAT_START_Y + STAT_HEIGHT + 2, STAT_WIDTH, 1, 0x07);
     write_at_color(STAT_START_X + 2, STAT_START_Y + STAT_HEIGHT + 2,
-                   "Press any key to refresh, ESC to exit", STAT_BORDER_COLOR);
+                   page != PAGE_OVERVIEW ? "C/D: overview  any key: refresh  ESC: exit"
+                                         : "C: CPU  D: disk  any key: refresh  ESC: exit",
+                   STAT_BORDER_COLOR);
 }
 
 void cstat_run(void)
@@ -315,6 +562,8 @@ void cstat_run(void)
     draw_border();
     show_all_stats();
 
+    uint32_t last_refresh = timer_get_ticks();
+
     while (running)
     {
         if (keyboard_available())
@@ -329,13 +578,24 @@ void cstat_run(void)
             }
             else
             {
+                if (c == 'c' || c == 'C')
+                    page = page == PAGE_CPU ? PAGE_OVERVIEW : PAGE_CPU;
+                else if (c == 'd' || c == 'D')
+                    page = page == PAGE_DISK ? PAGE_OVERVIEW : PAGE_DISK;
 
                 show_all_stats();
+                last_refresh = timer_get_ticks();
             }
         }
-
-        for (volatile int i = 0; i < 10000; i++)
-            ;
+        else if (timer_get_ticks() - last_refresh >= TIMER_HZ)
+        {
+            show_all_stats();
+            last_refresh = timer_get_ticks();
+        }
+        else
+        {
+            sched_wait_input(100);
+        }
     }
 
     terminal_clear();
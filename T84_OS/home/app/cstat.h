@@ -6,5 +6,6 @@ void cmd_cstat(const char *args);
 void show_system_stats(void);
 void show_memory_stats(void);
 void show_cpu_stats(void);
+void show_task_stats(void);
 void show_disk_stats(void);
 #endif
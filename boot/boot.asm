@@ -16,12 +16,17 @@ header_end:
 
 section .text
 global _start
+global multiboot_magic
+global multiboot_info
 extern kernel_main
 
 _start:
     mov esp, stack_top
     and esp, 0xFFFFFFF0
 
+    mov [multiboot_magic], eax
+    mov [multiboot_info], ebx
+
     call kernel_main
 
     cli
@@ -30,6 +35,12 @@ _start:
     jmp .hang
 
 section .bss
+align 4
+multiboot_magic:
+    resd 1
+multiboot_info:
+    resd 1
+
 align 16
 stack_bottom:
     resb 16384
@@ -28,6 +28,24 @@ gcc -m32 -ffreestanding -O2 -c kernel/misc.c -o build/misc.o -I./kernel -nostdli
 gcc -m32 -ffreestanding -O2 -c T84_OS/home/app/4IDE.c -o build/apps/4IDE.o -I./kernel -nostdlib -fno-builtin
 gcc -m32 -ffreestanding -O2 -c kernel/tlang.c -o build/tlang.o -I./kernel -nostdlib -fno-builtin
 gcc -m32 -ffreestanding -O2 -c T84_OS/home/app/cstat.c -o build/apps/cstat.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/gdt.c -o build/gdt.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/isr.c -o build/isr.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -c kernel/interrupts.S -o build/interrupts.o
+gcc -m32 -ffreestanding -O2 -c kernel/timer.c -o build/timer.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/sched.c -o build/sched.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/acpi.c -o build/acpi.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/apic.c -o build/apic.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/cpu.c -o build/cpu.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/strbench.c -o build/strbench.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/cmdtable.c -o build/cmdtable.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/floatfmt.c -o build/floatfmt.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/multiboot.c -o build/multiboot.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/pci.c -o build/pci.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/ata.c -o build/ata.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/bcache.c -o build/bcache.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/fat.c -o build/fat.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -ffreestanding -O2 -c kernel/smp.c -o build/smp.o -I./kernel -nostdlib -fno-builtin
+gcc -m32 -c kernel/trampoline.S -o build/trampoline.o
 
 ld -m elf_i386 \
   -T linker.ld \
@@ -51,10 +69,30 @@ ld -m elf_i386 \
   build/misc.o \
   build/apps/4IDE.o \
   build/tlang.o \
-  build/apps/cstat.o
+  build/apps/cstat.o \
+  build/gdt.o \
+  build/isr.o \
+  build/interrupts.o \
+  build/timer.o \
+  build/sched.o \
+  build/acpi.o \
+  build/apic.o \
+  build/cpu.o \
+  build/strbench.o \
+  build/cmdtable.o \
+  build/floatfmt.o \
+  build/multiboot.o \
+  build/pci.o \
+  build/ata.o \
+  build/bcache.o \
+  build/fat.o \
+  build/smp.o \
+  build/trampoline.o
 
 cp build/kernel.elf isodir/boot/
 
+tar --format=ustar --sort=name --owner=0 --group=0 -cf isodir/boot/initrd.tar -C T84_OS/initrd home
+
 cat > isodir/boot/grub/grub.cfg << EOF
 set timeout=0
 set default=0
@@ -62,6 +100,7 @@ set default=0
 menuentry "T84 OS" {
     insmod multiboot2
     multiboot2 /boot/kernel.elf
+    module2 /boot/initrd.tar initrd
     boot
 }
 EOF
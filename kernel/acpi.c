@@ -0,0 +1,193 @@
+#include "acpi.h"
+#include "string_utils.h"
+
+typedef struct
+{
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) ACPI_RSDP;
+
+typedef struct
+{
+    ACPI_SDTHeader header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) ACPI_MADT;
+
+#define MADT_LOCAL_APIC 0
+#define MADT_IO_APIC 1
+#define MADT_LAPIC_OVERRIDE 5
+
+static ACPI_RSDP *rsdp = NULL;
+static int cpu_count = 0;
+static uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+static uint32_t lapic_address = 0;
+static uint32_t ioapic_address = 0;
+
+static bool acpi_checksum(const void *data, uint32_t length)
+{
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static ACPI_RSDP *acpi_scan_rsdp(uint32_t start, uint32_t length)
+{
+    for (uint32_t addr = start; addr < start + length; addr += 16)
+    {
+        ACPI_RSDP *candidate = (ACPI_RSDP *)addr;
+
+        if (memcmp(candidate->signature, "RSD PTR ", 8) == 0 &&
+            acpi_checksum(candidate, 20))
+        {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+ACPI_SDTHeader *acpi_find_table(const char *signature)
+{
+    if (!rsdp)
+        return NULL;
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && rsdp->xsdt_address < 0xFFFFFFFFULL)
+    {
+        ACPI_SDTHeader *xsdt = (ACPI_SDTHeader *)(uint32_t)rsdp->xsdt_address;
+        int entries = (xsdt->length - sizeof(ACPI_SDTHeader)) / 8;
+        uint64_t *tables = (uint64_t *)(xsdt + 1);
+
+        for (int i = 0; i < entries; i++)
+        {
+            if (tables[i] >= 0xFFFFFFFFULL)
+                continue;
+
+            ACPI_SDTHeader *table = (ACPI_SDTHeader *)(uint32_t)tables[i];
+            if (memcmp(table->signature, signature, 4) == 0 &&
+                acpi_checksum(table, table->length))
+            {
+                return table;
+            }
+        }
+        return NULL;
+    }
+
+    ACPI_SDTHeader *rsdt = (ACPI_SDTHeader *)rsdp->rsdt_address;
+    int entries = (rsdt->length - sizeof(ACPI_SDTHeader)) / 4;
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+
+    for (int i = 0; i < entries; i++)
+    {
+        ACPI_SDTHeader *table = (ACPI_SDTHeader *)tables[i];
+        if (memcmp(table->signature, signature, 4) == 0 &&
+            acpi_checksum(table, table->length))
+        {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+static void acpi_parse_madt(ACPI_MADT *madt)
+{
+    lapic_address = madt->lapic_address;
+
+    uint8_t *entry = (uint8_t *)(madt + 1);
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+
+    while (entry + 2 <= end && entry[1] >= 2)
+    {
+        uint8_t type = entry[0];
+        uint8_t length = entry[1];
+
+        if (type == MADT_LOCAL_APIC && length >= 8)
+        {
+            uint32_t flags = *(uint32_t *)(entry + 4);
+
+            /* Bit 0: enabled, bit 1: can be brought online. */
+            if ((flags & 0x3) && cpu_count < ACPI_MAX_CPUS)
+            {
+                cpu_apic_ids[cpu_count++] = entry[3];
+            }
+        }
+        else if (type == MADT_IO_APIC && length >= 12 && !ioapic_address)
+        {
+            ioapic_address = *(uint32_t *)(entry + 4);
+        }
+        else if (type == MADT_LAPIC_OVERRIDE && length >= 12)
+        {
+            uint64_t address = *(uint64_t *)(entry + 4);
+            if (address < 0xFFFFFFFFULL)
+            {
+                lapic_address = (uint32_t)address;
+            }
+        }
+
+        entry += length;
+    }
+}
+
+bool acpi_init(void)
+{
+    if (rsdp)
+        return true;
+
+    /* The BIOS data area keeps the EBDA segment at 0x40E. */
+    uint16_t ebda_segment;
+    __asm__ volatile("movw 0x40E, %0" : "=r"(ebda_segment));
+    uint32_t ebda = (uint32_t)ebda_segment << 4;
+
+    if (ebda)
+    {
+        rsdp = acpi_scan_rsdp(ebda, 1024);
+    }
+    if (!rsdp)
+    {
+        rsdp = acpi_scan_rsdp(0xE0000, 0x20000);
+    }
+    if (!rsdp)
+        return false;
+
+    ACPI_MADT *madt = (ACPI_MADT *)acpi_find_table("APIC");
+    if (madt)
+    {
+        acpi_parse_madt(madt);
+    }
+
+    return true;
+}
+
+int acpi_cpu_count(void)
+{
+    return cpu_count;
+}
+
+uint8_t acpi_cpu_apic_id(int index)
+{
+    if (index < 0 || index >= cpu_count)
+        return 0;
+
+    return cpu_apic_ids[index];
+}
+
+uint32_t acpi_lapic_address(void)
+{
+    return lapic_address;
+}
+
+uint32_t acpi_ioapic_address(void)
+{
+    return ioapic_address;
+}
@@ -0,0 +1,30 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ACPI_MAX_CPUS 8
+
+typedef struct
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) ACPI_SDTHeader;
+
+bool acpi_init(void);
+ACPI_SDTHeader *acpi_find_table(const char *signature);
+
+int acpi_cpu_count(void);
+uint8_t acpi_cpu_apic_id(int index);
+uint32_t acpi_lapic_address(void);
+uint32_t acpi_ioapic_address(void);
+
+#endif
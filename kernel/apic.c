@@ -0,0 +1,135 @@
+#include "apic.h"
+#include "cpu.h"
+#include <stddef.h>
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_APIC_BASE_BSP 0x100
+#define IA32_APIC_BASE_X2APIC 0x400
+#define IA32_APIC_BASE_ENABLE 0x800
+
+/* x2APIC registers are MSRs at 0x800 + (MMIO offset / 16). */
+#define X2APIC_MSR_BASE 0x800
+
+#define LVT_MASKED 0x10000
+#define LVT_EXTINT 0x700
+#define LVT_NMI 0x400
+
+static volatile uint32_t *lapic = NULL;
+
+static bool x2apic = false;
+
+uint32_t lapic_read(uint32_t reg)
+{
+    if (x2apic)
+        return (uint32_t)rdmsr(X2APIC_MSR_BASE + reg / 16);
+
+    return lapic[reg / 4];
+}
+
+void lapic_write(uint32_t reg, uint32_t value)
+{
+    if (x2apic)
+    {
+        wrmsr(X2APIC_MSR_BASE + reg / 16, value);
+        return;
+    }
+
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4];
+}
+
+/* Called once on every CPU: the registers are banked per core. */
+bool lapic_init(uint32_t base)
+{
+    if (!cpu_has(CPU_FEATURE_APIC) || !cpu_has(CPU_FEATURE_MSR))
+        return false;
+
+    uint64_t apic_base = rdmsr(IA32_APIC_BASE_MSR);
+    uint32_t low = (uint32_t)apic_base;
+
+    if (!(low & IA32_APIC_BASE_ENABLE))
+    {
+        low |= IA32_APIC_BASE_ENABLE;
+        wrmsr(IA32_APIC_BASE_MSR, (apic_base & 0xFFFFFFFF00000000ULL) | low);
+    }
+
+    /* MSR access avoids the uncached MMIO page; EN must be set before EXTD. */
+    if (cpu_has(CPU_FEATURE_X2APIC) && !(low & IA32_APIC_BASE_X2APIC))
+    {
+        low |= IA32_APIC_BASE_X2APIC;
+        wrmsr(IA32_APIC_BASE_MSR, (apic_base & 0xFFFFFFFF00000000ULL) | low);
+    }
+    x2apic = (low & IA32_APIC_BASE_X2APIC) != 0;
+
+    if (!base)
+    {
+        base = low & 0xFFFFF000;
+    }
+    lapic = (volatile uint32_t *)base;
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+
+    /* The 8259 keeps delivering legacy IRQs to the BSP through LINT0. */
+    if (low & IA32_APIC_BASE_BSP)
+    {
+        lapic_write(LAPIC_LVT_LINT0, LVT_EXTINT);
+        lapic_write(LAPIC_LVT_LINT1, LVT_NMI);
+    }
+    else
+    {
+        lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LVT_MASKED);
+    }
+
+    lapic_write(LAPIC_SVR, 0x100 | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_EOI, 0);
+
+    return true;
+}
+
+bool lapic_available(void)
+{
+    return lapic != NULL;
+}
+
+uint8_t lapic_id(void)
+{
+    if (!lapic)
+        return 0;
+
+    if (x2apic)
+        return (uint8_t)lapic_read(LAPIC_ID);
+
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void)
+{
+    if (lapic)
+    {
+        lapic_write(LAPIC_EOI, 0);
+    }
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint32_t command)
+{
+    if (!lapic)
+        return;
+
+    /* One 64-bit ICR write; x2APIC has no delivery status to poll. */
+    if (x2apic)
+    {
+        wrmsr(X2APIC_MSR_BASE + LAPIC_ICR_LOW / 16, ((uint64_t)apic_id << 32) | command);
+        return;
+    }
+
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING)
+    {
+        __asm__ volatile("pause");
+    }
+}
@@ -0,0 +1,456 @@
+#include "ata.h"
+#include "ports.h"
+#include "pci.h"
+#include "isr.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "vga.h"
+#include "string_utils.h"
+
+#define ATA_REG_DATA 0
+#define ATA_REG_COUNT 2
+#define ATA_REG_LBA0 3
+#define ATA_REG_LBA1 4
+#define ATA_REG_LBA2 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_BSY 0x80
+
+#define ATA_CTRL_NIEN 0x02
+#define ATA_CTRL_SRST 0x04
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define PRD_EOT 0x8000
+
+/* 64 KB per command, so one transfer needs at most two PRDs. */
+#define ATA_CHUNK_SECTORS 128
+#define ATA_POLL_SPINS (1u << 22)
+#define ATA_DMA_TIMEOUT_US 2000000
+
+typedef struct
+{
+    uint32_t addr;
+    uint16_t bytes;
+    uint16_t flags;
+} __attribute__((packed)) AtaPrd;
+
+typedef struct
+{
+    AtaPrd prd[2];
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bm;
+    int irq;
+    bool irq_ready;
+    spinlock_t lock;
+    volatile bool irq_done;
+    volatile uint8_t bm_status;
+    Task *volatile waiter;
+} __attribute__((aligned(16))) AtaChannel;
+
+static AtaChannel channels[2] = {
+    {.io = 0x1F0, .ctrl = 0x3F6, .irq = IRQ14},
+    {.io = 0x170, .ctrl = 0x376, .irq = IRQ15}};
+
+static AtaDrive drives[ATA_MAX_DRIVES];
+static int drive_count = 0;
+static bool probed = false;
+
+/* Each alternate status read takes about 100 ns. */
+static void ata_delay(AtaChannel *ch)
+{
+    for (int i = 0; i < 4; i++)
+        inb(ch->ctrl);
+}
+
+/* Waits for BSY to clear and, if asked, for DRQ.  Fails on an error,
+   a device fault or a timeout. */
+static bool ata_poll(AtaChannel *ch, bool want_drq)
+{
+    ata_delay(ch);
+
+    for (uint32_t i = 0; i < ATA_POLL_SPINS; i++)
+    {
+        uint8_t status = inb(ch->ctrl);
+
+        if (status & ATA_SR_BSY)
+            continue;
+        if (status & (ATA_SR_ERR | ATA_SR_DF))
+            return false;
+        if (!want_drq || (status & ATA_SR_DRQ))
+            return true;
+    }
+    return false;
+}
+
+static void ata_reset(AtaChannel *ch)
+{
+    uint8_t ctrl = ch->irq_ready ? 0 : ATA_CTRL_NIEN;
+
+    outb(ch->ctrl, ctrl | ATA_CTRL_SRST);
+    ata_delay(ch);
+    outb(ch->ctrl, ctrl);
+    ata_poll(ch, false);
+}
+
+static void ata_setup(AtaChannel *ch, const AtaDrive *d, uint32_t lba, int count)
+{
+    outb(ch->io + ATA_REG_DRIVE, 0xE0 | (d->slave << 4) | ((lba >> 24) & 0x0F));
+    ata_delay(ch);
+    outb(ch->io + ATA_REG_COUNT, count & 0xFF);
+    outb(ch->io + ATA_REG_LBA0, lba & 0xFF);
+    outb(ch->io + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    outb(ch->io + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+}
+
+static bool ata_identify(AtaChannel *ch, bool slave, AtaDrive *d)
+{
+    uint16_t id[256];
+
+    outb(ch->io + ATA_REG_DRIVE, 0xA0 | (slave << 4));
+    ata_delay(ch);
+    outb(ch->io + ATA_REG_COUNT, 0);
+    outb(ch->io + ATA_REG_LBA0, 0);
+    outb(ch->io + ATA_REG_LBA1, 0);
+    outb(ch->io + ATA_REG_LBA2, 0);
+    outb(ch->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    if (inb(ch->io + ATA_REG_STATUS) == 0)
+        return false;
+
+    uint32_t spins = 0;
+    while ((inb(ch->ctrl) & ATA_SR_BSY) && ++spins < ATA_POLL_SPINS)
+        ;
+
+    /* ATAPI and SATA devices abort IDENTIFY and leave a signature. */
+    if (inb(ch->io + ATA_REG_LBA1) || inb(ch->io + ATA_REG_LBA2))
+        return false;
+    if (!ata_poll(ch, true))
+        return false;
+
+    insw(ch->io + ATA_REG_DATA, id, 256);
+
+    /* Without LBA the drive is too old to bother with. */
+    if (!(id[49] & (1 << 9)))
+        return false;
+
+    d->slave = slave;
+    d->dma = (id[49] & (1 << 8)) != 0;
+    d->sectors = id[60] | ((uint32_t)id[61] << 16);
+
+    for (int i = 0; i < 20; i++)
+    {
+        d->model[i * 2] = id[27 + i] >> 8;
+        d->model[i * 2 + 1] = id[27 + i] & 0xFF;
+    }
+    int len = 40;
+    while (len > 0 && d->model[len - 1] == ' ')
+        len--;
+    d->model[len] = '\0';
+
+    return d->sectors != 0;
+}
+
+/* Finds the IDE controller's bus master registers.  Only channels in
+   legacy mode are used, since their IRQs are known to be 14 and 15. */
+static void ata_probe_dma(void)
+{
+    PciDevice dev;
+
+    if (!pci_find_class(0x01, 0x01, &dev))
+        return;
+
+    uint32_t class_reg = pci_read32(&dev, PCI_CLASS);
+    uint8_t prog_if = (class_reg >> 8) & 0xFF;
+    uint32_t bar4 = pci_read32(&dev, PCI_BAR4);
+
+    if (!(prog_if & 0x80) || !(bar4 & 1) || !(bar4 & 0xFFFC))
+        return;
+
+    /* The status half of the register is write-one-to-clear. */
+    uint32_t command = pci_read32(&dev, PCI_COMMAND) & 0xFFFF;
+    pci_write32(&dev, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    uint16_t base = bar4 & 0xFFFC;
+    if (!(prog_if & 0x01))
+        channels[0].bm = base;
+    if (!(prog_if & 0x04))
+        channels[1].bm = base + 8;
+}
+
+/*
+ * Finds the disks with polled PIO, which works before interrupts are set
+ * up; fs_init reads the disk that early.  Runs once.
+ */
+void ata_init(void)
+{
+    if (probed)
+        return;
+    probed = true;
+
+    for (int c = 0; c < 2; c++)
+    {
+        AtaChannel *ch = &channels[c];
+
+        /* Nothing drives a missing channel's bus. */
+        if (inb(ch->io + ATA_REG_STATUS) == 0xFF)
+            continue;
+
+        ata_reset(ch);
+
+        for (int s = 0; s < 2 && drive_count < ATA_MAX_DRIVES; s++)
+        {
+            AtaDrive *d = &drives[drive_count];
+
+            d->channel = c;
+            if (ata_identify(ch, s == 1, d))
+                drive_count++;
+        }
+    }
+
+    if (drive_count)
+        ata_probe_dma();
+}
+
+static void ata_irq(registers_t *regs)
+{
+    AtaChannel *ch = &channels[regs->int_no == IRQ14 ? 0 : 1];
+
+    if (ch->bm)
+    {
+        ch->bm_status = inb(ch->bm + BM_STATUS);
+        outb(ch->bm + BM_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+    }
+
+    /* Reading the status register acknowledges the drive. */
+    inb(ch->io + ATA_REG_STATUS);
+    ch->irq_done = true;
+
+    Task *waiter = ch->waiter;
+    if (waiter)
+        task_wake(waiter);
+}
+
+/* Called once the scheduler runs: from then on DMA transfers sleep until
+   the channel's IRQ instead of polling. */
+void ata_enable_irq(void)
+{
+    for (int c = 0; c < 2; c++)
+    {
+        AtaChannel *ch = &channels[c];
+        bool used = false;
+
+        for (int i = 0; i < drive_count; i++)
+            used |= drives[i].channel == c;
+
+        if (!used || ch->irq_ready)
+            continue;
+
+        irq_install_handler(ch->irq, ata_irq);
+        ch->irq_ready = true;
+        outb(ch->ctrl, 0);
+    }
+}
+
+int ata_drive_count(void)
+{
+    return drive_count;
+}
+
+const AtaDrive *ata_drive(int index)
+{
+    if (index < 0 || index >= drive_count)
+        return NULL;
+    return &drives[index];
+}
+
+static bool ata_pio(AtaChannel *ch, const AtaDrive *d, uint32_t lba, int count, uint8_t *buf, bool write)
+{
+    if (!ata_poll(ch, false))
+        return false;
+
+    ata_setup(ch, d, lba, count);
+    outb(ch->io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+
+    for (int i = 0; i < count; i++, buf += ATA_SECTOR_SIZE)
+    {
+        if (!ata_poll(ch, true))
+            return false;
+
+        if (write)
+            outsw(ch->io + ATA_REG_DATA, buf, ATA_SECTOR_SIZE / 2);
+        else
+            insw(ch->io + ATA_REG_DATA, buf, ATA_SECTOR_SIZE / 2);
+    }
+
+    bool ok = !write || ata_poll(ch, false);
+    inb(ch->io + ATA_REG_STATUS);
+    return ok;
+}
+
+/* The buffer is used in place: there is no paging, so its address is
+   the physical one the controller needs.  The caller holds the channel
+   with spin_lock_yield, so it cannot be killed, and its buffer freed,
+   while the transfer is in flight. */
+static bool ata_dma(AtaChannel *ch, const AtaDrive *d, uint32_t lba, int count, uint8_t *buf, bool write)
+{
+    uint32_t addr = (uint32_t)buf;
+    uint32_t bytes = count * ATA_SECTOR_SIZE;
+    uint32_t first = 0x10000 - (addr & 0xFFFF);
+
+    /* A PRD may not cross a 64 KB boundary; a byte count of 0 means 64 KB. */
+    if (first >= bytes)
+    {
+        ch->prd[0] = (AtaPrd){addr, bytes & 0xFFFF, PRD_EOT};
+    }
+    else
+    {
+        ch->prd[0] = (AtaPrd){addr, first & 0xFFFF, 0};
+        ch->prd[1] = (AtaPrd){addr + first, (bytes - first) & 0xFFFF, PRD_EOT};
+    }
+
+    if (!ata_poll(ch, false))
+        return false;
+
+    outb(ch->bm + BM_COMMAND, 0);
+    outl(ch->bm + BM_PRDT, (uint32_t)ch->prd);
+    outb(ch->bm + BM_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+
+    ata_setup(ch, d, lba, count);
+
+    uint32_t flags = irq_save();
+    ch->irq_done = false;
+    ch->bm_status = 0;
+    ch->waiter = task_current();
+
+    outb(ch->io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb(ch->bm + BM_COMMAND, BM_CMD_START | (write ? 0 : BM_CMD_READ));
+
+    uint64_t deadline = timer_get_us() + ATA_DMA_TIMEOUT_US;
+    uint64_t now;
+    while (!ch->irq_done && (now = timer_get_us()) < deadline)
+        task_sleep_us((uint32_t)(deadline - now));
+
+    ch->waiter = NULL;
+    irq_restore(flags);
+
+    outb(ch->bm + BM_COMMAND, 0);
+    uint8_t status = inb(ch->io + ATA_REG_STATUS);
+
+    if (ch->irq_done && !(ch->bm_status & BM_STATUS_ERR) && !(status & (ATA_SR_ERR | ATA_SR_DF)))
+        return true;
+
+    ata_reset(ch);
+    return false;
+}
+
+static bool ata_transfer(int index, uint32_t lba, uint32_t count, uint8_t *buf, bool write)
+{
+    if (index < 0 || index >= drive_count)
+        return false;
+
+    AtaDrive *d = &drives[index];
+    AtaChannel *ch = &channels[d->channel];
+    bool ok = true;
+
+    if (lba >= d->sectors || count > d->sectors - lba)
+        return false;
+
+    spin_lock_yield(&ch->lock);
+
+    while (count && ok)
+    {
+        int n = count > ATA_CHUNK_SECTORS ? ATA_CHUNK_SECTORS : count;
+        bool dma = d->dma && ch->bm && ch->irq_ready && sched_is_running() &&
+                   !((uint32_t)buf & 1);
+
+        if (!dma || !ata_dma(ch, d, lba, n, buf, write))
+        {
+            /* A drive that failed a DMA transfer stays on PIO. */
+            if (dma)
+                d->dma = false;
+            ok = ata_pio(ch, d, lba, n, buf, write);
+        }
+
+        lba += n;
+        count -= n;
+        buf += n * ATA_SECTOR_SIZE;
+    }
+
+    spin_unlock_yield(&ch->lock);
+    return ok;
+}
+
+bool ata_read(int drive, uint32_t lba, uint32_t count, void *buf)
+{
+    return ata_transfer(drive, lba, count, buf, false);
+}
+
+bool ata_write(int drive, uint32_t lba, uint32_t count, const void *buf)
+{
+    return ata_transfer(drive, lba, count, (uint8_t *)buf, true);
+}
+
+bool ata_flush(int drive)
+{
+    if (drive < 0 || drive >= drive_count)
+        return false;
+
+    AtaDrive *d = &drives[drive];
+    AtaChannel *ch = &channels[d->channel];
+
+    spin_lock_yield(&ch->lock);
+    bool ok = ata_poll(ch, false);
+    if (ok)
+    {
+        outb(ch->io + ATA_REG_DRIVE, 0xE0 | (d->slave << 4));
+        ata_delay(ch);
+        outb(ch->io + ATA_REG_COMMAND, ATA_CMD_FLUSH);
+        ok = ata_poll(ch, false);
+        inb(ch->io + ATA_REG_STATUS);
+    }
+    spin_unlock_yield(&ch->lock);
+    return ok;
+}
+
+void cmd_disk(const char *args)
+{
+    (void)args;
+
+    if (!drive_count)
+    {
+        terminal_writestring("No ATA disks\n");
+        return;
+    }
+
+    for (int i = 0; i < drive_count; i++)
+    {
+        const AtaDrive *d = &drives[i];
+        char line[96];
+
+        sprintf(line, "hd%d: %s, %u MB, %s %s, %s\n", i, d->model, d->sectors / 2048,
+                d->channel ? "secondary" : "primary", d->slave ? "slave" : "master",
+                d->dma && channels[d->channel].bm ? "DMA" : "PIO");
+        terminal_writestring(line);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_MAX_DRIVES 4
+
+typedef struct
+{
+    uint8_t channel;
+    bool slave;
+    bool dma;
+    uint32_t sectors;
+    char model[41];
+} AtaDrive;
+
+void ata_init(void);
+void ata_enable_irq(void);
+int ata_drive_count(void);
+const AtaDrive *ata_drive(int index);
+
+bool ata_read(int drive, uint32_t lba, uint32_t count, void *buf);
+bool ata_write(int drive, uint32_t lba, uint32_t count, const void *buf);
+bool ata_flush(int drive);
+
+void cmd_disk(const char *args);
+
+#endif
@@ -0,0 +1,454 @@
+#include "bcache.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "string_utils.h"
+
+/*
+ * A write-back cache of disk blocks.  Buffers are found through a hash
+ * of (drive, block) and kept on an LRU list, most recently used first;
+ * a miss takes the buffer at the tail, writing it back first if it is
+ * dirty.  A miss on the block after the last one read from the same
+ * drive also reads up to BCACHE_READAHEAD blocks that follow, in the
+ * same command.  Dirty blocks go back to disk on bcache_sync, on
+ * eviction, or from the flusher task once they are BCACHE_WRITEBACK_MS
+ * old.
+ *
+ * The cache lock is dropped for disk I/O.  A buffer being read or
+ * written meanwhile is marked busy, and anyone else who wants it yields
+ * until it is done.  The task doing the I/O keeps the kill hold that
+ * spin_lock_yield took, so a busy buffer is always finished.
+ */
+typedef struct Buffer
+{
+    int drive;
+    uint32_t block;
+    bool valid;
+    bool dirty;
+    bool busy;
+    uint64_t dirty_since;
+    struct Buffer *hash_next;
+    struct Buffer *prev;
+    struct Buffer *next;
+    uint8_t *data;
+} Buffer;
+
+static uint8_t buffer_data[BCACHE_BLOCKS][BCACHE_BLOCK_SIZE] __attribute__((aligned(16)));
+static uint8_t staging[(1 + BCACHE_READAHEAD) * BCACHE_BLOCK_SIZE] __attribute__((aligned(16)));
+static Buffer buffers[BCACHE_BLOCKS];
+static Buffer *hash[BCACHE_HASH_BUCKETS];
+static Buffer *lru_head = NULL;
+static Buffer *lru_tail = NULL;
+static uint32_t last_block[ATA_MAX_DRIVES];
+static BcacheStats stats;
+static bool staging_busy = false;
+static bool ready = false;
+static bool flusher_started = false;
+
+static spinlock_t cache_lock = SPINLOCK_INIT;
+
+/* Takes the cache lock back after I/O, still under the caller's
+   spin_lock_yield kill hold. */
+static void cache_relock(void)
+{
+    while (!spin_trylock(&cache_lock))
+        sched_yield();
+}
+
+/* Lets whoever has a buffer busy get on with it. */
+static void cache_wait(void)
+{
+    spin_unlock(&cache_lock);
+    sched_yield();
+    cache_relock();
+}
+
+static void cache_setup(void)
+{
+    for (int i = 0; i < BCACHE_BLOCKS; i++)
+    {
+        Buffer *b = &buffers[i];
+
+        b->valid = false;
+        b->dirty = false;
+        b->data = buffer_data[i];
+        b->prev = i ? &buffers[i - 1] : NULL;
+        b->next = i < BCACHE_BLOCKS - 1 ? &buffers[i + 1] : NULL;
+    }
+    lru_head = &buffers[0];
+    lru_tail = &buffers[BCACHE_BLOCKS - 1];
+
+    for (int i = 0; i < ATA_MAX_DRIVES; i++)
+        last_block[i] = 0xFFFFFFFF;
+    ready = true;
+}
+
+static uint32_t bucket_of(int drive, uint32_t block)
+{
+    return (block * 2654435761u + drive) & (BCACHE_HASH_BUCKETS - 1);
+}
+
+static Buffer *lookup(int drive, uint32_t block)
+{
+    for (Buffer *b = hash[bucket_of(drive, block)]; b; b = b->hash_next)
+    {
+        if (b->block == block && b->drive == drive)
+            return b;
+    }
+    return NULL;
+}
+
+static void hash_remove(Buffer *b)
+{
+    Buffer **link = &hash[bucket_of(b->drive, b->block)];
+
+    while (*link && *link != b)
+        link = &(*link)->hash_next;
+    if (*link)
+        *link = b->hash_next;
+}
+
+static void lru_touch(Buffer *b)
+{
+    if (b == lru_head)
+        return;
+
+    b->prev->next = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    else
+        lru_tail = b->prev;
+
+    b->prev = NULL;
+    b->next = lru_head;
+    lru_head->prev = b;
+    lru_head = b;
+}
+
+/* Sectors of the block that exist; only a disk's last block is short. */
+static uint32_t block_sectors(const AtaDrive *d, uint32_t block)
+{
+    uint32_t left = d->sectors - block * BCACHE_BLOCK_SECTORS;
+    return left < BCACHE_BLOCK_SECTORS ? left : BCACHE_BLOCK_SECTORS;
+}
+
+/* Writes a dirty buffer back, with the cache lock dropped meanwhile. */
+static bool writeback(Buffer *b)
+{
+    const AtaDrive *d = ata_drive(b->drive);
+
+    b->busy = true;
+    spin_unlock(&cache_lock);
+    bool ok = ata_write(b->drive, b->block * BCACHE_BLOCK_SECTORS, block_sectors(d, b->block), b->data);
+    cache_relock();
+    b->busy = false;
+
+    if (!ok)
+        return false;
+
+    b->dirty = false;
+    stats.dirty--;
+    stats.writebacks++;
+    return true;
+}
+
+/* The least recently used buffer that is clean or, if write is set, can
+   be made clean.  Writing one back drops the lock, so the list is walked
+   again after. */
+static Buffer *victim(bool write)
+{
+    bool failed[BCACHE_BLOCKS] = {false};
+    Buffer *b = lru_tail;
+
+    while (b)
+    {
+        if (b->busy || failed[b - buffers])
+        {
+            b = b->prev;
+            continue;
+        }
+
+        if (b->dirty)
+        {
+            if (!write)
+            {
+                b = b->prev;
+                continue;
+            }
+            if (!writeback(b))
+                failed[b - buffers] = true;
+            b = lru_tail;
+            continue;
+        }
+
+        if (b->valid)
+        {
+            hash_remove(b);
+            stats.evictions++;
+        }
+        b->valid = false;
+        return b;
+    }
+    return NULL;
+}
+
+static void install(Buffer *b, int drive, uint32_t block)
+{
+    uint32_t bucket = bucket_of(drive, block);
+
+    b->drive = drive;
+    b->block = block;
+    b->valid = true;
+    b->hash_next = hash[bucket];
+    hash[bucket] = b;
+    lru_touch(b);
+}
+
+static void fill_block(Buffer *b, const AtaDrive *d, const uint8_t *data)
+{
+    uint32_t bytes = block_sectors(d, b->block) * ATA_SECTOR_SIZE;
+
+    if (data != b->data)
+        memcpy(b->data, data, bytes);
+    memset(b->data + bytes, 0, BCACHE_BLOCK_SIZE - bytes);
+}
+
+/* Returns the block's buffer; fill is false when the caller is about to
+   overwrite all of it, so a miss needs no read.  The buffers being read,
+   read-ahead included, are installed and kept busy while the lock is
+   dropped, so nobody else reads or writes those blocks meanwhile.
+   Read-ahead goes through the staging area, which one miss at a time
+   may use; the others read just their block. */
+static Buffer *get_block(const AtaDrive *d, int drive, uint32_t block, bool fill)
+{
+    while (1)
+    {
+        Buffer *b = lookup(drive, block);
+
+        if (b && b->busy)
+        {
+            cache_wait();
+            continue;
+        }
+        if (b)
+        {
+            stats.hits++;
+            lru_touch(b);
+            return b;
+        }
+
+        b = victim(true);
+        if (!b)
+            return NULL;
+        if (lookup(drive, block))
+            continue;
+
+        stats.misses++;
+        install(b, drive, block);
+        if (!fill)
+            return b;
+
+        uint32_t blocks = (d->sectors + BCACHE_BLOCK_SECTORS - 1) / BCACHE_BLOCK_SECTORS;
+        Buffer *run[1 + BCACHE_READAHEAD] = {b};
+        uint32_t n = 1;
+
+        /* Read-ahead takes only clean buffers, since a write-back would
+           drop the lock. */
+        if (block == last_block[drive] + 1 && !staging_busy)
+        {
+            while (n < 1 + BCACHE_READAHEAD && block + n < blocks && !lookup(drive, block + n))
+            {
+                Buffer *ahead = victim(false);
+                if (!ahead)
+                    break;
+                install(ahead, drive, block + n);
+                ahead->busy = true;
+                run[n++] = ahead;
+            }
+        }
+
+        uint32_t sectors = (n - 1) * BCACHE_BLOCK_SECTORS + block_sectors(d, block + n - 1);
+        uint8_t *into = n > 1 ? staging : b->data;
+
+        b->busy = true;
+        staging_busy |= n > 1;
+        spin_unlock(&cache_lock);
+        bool ok = ata_read(drive, block * BCACHE_BLOCK_SECTORS, sectors, into);
+        cache_relock();
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (ok)
+            {
+                fill_block(run[i], d, into + i * BCACHE_BLOCK_SIZE);
+                if (i)
+                    stats.readahead++;
+            }
+            else
+            {
+                hash_remove(run[i]);
+                run[i]->valid = false;
+            }
+            run[i]->busy = false;
+        }
+
+        if (n > 1)
+            staging_busy = false;
+        return ok ? b : NULL;
+    }
+}
+
+static bool transfer(int drive, uint32_t lba, uint32_t count, uint8_t *buf, bool write)
+{
+    const AtaDrive *d = ata_drive(drive);
+
+    if (!d || lba >= d->sectors || count > d->sectors - lba)
+        return false;
+
+    spin_lock_yield(&cache_lock);
+    if (!ready)
+        cache_setup();
+
+    bool ok = true;
+
+    while (count && ok)
+    {
+        uint32_t block = lba / BCACHE_BLOCK_SECTORS;
+        uint32_t first = lba % BCACHE_BLOCK_SECTORS;
+        uint32_t n = BCACHE_BLOCK_SECTORS - first;
+        if (n > count)
+            n = count;
+
+        bool whole = first == 0 && n == block_sectors(d, block);
+        Buffer *b = get_block(d, drive, block, !(write && whole));
+        uint8_t *data = b ? b->data + first * ATA_SECTOR_SIZE : NULL;
+
+        if (!b)
+        {
+            ok = false;
+        }
+        else if (write)
+        {
+            memcpy(data, buf, n * ATA_SECTOR_SIZE);
+            if (!b->dirty)
+            {
+                b->dirty = true;
+                b->dirty_since = timer_get_us();
+                stats.dirty++;
+            }
+        }
+        else
+        {
+            memcpy(buf, data, n * ATA_SECTOR_SIZE);
+        }
+
+        last_block[drive] = block;
+        lba += n;
+        count -= n;
+        buf += n * ATA_SECTOR_SIZE;
+    }
+
+    spin_unlock_yield(&cache_lock);
+    return ok;
+}
+
+bool bcache_read(int drive, uint32_t lba, uint32_t count, void *buf)
+{
+    return transfer(drive, lba, count, buf, false);
+}
+
+bool bcache_write(int drive, uint32_t lba, uint32_t count, const void *buf)
+{
+    return transfer(drive, lba, count, (uint8_t *)buf, true);
+}
+
+/* Writes back the drive's dirty blocks, or those of all drives, in block
+   order; only blocks dirty since before older_than.  The caller holds
+   the cache lock.  A block another task is writing back is waited for. */
+static bool flush_dirty(int drive, uint64_t older_than)
+{
+    bool tried[BCACHE_BLOCKS] = {false};
+    bool ok = true;
+
+    while (1)
+    {
+        Buffer *next = NULL;
+        bool busy = false;
+
+        for (int i = 0; i < BCACHE_BLOCKS; i++)
+        {
+            Buffer *b = &buffers[i];
+
+            if (tried[i] || !b->dirty || (drive >= 0 && b->drive != drive) || b->dirty_since > older_than)
+                continue;
+            if (b->busy)
+            {
+                busy = true;
+                continue;
+            }
+            if (!next || b->drive < next->drive ||
+                (b->drive == next->drive && b->block < next->block))
+                next = b;
+        }
+
+        if (!next && busy)
+        {
+            cache_wait();
+            continue;
+        }
+        if (!next)
+            return ok;
+
+        tried[next - buffers] = true;
+        if (!writeback(next))
+            ok = false;
+    }
+}
+
+/* Writes back every dirty block of the drive, or of all drives when
+   drive is negative, and flushes the disks' own caches. */
+bool bcache_sync(int drive)
+{
+    spin_lock_yield(&cache_lock);
+    bool ok = !ready || flush_dirty(drive, TIMER_NO_DEADLINE);
+    spin_unlock_yield(&cache_lock);
+
+    for (int i = 0; i < ata_drive_count(); i++)
+    {
+        if (drive < 0 || drive == i)
+            ok = ata_flush(i) && ok;
+    }
+    return ok;
+}
+
+static void bcache_flusher(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        task_sleep_ms(1000);
+
+        if (!stats.dirty)
+            continue;
+
+        uint64_t now = timer_get_us();
+        spin_lock_yield(&cache_lock);
+        if (now > BCACHE_WRITEBACK_MS * 1000ULL)
+            flush_dirty(-1, now - BCACHE_WRITEBACK_MS * 1000ULL);
+        spin_unlock_yield(&cache_lock);
+    }
+}
+
+void bcache_start_flusher(void)
+{
+    if (flusher_started || !ata_drive_count())
+        return;
+
+    flusher_started = task_create("bflush", bcache_flusher, NULL, TASK_PRIO_BATCH) != NULL;
+}
+
+void bcache_get_stats(BcacheStats *out)
+{
+    *out = stats;
+}
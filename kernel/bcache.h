@@ -0,0 +1,32 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ata.h"
+
+/* Disks are cached in blocks of BCACHE_BLOCK_SECTORS sectors. */
+#define BCACHE_BLOCK_SECTORS 8
+#define BCACHE_BLOCK_SIZE (BCACHE_BLOCK_SECTORS * ATA_SECTOR_SIZE)
+#define BCACHE_BLOCKS 64
+#define BCACHE_HASH_BUCKETS 128
+#define BCACHE_READAHEAD 4
+#define BCACHE_WRITEBACK_MS 5000
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t readahead;
+    uint32_t writebacks;
+    uint32_t dirty;
+} BcacheStats;
+
+bool bcache_read(int drive, uint32_t lba, uint32_t count, void *buf);
+bool bcache_write(int drive, uint32_t lba, uint32_t count, const void *buf);
+bool bcache_sync(int drive);
+void bcache_start_flusher(void);
+void bcache_get_stats(BcacheStats *stats);
+
+#endif
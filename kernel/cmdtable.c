@@ -0,0 +1,200 @@
+#include "cmdtable.h"
+#include "string_utils.h"
+#include "vga.h"
+
+/* Open addressing over names and aliases; must stay a power of two and
+   well above the number of names so probes stay short. */
+#define CMD_HASH_SIZE 256
+#define CMD_MAX_GROUPS 4
+#define CMD_HELP_COLUMN 20
+
+typedef struct
+{
+    const char *name;
+    const Command *command;
+} CommandSlot;
+
+static CommandSlot slots[CMD_HASH_SIZE];
+static int slot_count = 0;
+
+static const Command *groups[CMD_MAX_GROUPS];
+static int group_sizes[CMD_MAX_GROUPS];
+static int group_count = 0;
+
+static char lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
+
+/* FNV-1a over the lower-cased name, so lookups ignore case. */
+static uint32_t name_hash(const char *name, int len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)lower(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool name_equal(const char *name, const char *token, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (lower(name[i]) != lower(token[i]))
+            return false;
+    }
+    return name[len] == '\0';
+}
+
+static void slot_insert(const char *name, const Command *command)
+{
+    if (slot_count >= CMD_HASH_SIZE / 2)
+    {
+        terminal_writestring("cmdtable: too many command names\n");
+        return;
+    }
+
+    uint32_t i = name_hash(name, strlen(name)) & (CMD_HASH_SIZE - 1);
+    while (slots[i].name)
+    {
+        i = (i + 1) & (CMD_HASH_SIZE - 1);
+    }
+
+    slots[i].name = name;
+    slots[i].command = command;
+    slot_count++;
+}
+
+/* Safe to call again with the same array, e.g. when the shell restarts. */
+void cmdtable_register(const Command *commands, int count)
+{
+    for (int g = 0; g < group_count; g++)
+    {
+        if (groups[g] == commands)
+            return;
+    }
+
+    if (group_count >= CMD_MAX_GROUPS)
+        return;
+
+    groups[group_count] = commands;
+    group_sizes[group_count] = count;
+    group_count++;
+
+    for (int i = 0; i < count; i++)
+    {
+        slot_insert(commands[i].name, &commands[i]);
+        for (int a = 0; a < CMD_MAX_ALIASES && commands[i].aliases[a]; a++)
+        {
+            slot_insert(commands[i].aliases[a], &commands[i]);
+        }
+    }
+}
+
+/* A name may be registered once per context, so keep probing until an
+   entry for this context turns up. */
+const Command *cmdtable_find(const char *name, int len, uint8_t context)
+{
+    uint32_t i = name_hash(name, len) & (CMD_HASH_SIZE - 1);
+
+    while (slots[i].name)
+    {
+        if ((slots[i].command->contexts & context) && name_equal(slots[i].name, name, len))
+            return slots[i].command;
+        i = (i + 1) & (CMD_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+/*
+ * Splits a line in place for later execution: the command word is
+ * terminated and *args points at the rest (the token itself for "&var").
+ */
+const Command *cmdtable_prepare(char *line, uint8_t context, const char **args)
+{
+    int len = 0;
+
+    while (line[len] && line[len] != ' ')
+        len++;
+
+    *args = NULL;
+    if (len == 0)
+        return NULL;
+
+    if (line[len] == ' ')
+    {
+        line[len] = '\0';
+        *args = line + len + 1;
+    }
+
+    if (line[0] == '&')
+    {
+        *args = line;
+        return cmdtable_find("&", 1, context);
+    }
+    return cmdtable_find(line, len, context);
+}
+
+/* Returns false when the line names no command for this context. */
+bool cmdtable_execute(const char *line, uint8_t context)
+{
+    int len = 0;
+
+    while (line[len] && line[len] != ' ')
+        len++;
+    if (len == 0)
+        return false;
+
+    const char *args = line[len] == ' ' ? line + len + 1 : NULL;
+
+    if (line[0] == '&')
+    {
+        const Command *command = cmdtable_find("&", 1, context);
+        if (!command)
+            return false;
+
+        char token[64];
+        int token_len = len < 63 ? len : 63;
+        memcpy(token, line, token_len);
+        token[token_len] = '\0';
+
+        command->handler(token);
+        return true;
+    }
+
+    const Command *command = cmdtable_find(line, len, context);
+    if (!command)
+        return false;
+
+    command->handler(args);
+    return true;
+}
+
+void cmdtable_help(void)
+{
+    for (int g = 0; g < group_count; g++)
+    {
+        for (int i = 0; i < group_sizes[g]; i++)
+        {
+            const Command *command = &groups[g][i];
+
+            if (!command->help || !(command->contexts & CMD_SHELL))
+                continue;
+
+            const char *usage = command->usage ? command->usage : command->name;
+            int pad = CMD_HELP_COLUMN - (int)strlen(usage);
+
+            terminal_writestring(usage);
+            do
+            {
+                terminal_writestring(" ");
+            } while (--pad > 0);
+            terminal_writestring("- ");
+            terminal_writestring(command->help);
+            terminal_writestring("\n");
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef CMDTABLE_H
+#define CMDTABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Where a command may run: the T84> prompt, tparse scripts, or the
+   command embedded in a FOR/IF line (variables already expanded). */
+#define CMD_SHELL 0x01
+#define CMD_SCRIPT 0x02
+#define CMD_INLINE 0x04
+
+#define CMD_MAX_ALIASES 3
+
+/* A command named "&" receives the whole "&var" token as its argument. */
+typedef struct
+{
+    const char *name;
+    const char *aliases[CMD_MAX_ALIASES];
+    void (*handler)(const char *args);
+    uint8_t contexts;
+    const char *usage;
+    const char *help;
+} Command;
+
+void cmdtable_register(const Command *commands, int count);
+const Command *cmdtable_find(const char *name, int len, uint8_t context);
+const Command *cmdtable_prepare(char *line, uint8_t context, const char **args);
+bool cmdtable_execute(const char *line, uint8_t context);
+void cmdtable_help(void);
+
+#endif
@@ -1,12 +1,15 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include <stdbool.h>
+
 void cmd_help(void);
 void cmd_clear(int mode);
 void cmd_about(void);
 void cmd_draw(void);
 void cmd_test(void);
 void cmd_int(const char *args);
+void cmd_dec(const char *args);
 void cmd_string(const char *args);
 void cmd_schar(const char *args);
 void cmd_print_var(const char *args);
@@ -18,5 +21,6 @@ void cmd_div(const char *args);
 void cmd_run_example(const char *example_name);
 void cmd_list_vars(void);
 void cmd_echo(const char *args);
+bool execute_command_with_vars(const char *command);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "cpu.h"
+#include "string_utils.h"
+#include "timer.h"
+#include "vga.h"
+
+#define EFLAGS_ID 0x00200000
+
+static CpuInfo cpu_info;
+static bool cpu_detected = false;
+
+static const char *feature_names[CPU_FEATURE_COUNT] = {
+    "fpu", "tsc", "msr", "apic", "fxsr", "sse", "sse2", "sse3", "ssse3",
+    "sse4.1", "sse4.2", "popcnt", "avx", "avx2", "erms", "invariant-tsc",
+    "tsc-deadline", "x2apic", "hypervisor"};
+
+/* CPUID exists when the ID bit in EFLAGS can be flipped. */
+static bool cpuid_supported(void)
+{
+    uint32_t before, after;
+
+    __asm__ volatile(
+        "pushf\n\t"
+        "pop %0\n\t"
+        "mov %0, %1\n\t"
+        "xor %2, %1\n\t"
+        "push %1\n\t"
+        "popf\n\t"
+        "pushf\n\t"
+        "pop %1\n\t"
+        "push %0\n\t"
+        "popf"
+        : "=&r"(before), "=&r"(after)
+        : "i"(EFLAGS_ID));
+
+    return ((before ^ after) & EFLAGS_ID) != 0;
+}
+
+static void store_registers(char *dest, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    memcpy(dest, &a, 4);
+    memcpy(dest + 4, &b, 4);
+    memcpy(dest + 8, &c, 4);
+    memcpy(dest + 12, &d, 4);
+}
+
+static void detect_caches(uint32_t max_leaf, uint32_t max_ext)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    /* Intel: deterministic cache parameters, one subleaf per cache. */
+    if (max_leaf >= 4)
+    {
+        for (uint32_t index = 0; index < 16; index++)
+        {
+            cpuid(4, index, &eax, &ebx, &ecx, &edx);
+
+            uint32_t type = eax & 0x1F;
+            if (type == 0)
+                break;
+
+            uint32_t level = (eax >> 5) & 0x7;
+            uint32_t line = (ebx & 0xFFF) + 1;
+            uint32_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+            uint32_t ways = ((ebx >> 22) & 0x3FF) + 1;
+            uint32_t kb = ways * partitions * line * (ecx + 1) / 1024;
+
+            if (level == 1 && type == 1)
+                cpu_info.l1d_kb = kb;
+            else if (level == 1 && type == 2)
+                cpu_info.l1i_kb = kb;
+            else if (level == 2)
+                cpu_info.l2_kb = kb;
+            else if (level == 3)
+                cpu_info.l3_kb = kb;
+
+            if (!cpu_info.line_size)
+                cpu_info.line_size = line;
+        }
+
+        if (cpu_info.l1d_kb || cpu_info.l2_kb)
+            return;
+    }
+
+    /* AMD: L1 and L2/L3 descriptors in the extended leaves. */
+    if (max_ext >= 0x80000005)
+    {
+        cpuid(0x80000005, 0, &eax, &ebx, &ecx, &edx);
+        cpu_info.l1d_kb = ecx >> 24;
+        cpu_info.l1i_kb = edx >> 24;
+        cpu_info.line_size = ecx & 0xFF;
+    }
+    if (max_ext >= 0x80000006)
+    {
+        cpuid(0x80000006, 0, &eax, &ebx, &ecx, &edx);
+        cpu_info.l2_kb = ecx >> 16;
+        cpu_info.l3_kb = (edx >> 18) * 512;
+    }
+}
+
+void cpu_detect(void)
+{
+    if (cpu_detected)
+        return;
+    cpu_detected = true;
+
+    memset(&cpu_info, 0, sizeof(cpu_info));
+
+    if (!cpuid_supported())
+    {
+        strcpy(cpu_info.vendor, "Unknown");
+        strcpy(cpu_info.brand, "Pre-CPUID x86");
+        return;
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    memcpy(cpu_info.vendor, &ebx, 4);
+    memcpy(cpu_info.vendor + 4, &edx, 4);
+    memcpy(cpu_info.vendor + 8, &ecx, 4);
+    cpu_info.vendor[12] = '\0';
+
+    if (max_leaf >= 1)
+    {
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+        cpu_info.stepping = eax & 0xF;
+        cpu_info.model = (eax >> 4) & 0xF;
+        cpu_info.family = (eax >> 8) & 0xF;
+        if (cpu_info.family == 0xF)
+            cpu_info.family += (eax >> 20) & 0xFF;
+        if (cpu_info.family == 0x6 || cpu_info.family >= 0xF)
+            cpu_info.model += ((eax >> 16) & 0xF) << 4;
+
+        if (edx & (1 << 0))
+            cpu_info.features |= CPU_FEATURE_FPU;
+        if (edx & (1 << 4))
+            cpu_info.features |= CPU_FEATURE_TSC;
+        if (edx & (1 << 5))
+            cpu_info.features |= CPU_FEATURE_MSR;
+        if (edx & (1 << 9))
+            cpu_info.features |= CPU_FEATURE_APIC;
+        if (edx & (1 << 24))
+            cpu_info.features |= CPU_FEATURE_FXSR;
+        if (edx & (1 << 25))
+            cpu_info.features |= CPU_FEATURE_SSE;
+        if (edx & (1 << 26))
+            cpu_info.features |= CPU_FEATURE_SSE2;
+        if (ecx & (1 << 0))
+            cpu_info.features |= CPU_FEATURE_SSE3;
+        if (ecx & (1 << 9))
+            cpu_info.features |= CPU_FEATURE_SSSE3;
+        if (ecx & (1 << 19))
+            cpu_info.features |= CPU_FEATURE_SSE41;
+        if (ecx & (1 << 20))
+            cpu_info.features |= CPU_FEATURE_SSE42;
+        if (ecx & (1 << 21))
+            cpu_info.features |= CPU_FEATURE_X2APIC;
+        if (ecx & (1 << 23))
+            cpu_info.features |= CPU_FEATURE_POPCNT;
+        if (ecx & (1 << 24))
+            cpu_info.features |= CPU_FEATURE_TSC_DEADLINE;
+        if (ecx & (1 << 28))
+            cpu_info.features |= CPU_FEATURE_AVX;
+        if (ecx & (1u << 31))
+            cpu_info.features |= CPU_FEATURE_HYPERVISOR;
+    }
+
+    if (max_leaf >= 7)
+    {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+
+        if (ebx & (1 << 5))
+            cpu_info.features |= CPU_FEATURE_AVX2;
+        if (ebx & (1 << 9))
+            cpu_info.features |= CPU_FEATURE_ERMS;
+    }
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_ext = eax >= 0x80000000 ? eax : 0;
+
+    if (max_ext >= 0x80000004)
+    {
+        for (uint32_t leaf = 0; leaf < 3; leaf++)
+        {
+            cpuid(0x80000002 + leaf, 0, &eax, &ebx, &ecx, &edx);
+            store_registers(cpu_info.brand + leaf * 16, eax, ebx, ecx, edx);
+        }
+        cpu_info.brand[48] = '\0';
+
+        /* Intel pads the brand string with leading spaces. */
+        int start = 0;
+        while (cpu_info.brand[start] == ' ')
+            start++;
+        if (start)
+            memmove(cpu_info.brand, cpu_info.brand + start, strlen(cpu_info.brand + start) + 1);
+    }
+    else
+    {
+        strcpy(cpu_info.brand, cpu_info.vendor);
+    }
+
+    if (max_ext >= 0x80000007)
+    {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        if (edx & (1 << 8))
+            cpu_info.features |= CPU_FEATURE_INVARIANT_TSC;
+    }
+
+    detect_caches(max_leaf, max_ext);
+}
+
+const CpuInfo *cpu_get_info(void)
+{
+    cpu_detect();
+    return &cpu_info;
+}
+
+bool cpu_has(uint32_t feature)
+{
+    return (cpu_info.features & feature) == feature;
+}
+
+const char *cpu_feature_name(int bit)
+{
+    if (bit < 0 || bit >= CPU_FEATURE_COUNT)
+        return "?";
+
+    return feature_names[bit];
+}
+
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR0_TS (1u << 3)
+#define CR0_NE (1u << 5)
+#define CR4_OSFXSR (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+#define MXCSR_DEFAULT 0x1F80
+
+static bool sse_enabled = false;
+static bool fpu_initial_saved = false;
+static uint8_t fpu_initial_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+/*
+ * Runs on every CPU before it schedules anything.  The first call also
+ * records the clean register image new tasks start from.
+ */
+void cpu_enable_sse(void)
+{
+    if (!cpu_has(CPU_FEATURE_FPU))
+        return;
+
+    uint32_t cr0, cr4;
+
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+    __asm__ volatile("fninit");
+
+    if (!cpu_has(CPU_FEATURE_FXSR | CPU_FEATURE_SSE))
+        return;
+
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    __asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+
+    if (!fpu_initial_saved)
+    {
+        fxsave(fpu_initial_state);
+        fpu_initial_saved = true;
+    }
+    sse_enabled = true;
+}
+
+bool cpu_sse_enabled(void)
+{
+    return sse_enabled;
+}
+
+void cpu_fpu_init_state(void *state)
+{
+    memcpy(state, fpu_initial_state, FPU_STATE_SIZE);
+}
+
+void cmd_cpuinfo(const char *args)
+{
+    (void)args;
+
+    const CpuInfo *info = cpu_get_info();
+
+    terminal_writestring("\n=== CPU ===\n");
+    terminal_writeall("Vendor:   %s\n", info->vendor);
+    terminal_writeall("Brand:    %s\n", info->brand);
+    terminal_writeall("Family:   %u  Model: %u  Stepping: %u\n",
+                      info->family, info->model, info->stepping);
+    terminal_writeall("Caches:   L1d %uK  L1i %uK  L2 %uK  L3 %uK  line %u\n",
+                      info->l1d_kb, info->l1i_kb, info->l2_kb, info->l3_kb, info->line_size);
+
+    terminal_writestring("Features:");
+    for (int bit = 0; bit < CPU_FEATURE_COUNT; bit++)
+    {
+        if (info->features & (1u << bit))
+        {
+            terminal_writestring(" ");
+            terminal_writestring(feature_names[bit]);
+        }
+    }
+
+    terminal_writeall("\nSSE:      %s\n", sse_enabled ? "enabled, FXSAVE per task" : "off");
+    terminal_writeall("Strings:  %s\n", string_impl_name());
+    terminal_writeall("Timer:    %s\n", timer_mode_name());
+}
@@ -0,0 +1,113 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CPU_FEATURE_FPU (1u << 0)
+#define CPU_FEATURE_TSC (1u << 1)
+#define CPU_FEATURE_MSR (1u << 2)
+#define CPU_FEATURE_APIC (1u << 3)
+#define CPU_FEATURE_FXSR (1u << 4)
+#define CPU_FEATURE_SSE (1u << 5)
+#define CPU_FEATURE_SSE2 (1u << 6)
+#define CPU_FEATURE_SSE3 (1u << 7)
+#define CPU_FEATURE_SSSE3 (1u << 8)
+#define CPU_FEATURE_SSE41 (1u << 9)
+#define CPU_FEATURE_SSE42 (1u << 10)
+#define CPU_FEATURE_POPCNT (1u << 11)
+#define CPU_FEATURE_AVX (1u << 12)
+#define CPU_FEATURE_AVX2 (1u << 13)
+#define CPU_FEATURE_ERMS (1u << 14)
+#define CPU_FEATURE_INVARIANT_TSC (1u << 15)
+#define CPU_FEATURE_TSC_DEADLINE (1u << 16)
+#define CPU_FEATURE_X2APIC (1u << 17)
+#define CPU_FEATURE_HYPERVISOR (1u << 18)
+#define CPU_FEATURE_COUNT 19
+
+/* FXSAVE image: x87, MMX and SSE registers plus MXCSR. */
+#define FPU_STATE_SIZE 512
+
+typedef struct
+{
+    char vendor[13];
+    char brand[49];
+    uint32_t family;
+    uint32_t model;
+    uint32_t stepping;
+    uint32_t l1d_kb;
+    uint32_t l1i_kb;
+    uint32_t l2_kb;
+    uint32_t l3_kb;
+    uint32_t line_size;
+    uint32_t features;
+} CpuInfo;
+
+void cpu_detect(void);
+const CpuInfo *cpu_get_info(void);
+bool cpu_has(uint32_t feature);
+const char *cpu_feature_name(int bit);
+
+void cpu_enable_sse(void);
+bool cpu_sse_enabled(void);
+void cpu_fpu_init_state(void *state);
+
+void cmd_cpuinfo(const char *args);
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr"
+                     :
+                     : "a"((uint32_t)value), "d"((uint32_t)(value >> 32)), "c"(msr));
+}
+
+static inline void fxsave(void *state)
+{
+    __asm__ volatile("fxsave (%0)" : : "r"(state) : "memory");
+}
+
+static inline void fxrstor(const void *state)
+{
+    __asm__ volatile("fxrstor (%0)" : : "r"(state) : "memory");
+}
+
+/* 64-by-32 division without libgcc: two divl steps, so the quotient may
+   use all 64 bits. */
+static inline uint64_t div64_32(uint64_t dividend, uint32_t divisor)
+{
+    uint32_t high = dividend >> 32;
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quotient_high = high / divisor;
+    uint32_t remainder = high % divisor;
+    uint32_t quotient_low;
+
+    __asm__("divl %4"
+            : "=a"(quotient_low), "=d"(remainder)
+            : "a"(low), "d"(remainder), "rm"(divisor));
+
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+#endif
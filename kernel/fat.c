@@ -0,0 +1,408 @@
+#include "fat.h"
+#include "ata.h"
+#include "bcache.h"
+#include "string_utils.h"
+
+#define FAT_SECTOR 512
+#define FAT_DIR_ENTRY 32
+#define FAT_ENTRIES_PER_SECTOR (FAT_SECTOR / FAT_DIR_ENTRY)
+#define FAT16_MAX_CLUSTERS 65525
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT_EOC 0xFFF8
+
+#define FAT_ATTR_VOLUME 0x08
+#define FAT_ATTR_DIR 0x10
+#define FAT_ATTR_LFN 0x0F
+
+typedef struct
+{
+    int drive;
+    int bits;
+    uint8_t cluster_sectors;
+    uint32_t fat_lba;
+    uint32_t root_lba;
+    uint32_t root_entries;
+    uint32_t data_lba;
+    uint32_t clusters;
+    uint16_t *fat;
+    char name[8];
+} FatVolume;
+
+/*
+ * Each volume's FAT is read once at mount and kept decoded, FAT12 as
+ * well, as one 16-bit entry per cluster, so following a chain never
+ * touches the disk.
+ */
+static uint16_t fat_tables[FAT_MAX_VOLUMES][FAT16_MAX_CLUSTERS + 11];
+static uint8_t fat12_raw[(FAT12_MAX_CLUSTERS + 2) * 3 / 2 + FAT_SECTOR];
+static FatVolume volumes[FAT_MAX_VOLUMES];
+static int volume_count = 0;
+static bool probed = false;
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool cluster_valid(const FatVolume *v, uint32_t cluster)
+{
+    return cluster >= 2 && cluster < v->clusters + 2;
+}
+
+static uint32_t cluster_lba(const FatVolume *v, uint32_t cluster)
+{
+    return v->data_lba + (cluster - 2) * v->cluster_sectors;
+}
+
+static bool fat_load_table(FatVolume *v, uint32_t fat_sectors)
+{
+    uint32_t entries = v->clusters + 2;
+
+    if (v->bits == 16)
+    {
+        uint32_t sectors = (entries * 2 + FAT_SECTOR - 1) / FAT_SECTOR;
+        return sectors <= fat_sectors && bcache_read(v->drive, v->fat_lba, sectors, v->fat);
+    }
+
+    uint32_t sectors = (entries * 3 / 2 + 1 + FAT_SECTOR - 1) / FAT_SECTOR;
+    if (sectors > fat_sectors || !bcache_read(v->drive, v->fat_lba, sectors, fat12_raw))
+        return false;
+
+    /* Two 12-bit entries share three bytes; end-of-chain and bad-cluster
+       marks are widened to their FAT16 values. */
+    for (uint32_t i = 0; i < entries; i++)
+    {
+        uint16_t value = rd16(&fat12_raw[i * 3 / 2]);
+
+        value = (i & 1) ? value >> 4 : value & 0xFFF;
+        if (value >= 0xFF7)
+            value |= 0xF000;
+        v->fat[i] = value;
+    }
+    return true;
+}
+
+/* Checks for a FAT12/16 boot sector at lba and fills in the layout. */
+static bool fat_probe(int drive, uint32_t lba, FatVolume *v)
+{
+    uint8_t sector[FAT_SECTOR];
+
+    if (!bcache_read(drive, lba, 1, sector))
+        return false;
+    if (sector[0] != 0xEB && sector[0] != 0xE9)
+        return false;
+
+    uint16_t sector_size = rd16(sector + 11);
+    uint8_t cluster_sectors = sector[13];
+    uint16_t reserved = rd16(sector + 14);
+    uint8_t fats = sector[16];
+    uint16_t root_entries = rd16(sector + 17);
+    uint32_t total = rd16(sector + 19) ? rd16(sector + 19) : rd32(sector + 32);
+    uint16_t fat_sectors = rd16(sector + 22);
+
+    /* FAT32 keeps its root in a cluster chain and has no 16-bit FAT size. */
+    if (sector_size != FAT_SECTOR || !cluster_sectors || (cluster_sectors & (cluster_sectors - 1)) ||
+        !reserved || !fats || fats > 2 || !root_entries || !fat_sectors || !total)
+        return false;
+
+    uint32_t root_sectors = (root_entries * FAT_DIR_ENTRY + FAT_SECTOR - 1) / FAT_SECTOR;
+    uint32_t meta = reserved + fats * fat_sectors + root_sectors;
+    if (total <= meta)
+        return false;
+
+    v->drive = drive;
+    v->cluster_sectors = cluster_sectors;
+    v->fat_lba = lba + reserved;
+    v->root_lba = v->fat_lba + fats * fat_sectors;
+    v->root_entries = root_entries;
+    v->data_lba = v->root_lba + root_sectors;
+    v->clusters = (total - meta) / cluster_sectors;
+
+    if (v->clusters >= FAT16_MAX_CLUSTERS)
+        return false;
+    v->bits = v->clusters < FAT12_MAX_CLUSTERS ? 12 : 16;
+
+    return fat_load_table(v, fat_sectors);
+}
+
+/* A volume fills the whole disk, as on a floppy image, or is the first
+   FAT partition in its MBR. */
+static bool fat_probe_drive(int drive, FatVolume *v)
+{
+    uint8_t mbr[FAT_SECTOR];
+
+    if (fat_probe(drive, 0, v))
+        return true;
+    if (!bcache_read(drive, 0, 1, mbr) || mbr[510] != 0x55 || mbr[511] != 0xAA)
+        return false;
+
+    for (int i = 0; i < 4; i++)
+    {
+        const uint8_t *part = mbr + 446 + i * 16;
+        uint8_t type = part[4];
+
+        if ((type == 0x01 || type == 0x04 || type == 0x06 || type == 0x0E) &&
+            fat_probe(drive, rd32(part + 8), v))
+            return true;
+    }
+    return false;
+}
+
+void fat_init(void)
+{
+    if (probed)
+        return;
+    probed = true;
+
+    for (int drive = 0; drive < ata_drive_count() && volume_count < FAT_MAX_VOLUMES; drive++)
+    {
+        FatVolume *v = &volumes[volume_count];
+
+        v->fat = fat_tables[volume_count];
+        if (!fat_probe_drive(drive, v))
+            continue;
+
+        sprintf(v->name, "hd%d", drive);
+        volume_count++;
+    }
+}
+
+int fat_volume_count(void)
+{
+    return volume_count;
+}
+
+const char *fat_volume_name(int volume)
+{
+    if (volume < 0 || volume >= volume_count)
+        return NULL;
+    return volumes[volume].name;
+}
+
+static bool name_char_valid(char c)
+{
+    if ((uint8_t)c >= 128 || isalnum(c))
+        return true;
+    return c && strchr("!#$%&'()-@^_`{}~", c) != NULL;
+}
+
+/* Turns name into the form directory entries are shown in, upper case
+   BASE.EXT.  Fails for anything that is not a valid 8.3 name. */
+bool fat_canonical_name(const char *name, int len, char *out)
+{
+    int dot = -1;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (name[i] == '.')
+        {
+            if (dot >= 0)
+                return false;
+            dot = i;
+        }
+        else if (!name_char_valid(name[i]))
+        {
+            return false;
+        }
+    }
+
+    int base = dot < 0 ? len : dot;
+    int ext = dot < 0 ? 0 : len - dot - 1;
+    if (base < 1 || base > 8 || ext > 3 || (dot >= 0 && ext == 0))
+        return false;
+
+    for (int i = 0; i < len; i++)
+        out[i] = toupper(name[i]);
+    out[len] = '\0';
+    return true;
+}
+
+static void entry_name(const uint8_t *raw, char *out)
+{
+    int len = 0;
+
+    for (int i = 0; i < 8 && raw[i] != ' '; i++)
+        out[len++] = (i == 0 && raw[0] == 0x05) ? (char)0xE5 : raw[i];
+
+    if (raw[8] != ' ')
+    {
+        out[len++] = '.';
+        for (int i = 8; i < 11 && raw[i] != ' '; i++)
+            out[len++] = raw[i];
+    }
+    out[len] = '\0';
+}
+
+void fat_dir_open(int volume, uint32_t cluster, FatDir *dir)
+{
+    dir->volume = volume;
+    dir->cluster = cluster;
+    dir->index = 0;
+    dir->loaded = 0xFFFFFFFF;
+    dir->hops = 0;
+    dir->end = volume < 0 || volume >= volume_count;
+}
+
+/* Skips deleted entries, long-name fragments, the volume label and the
+   dot entries.  A chain longer than the volume has clusters must loop,
+   so the directory ends there. */
+bool fat_dir_next(FatDir *dir, FatEntry *entry)
+{
+    const FatVolume *v = &volumes[dir->volume];
+
+    while (!dir->end)
+    {
+        uint32_t lba;
+
+        if (dir->cluster == 0)
+        {
+            if (dir->index >= v->root_entries)
+                break;
+            lba = v->root_lba + dir->index / FAT_ENTRIES_PER_SECTOR;
+        }
+        else
+        {
+            if (dir->index == v->cluster_sectors * FAT_ENTRIES_PER_SECTOR)
+            {
+                if (++dir->hops >= v->clusters)
+                    break;
+                dir->cluster = v->fat[dir->cluster];
+                dir->index = 0;
+            }
+            if (!cluster_valid(v, dir->cluster))
+                break;
+            lba = cluster_lba(v, dir->cluster) + dir->index / FAT_ENTRIES_PER_SECTOR;
+        }
+
+        if (lba != dir->loaded)
+        {
+            if (!bcache_read(v->drive, lba, 1, dir->sector))
+                break;
+            dir->loaded = lba;
+        }
+
+        const uint8_t *raw = dir->sector + (dir->index % FAT_ENTRIES_PER_SECTOR) * FAT_DIR_ENTRY;
+        dir->index++;
+
+        if (raw[0] == 0)
+            break;
+        if (raw[0] == 0xE5 || raw[0] == '.' || raw[11] == FAT_ATTR_LFN || (raw[11] & FAT_ATTR_VOLUME))
+            continue;
+
+        entry_name(raw, entry->name);
+        entry->dir = (raw[11] & FAT_ATTR_DIR) != 0;
+        entry->cluster = rd16(raw + 26);
+        entry->size = entry->dir ? 0 : rd32(raw + 28);
+        return true;
+    }
+
+    dir->end = true;
+    return false;
+}
+
+bool fat_lookup(int volume, uint32_t cluster, const char *name, int len, FatEntry *entry)
+{
+    char want[FAT_NAME_MAX];
+    FatDir dir;
+
+    if (len >= FAT_NAME_MAX || !fat_canonical_name(name, len, want))
+        return false;
+
+    fat_dir_open(volume, cluster, &dir);
+    while (fat_dir_next(&dir, entry))
+    {
+        if (strcmp(entry->name, want) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Reads len bytes starting pos bytes into the sectors at lba.  Whole
+   sectors go straight into buf in one request. */
+static bool read_bytes(const FatVolume *v, uint32_t lba, uint32_t pos, uint8_t *buf, uint32_t len)
+{
+    uint8_t sector[FAT_SECTOR];
+
+    lba += pos / FAT_SECTOR;
+    pos %= FAT_SECTOR;
+
+    if (pos)
+    {
+        uint32_t n = FAT_SECTOR - pos < len ? FAT_SECTOR - pos : len;
+
+        if (!bcache_read(v->drive, lba, 1, sector))
+            return false;
+        memcpy(buf, sector + pos, n);
+        lba++;
+        buf += n;
+        len -= n;
+    }
+
+    uint32_t whole = len / FAT_SECTOR;
+    if (whole)
+    {
+        if (!bcache_read(v->drive, lba, whole, buf))
+            return false;
+        lba += whole;
+        buf += whole * FAT_SECTOR;
+        len -= whole * FAT_SECTOR;
+    }
+
+    if (len)
+    {
+        if (!bcache_read(v->drive, lba, 1, sector))
+            return false;
+        memcpy(buf, sector, len);
+    }
+    return true;
+}
+
+/*
+ * Reads from the file whose chain starts at cluster.  Clusters that
+ * follow each other on disk are read as one run.  Returns the bytes
+ * read, which is short only if the chain or the disk gives out; the
+ * caller keeps within the file size.
+ */
+int fat_read(int volume, uint32_t cluster, uint32_t offset, void *buf, int len)
+{
+    if (volume < 0 || volume >= volume_count || len <= 0)
+        return 0;
+
+    const FatVolume *v = &volumes[volume];
+    uint32_t cluster_size = v->cluster_sectors * FAT_SECTOR;
+    uint8_t *out = buf;
+    int done = 0;
+
+    if (offset / cluster_size >= v->clusters)
+        return 0;
+
+    for (uint32_t skip = offset / cluster_size; skip && cluster_valid(v, cluster); skip--)
+        cluster = v->fat[cluster];
+    offset %= cluster_size;
+
+    while (done < len && cluster_valid(v, cluster))
+    {
+        uint32_t run = 1;
+
+        while (run * cluster_size - offset < (uint32_t)(len - done) &&
+               v->fat[cluster + run - 1] == cluster + run && cluster_valid(v, cluster + run))
+            run++;
+
+        uint32_t n = run * cluster_size - offset;
+        if (n > (uint32_t)(len - done))
+            n = len - done;
+
+        if (!read_bytes(v, cluster_lba(v, cluster), offset, out + done, n))
+            break;
+
+        done += n;
+        offset = 0;
+        cluster = v->fat[cluster + run - 1];
+    }
+    return done;
+}
@@ -0,0 +1,40 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FAT_MAX_VOLUMES 2
+#define FAT_NAME_MAX 13
+
+typedef struct
+{
+    char name[FAT_NAME_MAX];
+    bool dir;
+    uint32_t cluster;
+    uint32_t size;
+} FatEntry;
+
+/* Walks a directory; cluster 0 is the fixed root directory. */
+typedef struct
+{
+    int volume;
+    uint32_t cluster;
+    uint32_t index;
+    uint32_t loaded;
+    uint32_t hops;
+    bool end;
+    uint8_t sector[512];
+} FatDir;
+
+void fat_init(void);
+int fat_volume_count(void);
+const char *fat_volume_name(int volume);
+
+bool fat_canonical_name(const char *name, int len, char *out);
+void fat_dir_open(int volume, uint32_t cluster, FatDir *dir);
+bool fat_dir_next(FatDir *dir, FatEntry *entry);
+bool fat_lookup(int volume, uint32_t cluster, const char *name, int len, FatEntry *entry);
+int fat_read(int volume, uint32_t cluster, uint32_t offset, void *buf, int len);
+
+#endif
@@ -0,0 +1,448 @@
+#include "floatfmt.h"
+#include "string_utils.h"
+
+/*
+ * Shortest round-trip float formatting, after Ulf Adams' Ryu (f2s).
+ * The value's rounding interval is scaled by a power of 10 using a 64-bit
+ * reciprocal from the tables below, then digits are dropped until the
+ * interval can no longer tell them apart.  Everything past the table
+ * lookups is 32-bit integer arithmetic, so no FPU work is involved.
+ */
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BITS 8
+#define FLOAT_BIAS 127
+
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+/* floor(2^(pow5bits(q) - 1 + 59) / 5^q) + 1 */
+static const uint64_t float_pow5_inv_split[31] = {
+    0x0800000000000001ull, 0x0666666666666667ull,
+    0x051eb851eb851eb9ull, 0x04189374bc6a7efaull,
+    0x068db8bac710cb2aull, 0x053e2d6238da3c22ull,
+    0x0431bde82d7b634eull, 0x06b5fca6af2bd216ull,
+    0x055e63b88c230e78ull, 0x044b82fa09b5a52dull,
+    0x06df37f675ef6eaeull, 0x057f5ff85e592558ull,
+    0x0465e6604b7a8447ull, 0x0709709a125da071ull,
+    0x05a126e1a84ae6c1ull, 0x0480ebe7b9d58567ull,
+    0x0734aca5f6226f0bull, 0x05c3bd5191b525a3ull,
+    0x049c97747490eae9ull, 0x0760f253edb4ab0eull,
+    0x05e72843249088d8ull, 0x04b8ed0283a6d3e0ull,
+    0x078e480405d7b966ull, 0x060b6cd004ac9452ull,
+    0x04d5f0a66a23a9dbull, 0x07bcb43d769f762bull,
+    0x063090312bb2c4efull, 0x04f3a68dbc8f03f3ull,
+    0x07ec3daf94180651ull, 0x065697bfa9acd1daull,
+    0x051212ffbaf0a7e2ull,
+};
+
+/* 5^i scaled to 61 bits */
+static const uint64_t float_pow5_split[47] = {
+    0x1000000000000000ull, 0x1400000000000000ull,
+    0x1900000000000000ull, 0x1f40000000000000ull,
+    0x1388000000000000ull, 0x186a000000000000ull,
+    0x1e84800000000000ull, 0x1312d00000000000ull,
+    0x17d7840000000000ull, 0x1dcd650000000000ull,
+    0x12a05f2000000000ull, 0x174876e800000000ull,
+    0x1d1a94a200000000ull, 0x12309ce540000000ull,
+    0x16bcc41e90000000ull, 0x1c6bf52634000000ull,
+    0x11c37937e0800000ull, 0x16345785d8a00000ull,
+    0x1bc16d674ec80000ull, 0x1158e460913d0000ull,
+    0x15af1d78b58c4000ull, 0x1b1ae4d6e2ef5000ull,
+    0x10f0cf064dd59200ull, 0x152d02c7e14af680ull,
+    0x1a784379d99db420ull, 0x108b2a2c28029094ull,
+    0x14adf4b7320334b9ull, 0x19d971e4fe8401e7ull,
+    0x1027e72f1f128130ull, 0x1431e0fae6d7217cull,
+    0x193e5939a08ce9dbull, 0x1f8def8808b02452ull,
+    0x13b8b5b5056e16b3ull, 0x18a6e32246c99c60ull,
+    0x1ed09bead87c0378ull, 0x13426172c74d822bull,
+    0x1812f9cf7920e2b6ull, 0x1e17b84357691b64ull,
+    0x12ced32a16a1b11eull, 0x178287f49c4a1d66ull,
+    0x1d6329f1c35ca4bfull, 0x125dfa371a19e6f7ull,
+    0x16f578c4e0a060b5ull, 0x1cb2d6f618c878e3ull,
+    0x11efc659cf7d4b8dull, 0x166bb7f0435c9e71ull,
+    0x1c06a5ec5433c60dull,
+};
+
+static uint32_t pow5bits(int32_t e)
+{
+    return (uint32_t)(((e * 1217359) >> 19) + 1);
+}
+
+static uint32_t log10_pow2(int32_t e)
+{
+    return (uint32_t)((e * 78913) >> 18);
+}
+
+static uint32_t log10_pow5(int32_t e)
+{
+    return (uint32_t)((e * 732923) >> 20);
+}
+
+static uint32_t pow5_factor(uint32_t value)
+{
+    uint32_t count = 0;
+
+    while (value % 5 == 0)
+    {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static bool multiple_of_pow5(uint32_t value, uint32_t p)
+{
+    return pow5_factor(value) >= p;
+}
+
+static bool multiple_of_pow2(uint32_t value, uint32_t p)
+{
+    return (value & ((1u << p) - 1)) == 0;
+}
+
+static uint32_t mul_shift(uint32_t m, uint64_t factor, int32_t shift)
+{
+    uint64_t lo = (uint64_t)m * (uint32_t)factor;
+    uint64_t hi = (uint64_t)m * (uint32_t)(factor >> 32);
+    uint64_t sum = (lo >> 32) + hi;
+
+    return (uint32_t)(sum >> (shift - 32));
+}
+
+/* Shortest digits d and exponent e with d * 10^e rounding back to the
+   float given by its raw mantissa and exponent fields. */
+static uint32_t float_shortest(uint32_t mantissa, uint32_t exponent, int32_t *exp10)
+{
+    int32_t e2;
+    uint32_t m2;
+
+    if (exponent == 0)
+    {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = mantissa;
+    }
+    else
+    {
+        e2 = (int32_t)exponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1u << FLOAT_MANTISSA_BITS) | mantissa;
+    }
+
+    bool accept_bounds = (m2 & 1) == 0;
+    uint32_t mv = 4 * m2;
+    uint32_t mp = 4 * m2 + 2;
+    uint32_t mm_shift = mantissa != 0 || exponent <= 1;
+    uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    bool vm_trailing_zeros = false;
+    bool vr_trailing_zeros = false;
+    uint8_t last_removed = 0;
+
+    if (e2 >= 0)
+    {
+        uint32_t q = log10_pow2(e2);
+        int32_t k = FLOAT_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+
+        e10 = (int32_t)q;
+        vr = mul_shift(mv, float_pow5_inv_split[q], i);
+        vp = mul_shift(mp, float_pow5_inv_split[q], i);
+        vm = mul_shift(mm, float_pow5_inv_split[q], i);
+
+        if (q != 0 && (vp - 1) / 10 <= vm / 10)
+        {
+            int32_t l = FLOAT_POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+            last_removed = (uint8_t)(mul_shift(mv, float_pow5_inv_split[q - 1], -e2 + (int32_t)q - 1 + l) % 10);
+        }
+
+        if (q <= 9)
+        {
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mm, q);
+            else
+                vp -= multiple_of_pow5(mp, q);
+        }
+    }
+    else
+    {
+        uint32_t q = log10_pow5(-e2);
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = pow5bits(i) - FLOAT_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+
+        e10 = (int32_t)q + e2;
+        vr = mul_shift(mv, float_pow5_split[i], j);
+        vp = mul_shift(mp, float_pow5_split[i], j);
+        vm = mul_shift(mm, float_pow5_split[i], j);
+
+        if (q != 0 && (vp - 1) / 10 <= vm / 10)
+        {
+            j = (int32_t)q - 1 - ((int32_t)pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            last_removed = (uint8_t)(mul_shift(mv, float_pow5_split[i + 1], j) % 10);
+        }
+
+        if (q <= 1)
+        {
+            vr_trailing_zeros = true;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        }
+        else if (q < 31)
+        {
+            vr_trailing_zeros = multiple_of_pow2(mv, q - 1);
+        }
+    }
+
+    int32_t removed = 0;
+    uint32_t output;
+
+    if (vm_trailing_zeros || vr_trailing_zeros)
+    {
+        while (vp / 10 > vm / 10)
+        {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        if (vm_trailing_zeros)
+        {
+            while (vm % 10 == 0)
+            {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    }
+    else
+    {
+        while (vp / 10 > vm / 10)
+        {
+            last_removed = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        output = vr + (vr == vm || last_removed >= 5);
+    }
+
+    *exp10 = e10 + removed;
+    return output;
+}
+
+int float_format(float value, char *buf)
+{
+    union
+    {
+        float f;
+        uint32_t u;
+    } bits = {value};
+
+    uint32_t mantissa = bits.u & ((1u << FLOAT_MANTISSA_BITS) - 1);
+    uint32_t exponent = (bits.u >> FLOAT_MANTISSA_BITS) & ((1u << FLOAT_EXPONENT_BITS) - 1);
+    int len = 0;
+
+    if (exponent == 0xFF && mantissa)
+    {
+        strcpy(buf, "nan");
+        return 3;
+    }
+
+    if (bits.u >> 31)
+        buf[len++] = '-';
+
+    if (exponent == 0xFF)
+    {
+        strcpy(buf + len, "inf");
+        return len + 3;
+    }
+
+    if (exponent == 0 && mantissa == 0)
+    {
+        strcpy(buf + len, "0.0");
+        return len + 3;
+    }
+
+    int32_t exp10;
+    char digits[12];
+    itoa((int)float_shortest(mantissa, exponent, &exp10), digits, 10);
+
+    int ndigits = strlen(digits);
+    int point = ndigits + exp10;
+
+    if (point > -4 && point <= 10)
+    {
+        if (point <= 0)
+        {
+            buf[len++] = '0';
+            buf[len++] = '.';
+            while (point++ < 0)
+                buf[len++] = '0';
+            memcpy(buf + len, digits, ndigits);
+            len += ndigits;
+        }
+        else if (point >= ndigits)
+        {
+            memcpy(buf + len, digits, ndigits);
+            len += ndigits;
+            while (point-- > ndigits)
+                buf[len++] = '0';
+            buf[len++] = '.';
+            buf[len++] = '0';
+        }
+        else
+        {
+            memcpy(buf + len, digits, point);
+            len += point;
+            buf[len++] = '.';
+            memcpy(buf + len, digits + point, ndigits - point);
+            len += ndigits - point;
+        }
+    }
+    else
+    {
+        buf[len++] = digits[0];
+        if (ndigits > 1)
+        {
+            buf[len++] = '.';
+            memcpy(buf + len, digits + 1, ndigits - 1);
+            len += ndigits - 1;
+        }
+        buf[len++] = 'e';
+        itoa(point - 1, buf + len, 10);
+        len += strlen(buf + len);
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+/*
+ * Up to 18 significant digits are gathered exactly, then scaled once by
+ * a power of ten in x87 extended precision; 10^n is exact there up to
+ * n = 27, which covers every digit string float_format produces.
+ */
+static long double pow10_ld(int n)
+{
+    long double result = 1.0L;
+    long double base = 10.0L;
+
+    while (n)
+    {
+        if (n & 1)
+            result *= base;
+        base *= base;
+        n >>= 1;
+    }
+    return result;
+}
+
+bool float_parse(const char *str, float *out, const char **end)
+{
+    const char *p = str;
+    bool negative = false;
+
+    if (*p == '-' || *p == '+')
+        negative = *p++ == '-';
+
+    uint64_t digits = 0;
+    int ndigits = 0;
+    int exp10 = 0;
+    bool any = false;
+
+    while (*p >= '0' && *p <= '9')
+    {
+        if (ndigits < 18)
+        {
+            digits = digits * 10 + (uint32_t)(*p - '0');
+            if (digits)
+                ndigits++;
+        }
+        else
+        {
+            exp10++;
+        }
+        any = true;
+        p++;
+    }
+
+    if (*p == '.')
+    {
+        p++;
+        while (*p >= '0' && *p <= '9')
+        {
+            if (ndigits < 18)
+            {
+                digits = digits * 10 + (uint32_t)(*p - '0');
+                if (digits)
+                    ndigits++;
+                exp10--;
+            }
+            any = true;
+            p++;
+        }
+    }
+
+    if (!any)
+        return false;
+
+    if (*p == 'e' || *p == 'E')
+    {
+        const char *q = p + 1;
+        bool exp_negative = false;
+        int exp = 0;
+
+        if (*q == '-' || *q == '+')
+            exp_negative = *q++ == '-';
+
+        if (*q >= '0' && *q <= '9')
+        {
+            while (*q >= '0' && *q <= '9')
+            {
+                if (exp < 1000)
+                    exp = exp * 10 + (*q - '0');
+                q++;
+            }
+            exp10 += exp_negative ? -exp : exp;
+            p = q;
+        }
+    }
+
+    long double value = (long double)digits;
+
+    if (digits == 0 || exp10 < -80)
+        value = 0.0L;
+    else if (exp10 > 60)
+        value = 1e60L * 1e60L;
+    else if (exp10 >= 0)
+        value *= pow10_ld(exp10);
+    else if (exp10 >= -27)
+        value /= pow10_ld(-exp10);
+    else
+        value = value / pow10_ld(27) / pow10_ld(-exp10 - 27);
+
+    *out = negative ? -(float)value : (float)value;
+    if (end)
+        *end = p;
+    return true;
+}
@@ -0,0 +1,13 @@
+#ifndef FLOATFMT_H
+#define FLOATFMT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Longest float_format output, "-1.23456789e-38" and the like. */
+#define FLOAT_STR_MAX 24
+
+int float_format(float value, char *buf);
+bool float_parse(const char *str, float *out, const char **end);
+
+#endif
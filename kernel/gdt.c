@@ -0,0 +1,65 @@
+#include "gdt.h"
+
+typedef struct
+{
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+typedef struct
+{
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_ptr_t;
+
+static gdt_entry_t gdt[3];
+static gdt_ptr_t gdt_ptr;
+
+static void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran)
+{
+    gdt[num].base_low = base & 0xFFFF;
+    gdt[num].base_middle = (base >> 16) & 0xFF;
+    gdt[num].base_high = (base >> 24) & 0xFF;
+
+    gdt[num].limit_low = limit & 0xFFFF;
+    gdt[num].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    gdt[num].access = access;
+}
+
+/*
+ * GRUB leaves us with a GDT whose selectors are not specified, so the
+ * kernel loads its own flat one before any gate refers to GDT_KERNEL_CODE.
+ */
+void gdt_install(void)
+{
+    gdt_ptr.limit = sizeof(gdt) - 1;
+    gdt_ptr.base = (uint32_t)&gdt;
+
+    gdt_set_gate(0, 0, 0, 0, 0);
+    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+
+    gdt_load();
+}
+
+/* Also used by application processors leaving the SMP trampoline. */
+void gdt_load(void)
+{
+    __asm__ volatile(
+        "lgdt %0\n\t"
+        "ljmp $0x08, $1f\n"
+        "1:\n\t"
+        "mov $0x10, %%ax\n\t"
+        "mov %%ax, %%ds\n\t"
+        "mov %%ax, %%es\n\t"
+        "mov %%ax, %%fs\n\t"
+        "mov %%ax, %%gs\n\t"
+        "mov %%ax, %%ss\n\t"
+        :
+        : "m"(gdt_ptr)
+        : "eax", "memory");
+}
@@ -0,0 +1,12 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+
+void gdt_install(void);
+void gdt_load(void);
+
+#endif
@@ -2,36 +2,220 @@
 #include "keyboard.h"
 #include "vga.h"
 #include "string_utils.h"
+#include "panic.h"
+#include "gdt.h"
+#include "sched.h"
+#include "apic.h"
 
-void (*irq_handlers[16])(void);
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+
+typedef struct
+{
+    uint16_t base_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t flags;
+    uint16_t base_high;
+} __attribute__((packed)) idt_entry_t;
+
+typedef struct
+{
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) idt_ptr_t;
+
+static idt_entry_t idt[256];
+static idt_ptr_t idt_ptr;
+
+void (*irq_handlers[16])(registers_t *regs);
+
+extern void isr0(void), isr1(void), isr2(void), isr3(void), isr4(void), isr5(void), isr6(void), isr7(void);
+extern void isr8(void), isr9(void), isr10(void), isr11(void), isr12(void), isr13(void), isr14(void), isr15(void);
+extern void isr16(void), isr17(void), isr18(void), isr19(void), isr20(void), isr21(void), isr22(void), isr23(void);
+extern void isr24(void), isr25(void), isr26(void), isr27(void), isr28(void), isr29(void), isr30(void), isr31(void);
+extern void irq0(void), irq1(void), irq2(void), irq3(void), irq4(void), irq5(void), irq6(void), irq7(void);
+extern void irq8(void), irq9(void), irq10(void), irq11(void), irq12(void), irq13(void), irq14(void), irq15(void);
+extern void isr_yield(void), isr_resched(void), isr_lapic_timer(void), isr_spurious(void);
+
+static void (*const exception_stubs[32])(void) = {
+    isr0, isr1, isr2, isr3, isr4, isr5, isr6, isr7,
+    isr8, isr9, isr10, isr11, isr12, isr13, isr14, isr15,
+    isr16, isr17, isr18, isr19, isr20, isr21, isr22, isr23,
+    isr24, isr25, isr26, isr27, isr28, isr29, isr30, isr31};
+
+static void (*const irq_stubs[16])(void) = {
+    irq0, irq1, irq2, irq3, irq4, irq5, irq6, irq7,
+    irq8, irq9, irq10, irq11, irq12, irq13, irq14, irq15};
+
+static const char *exception_messages[32] = {
+    "Division by zero exception",
+    "Debug exception",
+    "Non maskable interrupt",
+    "Breakpoint exception",
+    "Overflow exception",
+    "Bound range exceeded",
+    "Invalid opcode",
+    "Device not available",
+    "Double fault",
+    "Coprocessor segment overrun",
+    "Invalid TSS",
+    "Segment not present",
+    "Stack-segment fault",
+    "General protection fault",
+    "Page fault",
+    "Reserved exception",
+    "x87 floating-point exception",
+    "Alignment check",
+    "Machine check",
+    "SIMD floating-point exception",
+    "Virtualization exception",
+    "Control protection exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Hypervisor injection exception",
+    "VMM communication exception",
+    "Security exception",
+    "Reserved exception"};
+
+static void idt_set_gate(int num, void (*handler)(void))
+{
+    uint32_t base = (uint32_t)handler;
+
+    idt[num].base_low = base & 0xFFFF;
+    idt[num].base_high = (base >> 16) & 0xFFFF;
+    idt[num].selector = GDT_KERNEL_CODE;
+    idt[num].zero = 0;
+    idt[num].flags = 0x8E;
+}
+
+static void pic_remap(void)
+{
+    outb(PIC1_COMMAND, 0x11);
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, IRQ0);
+    outb(PIC2_DATA, IRQ0 + 8);
+    outb(PIC1_DATA, 0x04);
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);
+    outb(PIC2_DATA, 0x01);
+
+    /* Every line stays masked until a driver installs a handler; the
+       keyboard is still polled, so IRQ1 must not steal its scancodes. */
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+static void irq_set_masked(int line, bool masked)
+{
+    uint16_t port = (line < 8) ? PIC1_DATA : PIC2_DATA;
+    uint8_t bit = 1 << (line & 7);
+    uint8_t value = inb(port);
+
+    value = masked ? (value | bit) : (value & ~bit);
+    outb(port, value);
+
+    if (line >= 8 && !masked)
+    {
+        irq_set_masked(2, false);
+    }
+}
 
 void isr_install(void)
 {
+    idt_ptr.limit = sizeof(idt) - 1;
+    idt_ptr.base = (uint32_t)&idt;
+
+    memset(idt, 0, sizeof(idt));
+
+    for (int i = 0; i < 32; i++)
+    {
+        idt_set_gate(i, exception_stubs[i]);
+    }
+
+    idt_set_gate(SCHED_YIELD_VECTOR, isr_yield);
+    idt_set_gate(SCHED_IPI_VECTOR, isr_resched);
+    idt_set_gate(LAPIC_TIMER_VECTOR, isr_lapic_timer);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, isr_spurious);
+
+    idt_load();
+}
+
+/* Application processors share the BSP's table. */
+void idt_load(void)
+{
+    __asm__ volatile("lidt %0" : : "m"(idt_ptr));
 }
 
 void irq_install(void)
 {
+    pic_remap();
 
     for (int i = 0; i < 16; i++)
     {
         irq_handlers[i] = 0;
+        idt_set_gate(IRQ0 + i, irq_stubs[i]);
     }
 }
 
-void irq_install_handler(int irq, void (*handler)(void))
+void irq_install_handler(int irq, void (*handler)(registers_t *regs))
 {
     irq_handlers[irq - IRQ0] = handler;
+    irq_set_masked(irq - IRQ0, false);
 }
 
 void irq_uninstall_handler(int irq)
 {
+    irq_set_masked(irq - IRQ0, true);
     irq_handlers[irq - IRQ0] = 0;
 }
 
-void irq_handler(int irq)
+void isr_handler(registers_t *regs)
 {
-    if (irq_handlers[irq - IRQ0])
+    if (regs->int_no < 32)
     {
-        irq_handlers[irq - IRQ0]();
+        panic_with_code(exception_messages[regs->int_no], regs->int_no);
     }
-}
\ No newline at end of file
+}
+
+registers_t *irq_handler(registers_t *regs)
+{
+    if (regs->int_no == SCHED_YIELD_VECTOR)
+    {
+        return sched_switch(regs, true);
+    }
+
+    if (regs->int_no == SCHED_IPI_VECTOR)
+    {
+        lapic_eoi();
+        return sched_switch(regs, true);
+    }
+
+    if (regs->int_no == LAPIC_TIMER_VECTOR)
+    {
+        lapic_eoi();
+        return sched_timer_event(regs);
+    }
+
+    int irq = regs->int_no - IRQ0;
+
+    if (irq_handlers[irq])
+    {
+        irq_handlers[irq](regs);
+    }
+
+    if (irq >= 8)
+    {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+
+    return sched_switch(regs, false);
+}
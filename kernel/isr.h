@@ -6,10 +6,38 @@
 #define IRQ0 32
 #define IRQ1 33
 #define IRQ12 44
+#define IRQ14 46
+#define IRQ15 47
+
+#define SCHED_YIELD_VECTOR 0x30
+#define SCHED_IPI_VECTOR 0x31
+#define LAPIC_TIMER_VECTOR 0x32
+
+typedef struct registers
+{
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags;
+} registers_t;
 
 void isr_install(void);
+void idt_load(void);
 void irq_install(void);
-void irq_install_handler(int irq, void (*handler)(void));
+void irq_install_handler(int irq, void (*handler)(registers_t *regs));
 void irq_uninstall_handler(int irq);
 
-#endif
\ No newline at end of file
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+    __asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags)
+{
+    if (flags & 0x200)
+        __asm__ volatile("sti" : : : "memory");
+}
+
+#endif
@@ -10,6 +10,18 @@
 #include "commands.h"
 #include "misc.h"
 #include "tlang.h"
+#include "gdt.h"
+#include "isr.h"
+#include "timer.h"
+#include "sched.h"
+#include "smp.h"
+#include "cpu.h"
+#include "strbench.h"
+#include "cmdtable.h"
+#include "floatfmt.h"
+#include "multiboot.h"
+#include "ata.h"
+#include "bcache.h"
 
 #include "../T84_OS/home/app/ttest.h"
 #include "../T84_OS/home/app/4IDE.h"
@@ -48,6 +60,42 @@ void cmd_echo(const char *args)
     terminal_writestring("\n");
 }
 
+static void number_text(const VarNumber *n, char *buf)
+{
+    if (n->type == VAR_FLOAT)
+        float_format(n->value.float_value, buf);
+    else
+        itoa(n->value.int_value, buf, 10);
+}
+
+static float number_as_float(const VarNumber *n)
+{
+    return n->type == VAR_FLOAT ? n->value.float_value : (float)n->value.int_value;
+}
+
+static bool read_operands(const char *args, VarNumber *n1, VarNumber *n2)
+{
+    char arg1[32], arg2[32];
+
+    if (sscanf(args, "%s %s", arg1, arg2) != 2 ||
+        !eval_expression(arg1, n1) || !eval_expression(arg2, n2))
+    {
+        terminal_writestring("\nError: Need two numbers\n");
+        return false;
+    }
+    return true;
+}
+
+static void print_operation(const VarNumber *n1, const char *op, const VarNumber *n2, const VarNumber *result)
+{
+    char t1[FLOAT_STR_MAX], t2[FLOAT_STR_MAX], tr[FLOAT_STR_MAX];
+
+    number_text(n1, t1);
+    number_text(n2, t2);
+    number_text(result, tr);
+    terminal_writeall("\n%s %s %s = %s\n", t1, op, t2, tr);
+}
+
 void cmd_sum(const char *args)
 {
     if (!args || strlen(args) == 0)
@@ -57,20 +105,14 @@ void cmd_sum(const char *args)
         return;
     }
 
-    char arg1[32], arg2[32];
-    int n1, n2;
+    VarNumber n1, n2, result;
 
-    if (sscanf(args, "%s %s", arg1, arg2) != 2)
-    {
-        terminal_writestring("\nError: Need two numbers\n");
+    if (!read_operands(args, &n1, &n2))
         return;
-    }
-
-    n1 = atoi(arg1);
-    n2 = atoi(arg2);
 
-    int result = n1 + n2;
-    terminal_writeall("\n%d + %d = %d\n", n1, n2, result);
+    result = n1;
+    number_apply(&result, '+', &n2);
+    print_operation(&n1, "+", &n2, &result);
 }
 
 void cmd_sub(const char *args)
@@ -82,20 +124,14 @@ void cmd_sub(const char *args)
         return;
     }
 
-    char arg1[32], arg2[32];
-    int n1, n2;
+    VarNumber n1, n2, result;
 
-    if (sscanf(args, "%s %s", arg1, arg2) != 2)
-    {
-        terminal_writestring("\nError: Need two numbers\n");
+    if (!read_operands(args, &n1, &n2))
         return;
-    }
-
-    n1 = atoi(arg1);
-    n2 = atoi(arg2);
 
-    int result = n1 - n2;
-    terminal_writeall("\n%d + %d = %d\n", n1, n2, result);
+    result = n1;
+    number_apply(&result, '-', &n2);
+    print_operation(&n1, "-", &n2, &result);
 }
 
 void cmd_schar(const char *args)
@@ -149,24 +185,18 @@ void cmd_div(const char *args)
         return;
     }
 
-    char arg1[32], arg2[32];
-    int n1, n2;
+    VarNumber n1, n2, result;
 
-    if (sscanf(args, "%s %s", arg1, arg2) != 2)
-    {
-        terminal_writestring("\nError: Need two numbers\n");
+    if (!read_operands(args, &n1, &n2))
         return;
-    }
 
-    n1 = atoi(arg1);
-    n2 = atoi(arg2);
-
-    if (n1 == 0 || n2 == 0)
+    result = n1;
+    if (!number_apply(&result, '/', &n2))
     {
-        panic_with_code("Divide by zero exception", 0x00);
+        terminal_writestring("\nError: Division by zero\n");
+        return;
     }
-    int result = n1 / n2;
-    terminal_writeall("\n%d / %d = %d\n", n1, n2, result);
+    print_operation(&n1, "/", &n2, &result);
 }
 
 void shutdown_system(void)
@@ -203,14 +233,8 @@ void shutdown_system(void)
 void cmd_help(void)
 {
     terminal_writestring("\n=== T84 OS Commands ===\n");
-    terminal_writestring("help                - Show this help\n");
-    terminal_writestring("clear, cls          - Clear screen\n");
-    terminal_writestring("echo <text>         - Print text\n");
-    terminal_writestring("print <text>        - Alias for echo\n");
-    terminal_writestring("about               - About T84 OS\n");
-    terminal_writestring("exit, quit          - Show exit message\n");
-    terminal_writestring("shutdown 0          - Shutdown kernel\n");
-    terminal_writestring("run (NOTE: Only for examples [run examples/avaliable examples])\n");
+    cmdtable_help();
+    terminal_writestring("Ctrl+C              - Stop a running FOR, tparse or tlang job\n");
     terminal_writestring("Hold SHIFT for uppercase letters\n");
 }
 
@@ -251,6 +275,29 @@ void cmd_clear(int mode)
     }
 }
 
+/* Copies the trimmed name left of '=' and returns the text after it. */
+static const char *split_assignment(const char *args, char *name)
+{
+    const char *equals = strchr(args, '=');
+    if (!equals)
+        return NULL;
+
+    while (*args == ' ')
+        args++;
+
+    int name_len = equals - args;
+    if (name_len > 31)
+        name_len = 31;
+
+    memcpy(name, args, name_len);
+    name[name_len] = '\0';
+
+    while (name_len > 0 && name[name_len - 1] == ' ')
+        name[--name_len] = '\0';
+
+    return name_len > 0 ? equals + 1 : NULL;
+}
+
 void cmd_int(const char *args)
 {
     if (!args || strlen(args) == 0)
@@ -261,14 +308,17 @@ void cmd_int(const char *args)
     }
 
     char name[32];
-    int value;
+    VarNumber number;
+    const char *expr = split_assignment(args, name);
 
-    if (sscanf(args, "%s = %d", name, &value) != 2)
+    if (!expr || !eval_expression(expr, &number))
     {
         terminal_writestring("\nError: Syntax: INT <name> = <value>\n");
         return;
     }
 
+    int value = number.type == VAR_FLOAT ? (int)number.value.float_value : number.value.int_value;
+
     if (var_set_int(name, value))
     {
         terminal_writestring("\nInteger variable '");
@@ -285,6 +335,43 @@ void cmd_int(const char *args)
     }
 }
 
+void cmd_dec(const char *args)
+{
+    if (!args || strlen(args) == 0)
+    {
+        terminal_writestring("\nUsage: DEC <name> = <value>\n");
+        terminal_writestring("Example: DEC pi = 3.14159\n");
+        return;
+    }
+
+    char name[32];
+    VarNumber number;
+    const char *expr = split_assignment(args, name);
+
+    if (!expr || !eval_expression(expr, &number))
+    {
+        terminal_writestring("\nError: Syntax: DEC <name> = <value>\n");
+        return;
+    }
+
+    float value = number_as_float(&number);
+
+    if (var_set_float(name, value))
+    {
+        char val_str[FLOAT_STR_MAX];
+        float_format(value, val_str);
+        terminal_writestring("\nDecimal variable '");
+        terminal_writestring(name);
+        terminal_writestring("' set to ");
+        terminal_writestring(val_str);
+        terminal_writestring("\n");
+    }
+    else
+    {
+        terminal_writestring("\nError: Failed to create variable\n");
+    }
+}
+
 void cmd_string(const char *args)
 {
     if (!args || strlen(args) == 0)
@@ -526,7 +613,7 @@ bool evaluate_condition(const char *condition)
     if (strcmp(cond, "false") == 0)
         return false;
 
-    char *operators[] = {"==", "!=", ">", "<", ">=", "<="};
+    char *operators[] = {"==", "!=", ">=", "<=", ">", "<"};
     char *found_op = NULL;
     int op_index = -1;
 
@@ -551,6 +638,8 @@ bool evaluate_condition(const char *condition)
             {
                 if (var->type == VAR_INT)
                     return var->value.int_value != 0;
+                if (var->type == VAR_FLOAT)
+                    return var->value.float_value != 0.0f;
                 if (var->type == VAR_BOOL)
                     return var->value.bool_value;
                 if (var->type == VAR_STRING && var->value.string_value)
@@ -582,54 +671,49 @@ bool evaluate_condition(const char *condition)
     right_part[right_len] = '\0';
     trim_spaces(right_part);
 
-    int left_val = 0, right_val = 0;
-    bool left_is_var = false, right_is_var = false;
-    Variable *left_var = NULL, *right_var = NULL;
-
-    if (left_part[0] == '&')
+    if (left_part[0] == '&' && right_part[0] == '&' && op_index <= 1)
     {
-        left_var = var_get(left_part + 1);
-        if (left_var && left_var->type == VAR_INT)
+        Variable *left_var = var_get(left_part + 1);
+        Variable *right_var = var_get(right_part + 1);
+
+        if (left_var && right_var && left_var->type == VAR_STRING && right_var->type == VAR_STRING)
         {
-            left_val = left_var->value.int_value;
-            left_is_var = true;
+            bool equal = strcmp(left_var->value.string_value, right_var->value.string_value) == 0;
+            return op_index == 0 ? equal : !equal;
         }
     }
-    else
-    {
-        left_val = string_to_int(left_part);
-    }
 
-    if (right_part[0] == '&')
+    VarNumber left, right;
+
+    if (!eval_expression(left_part, &left) || !eval_expression(right_part, &right))
+        return false;
+
+    int cmp;
+    if (left.type == VAR_INT && right.type == VAR_INT)
     {
-        right_var = var_get(right_part + 1);
-        if (right_var && right_var->type == VAR_INT)
-        {
-            right_val = right_var->value.int_value;
-            right_is_var = true;
-        }
+        cmp = (left.value.int_value > right.value.int_value) - (left.value.int_value < right.value.int_value);
     }
     else
     {
-        right_val = string_to_int(right_part);
+        float l = number_as_float(&left);
+        float r = number_as_float(&right);
+        cmp = (l > r) - (l < r);
     }
 
     switch (op_index)
     {
     case 0:
-        if (left_is_var && right_is_var && left_var->type == VAR_STRING && right_var->type == VAR_STRING)
-            return strcmp(left_var->value.string_value, right_var->value.string_value) == 0;
-        return left_val == right_val;
+        return cmp == 0;
     case 1:
-        return left_val != right_val;
+        return cmp != 0;
     case 2:
-        return left_val > right_val;
+        return cmp >= 0;
     case 3:
-        return left_val < right_val;
+        return cmp <= 0;
     case 4:
-        return left_val >= right_val;
+        return cmp > 0;
     case 5:
-        return left_val <= right_val;
+        return cmp < 0;
     }
 
     return false;
@@ -705,99 +789,7 @@ void cmd_if(const char *args)
     {
         terminal_writestring("\n[IF TRUE] ");
 
-        char *cmd = command;
-        char *cmd_args = NULL;
-
-        for (int i = 0; command[i]; i++)
-        {
-            if (command[i] == ' ')
-            {
-                command[i] = '\0';
-                cmd_args = &command[i + 1];
-                break;
-            }
-        }
-
-        if (strcmp(cmd, "echo") == 0 || strcmp(cmd, "print") == 0)
-        {
-            if (cmd_args)
-            {
-
-                char output[512];
-                int out_idx = 0;
-
-                for (int i = 0; cmd_args[i] && out_idx < 511; i++)
-                {
-                    if (cmd_args[i] == '&' && cmd_args[i + 1])
-                    {
-
-                        char var_name[32];
-                        int var_idx = 0;
-                        i++;
-
-                        while (cmd_args[i] && cmd_args[i] != ' ' && var_idx < 31)
-                        {
-                            var_name[var_idx++] = cmd_args[i++];
-                        }
-                        var_name[var_idx] = '\0';
-                        i--;
-
-                        Variable *var = var_get(var_name);
-                        if (var)
-                        {
-                            if (var->type == VAR_INT)
-                            {
-                                char val_str[16];
-                                itoa(var->value.int_value, val_str, 10);
-                                for (int j = 0; val_str[j] && out_idx < 511; j++)
-                                {
-                                    output[out_idx++] = val_str[j];
-                                }
-                            }
-                            else if (var->type == VAR_STRING && var->value.string_value)
-                            {
-                                for (int j = 0; var->value.string_value[j] && out_idx < 511; j++)
-                                {
-                                    output[out_idx++] = var->value.string_value[j];
-                                }
-                            }
-                        }
-                        else
-                        {
-                            output[out_idx++] = '?';
-                        }
-                    }
-                    else
-                    {
-                        output[out_idx++] = cmd_args[i];
-                    }
-                }
-                output[out_idx] = '\0';
-                terminal_writestring(output);
-            }
-            terminal_writestring("\n");
-        }
-        else if (cmd[0] == '&')
-        {
-
-            print_var_by_name(cmd + 1);
-            terminal_writestring("\n");
-        }
-        else if (strcmp(cmd, "INT") == 0 && cmd_args)
-        {
-
-            cmd_int(cmd_args);
-        }
-        else if (strcmp(cmd, "STRING") == 0 && cmd_args)
-        {
-
-            cmd_string(cmd_args);
-        }
-        else if (strcmp(cmd, "clear") == 0 || strcmp(cmd, "cls") == 0)
-        {
-            cmd_clear(1);
-        }
-        else
+        if (!execute_command_with_vars(command))
         {
             terminal_writestring("Executing: ");
             terminal_writestring(command);
@@ -813,97 +805,191 @@ void cmd_if(const char *args)
     }
 }
 
-void execute_command_with_vars(const char *command)
+/* The text &name stands for; '?' for unset or non-printable variables. */
+static const char *var_text(Variable *var, char *buf)
+{
+    if (var && var->type == VAR_INT)
+    {
+        itoa(var->value.int_value, buf, 10);
+        return buf;
+    }
+    if (var && var->type == VAR_FLOAT)
+    {
+        float_format(var->value.float_value, buf);
+        return buf;
+    }
+    if (var && var->type == VAR_STRING && var->value.string_value)
+    {
+        return var->value.string_value;
+    }
+    return "?";
+}
+
+/*
+ * Runs the command of a FOR or IF line.  &name in the arguments becomes
+ * the variable's value ('?' if unset); the command word itself is left
+ * alone so "&x" still prints x.
+ */
+bool execute_command_with_vars(const char *command)
 {
-    char cmd[256];
-    char args[256];
+    char expanded[512];
+    int idx = 0;
+    int i = 0;
 
-    strcpy(cmd, command);
-    char *space_pos = NULL;
+    while (command[i] && command[i] != ' ' && idx < 511)
+    {
+        expanded[idx++] = command[i++];
+    }
 
-    for (int i = 0; cmd[i]; i++)
+    for (; command[i] && idx < 511; i++)
     {
-        if (cmd[i] == ' ')
+        if (command[i] != '&' || !command[i + 1] || command[i + 1] == ' ')
         {
-            cmd[i] = '\0';
-            space_pos = &cmd[i + 1];
-            break;
+            expanded[idx++] = command[i];
+            continue;
         }
-    }
 
-    if (space_pos)
-    {
-        strcpy(args, space_pos);
+        char var_name[32];
+        int var_idx = 0;
+        i++;
+
+        while (command[i] && command[i] != ' ' && command[i] != '=' && var_idx < 31)
+        {
+            var_name[var_idx++] = command[i++];
+        }
+        var_name[var_idx] = '\0';
+        i--;
+
+        char val[FLOAT_STR_MAX];
+        const char *text = var_text(var_get(var_name), val);
+
+        for (int j = 0; text[j] && idx < 511; j++)
+        {
+            expanded[idx++] = text[j];
+        }
     }
-    else
+    expanded[idx] = '\0';
+
+    return cmdtable_execute(expanded, CMD_INLINE);
+}
+
+/*
+ * A FOR body compiled once: the command is resolved in the table and its
+ * arguments split into literal runs and &var slots.  Slots cache the
+ * Variable on first hit, since the body may create variables as it runs.
+ */
+#define FOR_MAX_SEGMENTS 24
+
+typedef struct
+{
+    const char *text;
+    int len;
+    bool is_var;
+    Variable *var;
+    char name[32];
+} ForSegment;
+
+typedef struct
+{
+    char line[256];
+    const Command *command;
+    const char *args;
+    int segment_count;
+    ForSegment segments[FOR_MAX_SEGMENTS];
+} ForTemplate;
+
+static bool for_add_segment(ForTemplate *tmpl, const char *text, int len, bool is_var)
+{
+    if (len == 0 && !is_var)
+        return true;
+    if (tmpl->segment_count >= FOR_MAX_SEGMENTS)
+        return false;
+
+    ForSegment *seg = &tmpl->segments[tmpl->segment_count++];
+    seg->text = text;
+    seg->len = len;
+    seg->is_var = is_var;
+    seg->var = NULL;
+
+    if (is_var)
     {
-        args[0] = '\0';
+        memcpy(seg->name, text, len);
+        seg->name[len] = '\0';
     }
+    return true;
+}
+
+/* Returns false when the body has too many &vars to template. */
+static bool for_compile(ForTemplate *tmpl, const char *command)
+{
+    strcpy(tmpl->line, command);
+    tmpl->command = cmdtable_prepare(tmpl->line, CMD_INLINE, &tmpl->args);
+    tmpl->segment_count = 0;
+
+    /* "&var" as the command is passed through unexpanded. */
+    if (!tmpl->args || tmpl->line[0] == '&')
+        return true;
+
+    const char *p = tmpl->args;
+    const char *literal = p;
 
-    if (strcmp(cmd, "echo") == 0 || strcmp(cmd, "print") == 0)
+    while (*p)
     {
-        terminal_writestring("\n");
-        if (args[0])
+        if (*p != '&' || !p[1] || p[1] == ' ')
         {
+            p++;
+            continue;
+        }
 
-            char output[512];
-            int idx = 0;
+        if (!for_add_segment(tmpl, literal, p - literal, false))
+            return false;
 
-            for (int i = 0; args[i] && idx < 511; i++)
-            {
-                if (args[i] == '&' && args[i + 1])
-                {
-                    char var_name[32];
-                    int var_idx = 0;
-                    i++;
+        const char *name = ++p;
+        while (*p && *p != ' ' && *p != '=' && p - name < 31)
+            p++;
 
-                    while (args[i] && args[i] != ' ' && var_idx < 31)
-                    {
-                        var_name[var_idx++] = args[i++];
-                    }
-                    var_name[var_idx] = '\0';
-                    i--;
+        if (!for_add_segment(tmpl, name, p - name, true))
+            return false;
+        literal = p;
+    }
 
-                    Variable *var = var_get(var_name);
-                    if (var)
-                    {
-                        if (var->type == VAR_INT)
-                        {
-                            char val[16];
-                            itoa(var->value.int_value, val, 10);
-                            for (int j = 0; val[j] && idx < 511; j++)
-                            {
-                                output[idx++] = val[j];
-                            }
-                        }
-                        else if (var->type == VAR_STRING && var->value.string_value)
-                        {
-                            for (int j = 0; var->value.string_value[j] && idx < 511; j++)
-                            {
-                                output[idx++] = var->value.string_value[j];
-                            }
-                        }
-                    }
-                    else
-                    {
-                        output[idx++] = '?';
-                    }
-                }
-                else
-                {
-                    output[idx++] = args[i];
-                }
-            }
-            output[idx] = '\0';
-            terminal_writestring(output);
-        }
-        terminal_writestring("\n");
+    return for_add_segment(tmpl, literal, p - literal, false);
+}
+
+static void for_run_template(ForTemplate *tmpl)
+{
+    if (!tmpl->args || tmpl->line[0] == '&')
+    {
+        tmpl->command->handler(tmpl->args);
+        return;
     }
-    else if (cmd[0] == '&')
+
+    char expanded[512];
+    int idx = 0;
+
+    for (int s = 0; s < tmpl->segment_count; s++)
     {
-        print_var_by_name(cmd + 1);
-        terminal_writestring("\n");
+        ForSegment *seg = &tmpl->segments[s];
+        const char *text = seg->text;
+        int len = seg->len;
+        char val[FLOAT_STR_MAX];
+
+        if (seg->is_var)
+        {
+            if (!seg->var)
+                seg->var = var_get(seg->name);
+            text = var_text(seg->var, val);
+            len = strlen(text);
+        }
+
+        if (len > 511 - idx)
+            len = 511 - idx;
+        memcpy(expanded + idx, text, len);
+        idx += len;
     }
+    expanded[idx] = '\0';
+
+    tmpl->command->handler(expanded);
 }
 
 void cmd_for(const char *args)
@@ -911,20 +997,29 @@ void cmd_for(const char *args)
     if (!args || strlen(args) == 0)
     {
         terminal_writestring("\n=== FOR LOOP ===\n");
-        terminal_writestring("Syntax: FOR <var> = <start> TO <end> DO <command>\n\n");
+        terminal_writestring("Syntax: FOR [-q] <var> = <start> TO <end> DO <command>\n\n");
         terminal_writestring("Parameters:\n");
         terminal_writestring("  var    - Variable name (will be created as INT)\n");
         terminal_writestring("  start  - Starting value (integer)\n");
         terminal_writestring("  end    - Ending value (integer)\n");
-        terminal_writestring("  command- Command to execute each iteration\n\n");
+        terminal_writestring("  command- Command to execute each iteration\n");
+        terminal_writestring("  -q     - Quiet: no loop and iteration banners\n\n");
         terminal_writestring("Examples:\n");
         terminal_writestring("  FOR i = 1 TO 10 DO echo &i\n");
         terminal_writestring("  FOR x = 0 TO 5 DO echo Counting: &x\n");
         terminal_writestring("  FOR n = 10 TO 0 DO echo Countdown: &n\n");
         terminal_writestring("  FOR idx = 1 TO 3 DO INT var&idx = &idx\n");
+        terminal_writestring("  FOR -q i = 1 TO 1000 DO INT last = &i\n");
         return;
     }
 
+    bool quiet = false;
+    if (args[0] == '-' && args[1] == 'q' && args[2] == ' ')
+    {
+        quiet = true;
+        args += 3;
+    }
+
     char *equals_pos = NULL;
     for (int i = 0; args[i]; i++)
     {
@@ -1049,172 +1144,80 @@ void cmd_for(const char *args)
     }
 
     int step = (start_val <= end_val) ? 1 : -1;
-
-    terminal_writestring("\n[FOR LOOP] ");
-    terminal_writestring(var_name);
-    terminal_writestring(" from ");
-
     char num_str[16];
-    itoa(start_val, num_str, 10);
-    terminal_writestring(num_str);
-
-    terminal_writestring(" to ");
-    itoa(end_val, num_str, 10);
-    terminal_writestring(num_str);
 
-    terminal_writestring(" (step ");
-    itoa(step, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring(")\n");
-
-    for (int i = start_val; (step > 0) ? (i <= end_val) : (i >= end_val); i += step)
+    if (!quiet)
     {
+        terminal_writestring("\n[FOR LOOP] ");
+        terminal_writestring(var_name);
+        terminal_writestring(" from ");
 
-        var_set_int(var_name, i);
+        itoa(start_val, num_str, 10);
+        terminal_writestring(num_str);
 
-        terminal_writestring("  Iteration ");
-        itoa(i, num_str, 10);
+        terminal_writestring(" to ");
+        itoa(end_val, num_str, 10);
         terminal_writestring(num_str);
-        terminal_writestring(": ");
 
-        char *cmd = command;
-        char *cmd_args = NULL;
+        terminal_writestring(" (step ");
+        itoa(step, num_str, 10);
+        terminal_writestring(num_str);
+        terminal_writestring(")\n");
+    }
+
+    ForTemplate tmpl;
+    bool compiled = for_compile(&tmpl, command);
 
-        char cmd_copy[256];
-        strcpy(cmd_copy, command);
+    var_set_int(var_name, start_val);
+    Variable *loop_var = var_get(var_name);
 
-        for (int j = 0; cmd_copy[j]; j++)
+    for (int i = start_val; (step > 0) ? (i <= end_val) : (i >= end_val); i += step)
+    {
+        /* The body may retype the variable; fall back to a full set then. */
+        if (loop_var && loop_var->type == VAR_INT)
         {
-            if (cmd_copy[j] == ' ')
-            {
-                cmd_copy[j] = '\0';
-                cmd_args = &cmd_copy[j + 1];
-                break;
-            }
+            loop_var->value.int_value = i;
         }
-
-        if (strcmp(cmd, "echo") == 0 || strcmp(cmd, "print") == 0)
+        else
         {
-            if (cmd_args)
-            {
-
-                char output[512];
-                int out_idx = 0;
-
-                for (int j = 0; cmd_args[j] && out_idx < 511; j++)
-                {
-                    if (cmd_args[j] == '&' && cmd_args[j + 1])
-                    {
-
-                        char loop_var_name[32];
-                        int var_idx = 0;
-                        j++;
-
-                        while (cmd_args[j] && cmd_args[j] != ' ' && var_idx < 31)
-                        {
-                            loop_var_name[var_idx++] = cmd_args[j++];
-                        }
-                        loop_var_name[var_idx] = '\0';
-                        j--;
-
-                        Variable *var = var_get(loop_var_name);
-                        if (var)
-                        {
-                            if (var->type == VAR_INT)
-                            {
-                                char val_str[16];
-                                itoa(var->value.int_value, val_str, 10);
-                                for (int k = 0; val_str[k] && out_idx < 511; k++)
-                                {
-                                    output[out_idx++] = val_str[k];
-                                }
-                            }
-                            else if (var->type == VAR_STRING && var->value.string_value)
-                            {
-                                for (int k = 0; var->value.string_value[k] && out_idx < 511; k++)
-                                {
-                                    output[out_idx++] = var->value.string_value[k];
-                                }
-                            }
-                        }
-                        else
-                        {
-                            output[out_idx++] = '?';
-                        }
-                    }
-                    else
-                    {
-                        output[out_idx++] = cmd_args[j];
-                    }
-                }
-                output[out_idx] = '\0';
-                terminal_writestring(output);
-            }
-            terminal_writestring("\n");
+            var_set_int(var_name, i);
+            loop_var = var_get(var_name);
         }
-        else if (cmd[0] == '&')
+
+        if (!quiet)
         {
+            terminal_writestring("  Iteration ");
+            itoa(i, num_str, 10);
+            terminal_writestring(num_str);
+            terminal_writestring(": ");
+        }
 
-            print_var_by_name(cmd + 1);
+        if (!tmpl.command)
+        {
+            terminal_writestring("Executing: ");
+            terminal_writestring(command);
             terminal_writestring("\n");
         }
-        else if (strcmp(cmd, "INT") == 0 && cmd_args)
+        else if (compiled)
         {
-
-            char int_cmd[256];
-            strcpy(int_cmd, cmd_args);
-
-            char final_cmd[256];
-            int final_idx = 0;
-
-            for (int j = 0; int_cmd[j] && final_idx < 255; j++)
-            {
-                if (int_cmd[j] == '&' && int_cmd[j + 1])
-                {
-
-                    char dyn_var[32];
-                    int dyn_idx = 0;
-                    j++;
-
-                    while (int_cmd[j] && int_cmd[j] != ' ' && int_cmd[j] != '=' && dyn_idx < 31)
-                    {
-                        dyn_var[dyn_idx++] = int_cmd[j++];
-                    }
-                    dyn_var[dyn_idx] = '\0';
-                    j--;
-
-                    Variable *dyn = var_get(dyn_var);
-                    if (dyn && dyn->type == VAR_INT)
-                    {
-                        char dyn_val[16];
-                        itoa(dyn->value.int_value, dyn_val, 10);
-                        for (int k = 0; dyn_val[k] && final_idx < 255; k++)
-                        {
-                            final_cmd[final_idx++] = dyn_val[k];
-                        }
-                    }
-                }
-                else
-                {
-                    final_cmd[final_idx++] = int_cmd[j];
-                }
-            }
-            final_cmd[final_idx] = '\0';
-
-            cmd_int(final_cmd);
+            for_run_template(&tmpl);
         }
         else
         {
-            terminal_writestring("Executing: ");
-            terminal_writestring(command);
-            terminal_writestring("\n");
+            execute_command_with_vars(command);
         }
 
-        for (volatile int d = 0; d < 10000; d++)
-            ;
+        if (!quiet)
+        {
+            for (volatile int d = 0; d < 10000; d++)
+                ;
+        }
     }
 
-    terminal_writestring("[END FOR LOOP]\n");
+    if (!quiet)
+    {
+        terminal_writestring("[END FOR LOOP]\n");
+    }
 }
 
 void cmd_list_vars(void)
@@ -1228,14 +1231,249 @@ void cmd_about(void)
     terminal_writestring("\n    Working!  \n");
 }
 
+static void batch_for(void *arg)
+{
+    cmd_for((const char *)arg);
+}
+
+static void batch_tparse(void *arg)
+{
+    cmd_tparse((const char *)arg);
+}
+
+static void batch_tlang(void *arg)
+{
+    cmd_tlang((const char *)arg);
+}
+
+static void shell_help(const char *args)
+{
+    (void)args;
+    cmd_help();
+}
+
+static void shell_clear(const char *args)
+{
+    cmd_clear(args && strcmp(args, "max") == 0 ? 0 : 1);
+}
+
+static void inline_echo(const char *args)
+{
+    if (args)
+    {
+        terminal_writestring(args);
+    }
+    terminal_writestring("\n");
+}
+
+static void inline_print_var(const char *token)
+{
+    print_var_by_name(token + 1);
+    terminal_writestring("\n");
+}
+
+static void shell_about(const char *args)
+{
+    (void)args;
+    cmd_about();
+}
+
+static void shell_exit(const char *args)
+{
+    (void)args;
+    terminal_writestring("\nT84 OS kernel cannot be exited.\n");
+    terminal_writestring("Use Ctrl+Alt+Delete to reboot the system.\n");
+}
+
+static void shell_shutdown(const char *arg)
+{
+    if (arg && strcmp(arg, "0") == 0)
+    {
+        bcache_sync(-1);
+        shutdown_system();
+    }
+    else if (arg && strcmp(arg, "-1") == 0)
+    {
+        panic_with_code("Shutdown with \"-1\" arguments exception.", 0x10);
+    }
+    else
+    {
+        terminal_writestring("\nUsage: shutdown 0\n");
+        terminal_writestring("This will power off the system.\n");
+    }
+}
+
+static void shell_kernel(const char *arg)
+{
+    if (arg && strcmp(arg, "-version") == 0)
+    {
+        terminal_writestring("\nT84 Kernel version: 1.8.4 (NOTE: the x.8.4 is a reference of the kernel name)\n");
+    }
+    else
+    {
+        terminal_writestring("\nUsage: -version ");
+        terminal_writestring("\nThis will show you the T84 Kernel version\n");
+    }
+}
+
+static void shell_run(const char *arg)
+{
+    if (arg && strncmp(arg, "examples/", 9) == 0)
+    {
+        cmd_run_example(arg);
+    }
+}
+
+static void shell_for(const char *arg)
+{
+    sched_run_foreground("for", batch_for, (void *)arg);
+}
+
+static void shell_vars(const char *args)
+{
+    (void)args;
+    cmd_list_vars();
+}
+
+static void shell_open(const char *arg)
+{
+    if (arg && strcmp(arg, "ttest") == 0)
+    {
+        terminal_writestring("\n\n");
+        load_ttest_app();
+    }
+    else if (arg && strncmp(arg, "4ide ", 5) == 0)
+    {
+        cmd_open_ide(arg);
+    }
+}
+
+static void shell_pwd(const char *args)
+{
+    (void)args;
+    cmd_pwd();
+}
+
+static void shell_tparse(const char *arg)
+{
+    sched_run_foreground("tparse", batch_tparse, (void *)arg);
+}
+
+static void shell_tlang(const char *arg)
+{
+    sched_run_foreground("tlang", batch_tlang, (void *)arg);
+}
+
+static void shell_daily_phrase(const char *arg)
+{
+    static uint32_t rng_state = 0xA3F1C9E7;
+
+    if (!(arg && strcmp(arg, "-force") == 0) && usedDailyPhrase)
+    {
+        terminal_writestring(
+            "You already used the daily phrase! \n"
+            "(TIP: Type daily_phrase -force to run anyway!)\n");
+        return;
+    }
+
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    uint32_t phrase_index = rng_state % DAILY_PHRASES_COUNT;
+
+    terminal_writeall("\nDaily phrase: ");
+    terminal_writeall(daily_phrases[phrase_index]);
+    terminal_writeall("\n");
+
+    usedDailyPhrase = true;
+}
+
+#define CMD_SCRIPTABLE (CMD_SHELL | CMD_SCRIPT)
+
+/* Help lists the CMD_SHELL entries in this order. */
+static const Command shell_commands[] = {
+    {"help", {NULL}, shell_help, CMD_SCRIPTABLE, NULL, "Show this help"},
+    {"clear", {"cls"}, shell_clear, CMD_SCRIPTABLE | CMD_INLINE, "clear, cls [max]", "Clear screen"},
+    {"echo", {"print"}, cmd_echo, CMD_SCRIPTABLE, "echo, print <text>", "Print text"},
+    {"echo", {"print"}, inline_echo, CMD_INLINE, NULL, NULL},
+    {"about", {NULL}, shell_about, CMD_SHELL, NULL, "About T84 OS"},
+    {"exit", {"quit"}, shell_exit, CMD_SHELL, "exit, quit", "Show exit message"},
+    {"shutdown", {NULL}, shell_shutdown, CMD_SHELL, "shutdown 0", "Shutdown kernel"},
+    {"kernel", {NULL}, shell_kernel, CMD_SHELL, "kernel -version", "Show the kernel version"},
+    {"run", {NULL}, shell_run, CMD_SHELL, "run examples/<name>", "Run a built-in example"},
+    {"sum", {NULL}, cmd_sum, CMD_SCRIPTABLE, "sum <a> <b>", "Add two numbers"},
+    {"subtract", {NULL}, cmd_sub, CMD_SCRIPTABLE, "subtract <a> <b>", "Subtract two numbers"},
+    {"divide", {NULL}, cmd_div, CMD_SCRIPTABLE, "divide <a> <b>", "Divide two numbers"},
+    {"int", {NULL}, cmd_int, CMD_SCRIPTABLE | CMD_INLINE, "INT <name> = <n>", "Set an integer variable"},
+    {"string", {NULL}, cmd_string, CMD_SCRIPTABLE | CMD_INLINE, "STRING <name> = \"s\"", "Set a string variable"},
+    {"schar", {NULL}, cmd_schar, CMD_SCRIPTABLE, NULL, NULL},
+    {"dec", {"float"}, cmd_dec, CMD_SCRIPTABLE | CMD_INLINE, "DEC <name> = <n.n>", "Set a decimal variable"},
+    {"&", {NULL}, cmd_print_var, CMD_SCRIPTABLE, "&<name>", "Print a variable"},
+    {"&", {NULL}, inline_print_var, CMD_INLINE, NULL, NULL},
+    {"if", {NULL}, cmd_if, CMD_SCRIPTABLE, "IF <cond> THEN <cmd>", "Run a command if the condition holds"},
+    {"for", {NULL}, shell_for, CMD_SCRIPTABLE, "FOR <v> = <a> TO <b> DO <cmd>", "Repeat a command"},
+    {"vars", {"variables"}, shell_vars, CMD_SHELL, "vars, variables", "List variables"},
+    {"open", {NULL}, shell_open, CMD_SHELL, "open ttest|4ide <f>", "Open an app"},
+    {"code", {NULL}, cmd_open_ide, CMD_SHELL, "code <file>", "Edit a file in 4IDE"},
+    {"dir", {NULL}, cmd_dir, CMD_SHELL, "dir <name>", "Create a directory"},
+    {"fs", {NULL}, cmd_fs, CMD_SHELL, "fs <name>", "Create a file"},
+    {"cd", {NULL}, cmd_cd, CMD_SHELL, "cd <dir>", "Change directory"},
+    {"write", {NULL}, cmd_write, CMD_SHELL, "write <file> <text>", "Write text to a file"},
+    {"append", {NULL}, cmd_append, CMD_SHELL, "append <file> <text>", "Append a line to a file"},
+    {"ls", {NULL}, cmd_ls, CMD_SHELL, NULL, "List the current directory"},
+    {"cat", {NULL}, cmd_cat, CMD_SHELL, "cat <file>", "Print a file"},
+    {"pwd", {NULL}, shell_pwd, CMD_SHELL, NULL, "Print the current directory"},
+    {"sync", {NULL}, cmd_sync, CMD_SHELL, "sync [-format]", "Save the file system to disk"},
+    {"snapshot", {NULL}, cmd_snapshot, CMD_SHELL, "snapshot [save|restore|drop <name>]", "Save or roll back the file system in memory"},
+    {"disk", {NULL}, cmd_disk, CMD_SHELL, NULL, "List ATA disks"},
+    {"tparse", {NULL}, shell_tparse, CMD_SHELL, "tparse <file.T>", "Run a T84 script"},
+    {"tlang", {NULL}, shell_tlang, CMD_SHELL, "tlang [-p] <file.T>", "Run TLANG scripts, -p in parallel"},
+    {"tasks", {NULL}, cmd_tasks, CMD_SHELL, NULL, "List running tasks and CPU usage"},
+    {"sched", {NULL}, cmd_sched, CMD_SHELL, NULL, "Show or set scheduler time slices"},
+    {"cpus", {NULL}, cmd_cpus, CMD_SHELL, NULL, "List processors and their run queues"},
+    {"cpuinfo", {NULL}, cmd_cpuinfo, CMD_SHELL, NULL, "Show CPUID vendor, caches and features"},
+    {"strbench", {NULL}, cmd_strbench, CMD_SHELL, NULL, "Benchmark the string routines"},
+    {"daily_phrase", {NULL}, shell_daily_phrase, CMD_SHELL, "daily_phrase [-force]", "Show a phrase of the day"},
+    {"cstat", {NULL}, cmd_cstat, CMD_SHELL, NULL, "System monitor"},
+};
+
 void kernel_main(void)
 {
 
+    cmdtable_register(shell_commands, sizeof(shell_commands) / sizeof(shell_commands[0]));
+
+    /* Before anything clears the screen: picks the mem* routines. */
+    cpu_detect();
+    cpu_enable_sse();
+    string_select_impl();
+    multiboot_init();
+
     terminal_initialize();
     keyboard_init();
+    ata_init();
     fs_init();
     vars_init();
 
+    /* Apps return here through GLOBAL_exit_app(); the hardware is
+       already set up by then. */
+    static bool hardware_ready = false;
+    if (!hardware_ready)
+    {
+        __asm__ volatile("cli");
+        gdt_install();
+        isr_install();
+        irq_install();
+        timer_init();
+        sched_init();
+        ata_enable_irq();
+        __asm__ volatile("sti");
+        smp_init();
+        timer_enable_lapic();
+        bcache_start_flusher();
+        hardware_ready = true;
+    }
+
     uint8_t bg_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_LIGHT_GREY);
     uint8_t header_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLUE);
     uint8_t line_color = vga_entry_color(VGA_COLOR_BLUE, VGA_COLOR_LIGHT_GREY);
@@ -1689,6 +1927,10 @@ void kernel_main(void)
                     terminal_putchar('_');
                 }
             }
+            else
+            {
+                sched_wait_input(0);
+            }
         }
 
         if (pos > 0)
@@ -1712,215 +1954,16 @@ void kernel_main(void)
 
         terminal_writestring("\n");
 
-        char *cmd = input;
-        char *arg = NULL;
-
-        for (int i = 0; input[i]; i++)
+        if (input[0] && !cmdtable_execute(input, CMD_SHELL))
         {
-            if (input[i] == ' ')
+            char *space = strchr(input, ' ');
+            if (space)
             {
-                input[i] = '\0';
-                arg = &input[i + 1];
-                break;
+                *space = '\0';
             }
-        }
 
-        if (strcmp(cmd, "help") == 0)
-        {
-            cmd_help();
-        }
-        else if (strcmp(cmd, "clear") == 0 || strcmp(cmd, "cls") == 0)
-        {
-            if (arg && strcmp(arg, "max") == 0)
-            {
-                cmd_clear(0);
-            }
-            else
-            {
-                cmd_clear(1);
-            }
-        }
-        else if (strcmp(cmd, "echo") == 0 || strcmp(cmd, "print") == 0)
-        {
-            if (arg)
-            {
-                terminal_writestring("\n");
-                terminal_writestring(arg);
-            }
-            terminal_writestring("\n");
-        }
-        else if (strcmp(cmd, "about") == 0)
-        {
-            cmd_about();
-        }
-        else if (strcmp(cmd, "exit") == 0 || strcmp(cmd, "quit") == 0)
-        {
-            terminal_writestring("\nT84 OS kernel cannot be exited.\n");
-            terminal_writestring("Use Ctrl+Alt+Delete to reboot the system.\n");
-        }
-        else if (strcmp(cmd, "shutdown") == 0)
-        {
-            if (arg && strcmp(arg, "0") == 0)
-            {
-                shutdown_system();
-            }
-            else if (arg && strcmp(arg, "-1") == 0)
-            {
-                panic_with_code("Shutdown with \"-1\" arguments exception.", 0x10);
-            }
-            else
-            {
-                terminal_writestring("\nUsage: shutdown 0\n");
-                terminal_writestring("This will power off the system.\n");
-            }
-        }
-        else if (strcmp(cmd, "kernel") == 0)
-        {
-            if (arg && strcmp(arg, "-version") == 0)
-            {
-                terminal_writestring("\nT84 Kernel version: 1.8.4 (NOTE: the x.8.4 is a reference of the kernel name)\n");
-            }
-            else
-            {
-                terminal_writestring("\nUsage: -version ");
-                terminal_writestring("\nThis will show you the T84 Kernel version\n");
-            }
-        }
-        else if (strcmp(cmd, "sum") == 0)
-        {
-            cmd_sum(arg);
-        }
-        else if (strcmp(cmd, "subtract") == 0)
-        {
-            cmd_sub(arg);
-        }
-        else if (strcmp(cmd, "divide") == 0)
-        {
-            cmd_div(arg);
-        }
-        else if (strcmp(cmd, "run") == 0)
-        {
-            if (arg && strncmp(arg, "examples/", 9) == 0)
-            {
-                cmd_run_example(arg);
-            }
-        }
-        else if (strcmp(cmd, "INT") == 0 || strcmp(cmd, "int") == 0)
-        {
-            cmd_int(arg);
-        }
-        else if (strcmp(cmd, "STRING") == 0 || strcmp(cmd, "string") == 0 ||
-                 strcmp(cmd, "SCHAR") == 0 || strcmp(cmd, "schar") == 0)
-        {
-            cmd_string(arg);
-        }
-        else if (strcmp(cmd, "DEC") == 0 || strcmp(cmd, "dec") == 0 ||
-                 strcmp(cmd, "FLOAT") == 0 || strcmp(cmd, "float") == 0)
-        {
-            terminal_writestring("\nFLOAT variables coming soon...\n");
-        }
-        else if (cmd[0] == '&')
-        {
-            cmd_print_var(cmd);
-        }
-        else if (strcmp(cmd, "if") == 0 || strcmp(cmd, "IF") == 0)
-        {
-            cmd_if(arg);
-        }
-        else if (strcmp(cmd, "for") == 0 || strcmp(cmd, "FOR") == 0)
-        {
-            cmd_for(arg);
-        }
-        else if (strcmp(cmd, "vars") == 0 || strcmp(cmd, "variables") == 0)
-        {
-            cmd_list_vars();
-        }
-        else if (strcmp(cmd, "open") == 0)
-        {
-            if (arg && strcmp(arg, "ttest") == 0)
-            {
-                terminal_writestring("\n\n");
-                load_ttest_app();
-            }
-
-            else if (arg && strncmp(arg, "4ide ", 5) == 0)
-            {
-
-                cmd_open_ide(arg);
-            }
-        }
-        else if (strcmp(cmd, "code") == 0)
-        {
-            cmd_open_ide(arg);
-        }
-        else if (strcmp(cmd, "dir") == 0)
-        {
-            cmd_dir(arg);
-        }
-        else if (strcmp(cmd, "fs") == 0)
-        {
-            cmd_fs(arg);
-        }
-        else if (strcmp(cmd, "cd") == 0)
-        {
-            cmd_cd(arg);
-        }
-        else if (strcmp(cmd, "write") == 0)
-        {
-            cmd_write(arg);
-        }
-        else if (strcmp(cmd, "ls") == 0)
-        {
-            cmd_ls(arg);
-        }
-        else if (strcmp(cmd, "cat") == 0)
-        {
-            cmd_cat(arg);
-        }
-        else if (strcmp(cmd, "pwd") == 0)
-        {
-            cmd_pwd();
-        }
-        else if (strcmp(cmd, "tparse") == 0)
-        {
-            cmd_tparse(arg);
-        }
-        else if (strcmp(cmd, "tlang") == 0)
-        {
-            cmd_tlang(arg);
-        }
-        else if (strcmp(cmd, "daily_phrase") == 0)
-        {
-            static uint32_t rng_state = 0xA3F1C9E7;
-
-            if (!(arg && strcmp(arg, "-force") == 0) && usedDailyPhrase)
-            {
-                terminal_writestring(
-                    "You already used the daily phrase! \n"
-                    "(TIP: Type daily_phrase -force to run anyway!)\n");
-                return;
-            }
-
-            rng_state ^= rng_state << 13;
-            rng_state ^= rng_state >> 17;
-            rng_state ^= rng_state << 5;
-
-            uint32_t phrase_index = rng_state % DAILY_PHRASES_COUNT;
-
-            terminal_writeall("\nDaily phrase: ");
-            terminal_writeall(daily_phrases[phrase_index]);
-            terminal_writeall("\n");
-
-            usedDailyPhrase = true;
-        }
-        else if (strcmp(cmd, "cstat") == 0)
-        {
-            cmd_cstat(arg);
-        }
-        else if (cmd[0] != '\0')
-        {
             terminal_writestring("\nCommand not recognized: '");
-            terminal_writestring(cmd);
+            terminal_writestring(input);
             terminal_writestring("'\nType 'help' for available commands.\n");
         }
         terminal_writestring("\n");
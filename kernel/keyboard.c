@@ -1,6 +1,9 @@
 #include "keyboard.h"
 #include "vga.h"
 #include "string_utils.h"
+#include "sched.h"
+
+#define KEYBOARD_QUEUE_SIZE 64
 
 static const char keymap[128] = {
     0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
@@ -22,6 +25,10 @@ static const char keymap_shift[128] = {
 
 static bool shift_pressed = false;
 
+static volatile uint8_t scancode_queue[KEYBOARD_QUEUE_SIZE];
+static volatile uint32_t queue_head = 0;
+static volatile uint32_t queue_tail = 0;
+
 uint8_t inb(uint16_t port)
 {
     uint8_t result;
@@ -39,20 +46,51 @@ void keyboard_init(void)
     shift_pressed = false;
 }
 
+void keyboard_push_scancode(uint8_t scancode)
+{
+    uint32_t next = (queue_tail + 1) % KEYBOARD_QUEUE_SIZE;
+
+    if (next == queue_head)
+        return;
+
+    scancode_queue[queue_tail] = scancode;
+    queue_tail = next;
+}
+
+void keyboard_clear_queue(void)
+{
+    queue_head = queue_tail;
+}
+
 bool keyboard_available(void)
 {
+    if (queue_head != queue_tail)
+        return true;
+
+    if (!sched_is_input_owner())
+        return false;
+
     return (inb(0x64) & 0x01) != 0;
 }
 
+uint8_t keyboard_read_scancode(void)
+{
+    if (queue_head != queue_tail)
+    {
+        uint8_t scancode = scancode_queue[queue_head];
+        queue_head = (queue_head + 1) % KEYBOARD_QUEUE_SIZE;
+        return scancode;
+    }
+
+    return inb(0x60);
+}
+
 uint8_t keyboard_get_scancode(void)
 {
     while (!keyboard_available())
-        ;
-
-    uint8_t scancode;
-    __asm__ volatile("inb $0x60, %0" : "=a"(scancode));
+        sched_wait_input(0);
 
-    return scancode;
+    return keyboard_read_scancode();
 }
 
 char keyboard_getchar(void)
@@ -61,9 +99,10 @@ char keyboard_getchar(void)
 
     while (!keyboard_available())
     {
+        sched_wait_input(0);
     }
 
-    uint8_t scancode = inb(0x60);
+    uint8_t scancode = keyboard_read_scancode();
 
     if (scancode & 0x80)
     {
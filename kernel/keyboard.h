@@ -10,6 +10,8 @@ void keyboard_getline(char *buffer, uint32_t size);
 bool keyboard_available(void);
 uint8_t keyboard_read_scancode(void);
 uint8_t keyboard_get_scancode(void);
+void keyboard_push_scancode(uint8_t scancode);
+void keyboard_clear_queue(void);
 uint8_t inb(uint16_t port);
 void outb(uint16_t port, uint8_t value);
 
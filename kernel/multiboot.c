@@ -0,0 +1,94 @@
+#include "multiboot.h"
+#include "string_utils.h"
+
+#define MB_TAG_END 0
+#define MB_TAG_MODULE 3
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t size;
+} __attribute__((packed)) MultibootTag;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start;
+    uint32_t mod_end;
+    char cmdline[];
+} __attribute__((packed)) MultibootTagModule;
+
+/* Set by boot.asm from eax/ebx before kernel_main. */
+extern uint32_t multiboot_magic;
+extern uint32_t multiboot_info;
+
+static MultibootModule modules[MULTIBOOT_MAX_MODULES];
+static int module_count = 0;
+static bool parsed = false;
+
+/* Copies what the kernel needs out of the boot information, which
+   nothing protects once the kernel starts using low memory.  Module
+   contents stay where GRUB put them, past the end of the kernel image. */
+void multiboot_init(void)
+{
+    if (parsed)
+        return;
+    parsed = true;
+
+    if (multiboot_magic != MULTIBOOT2_BOOTLOADER_MAGIC || !multiboot_info)
+        return;
+
+    uint32_t total = *(uint32_t *)multiboot_info;
+    uint32_t offset = 8;
+
+    while (offset + sizeof(MultibootTag) <= total)
+    {
+        MultibootTag *tag = (MultibootTag *)(multiboot_info + offset);
+
+        if (tag->type == MB_TAG_END)
+            break;
+
+        if (tag->type == MB_TAG_MODULE && module_count < MULTIBOOT_MAX_MODULES)
+        {
+            MultibootTagModule *mod = (MultibootTagModule *)tag;
+            MultibootModule *m = &modules[module_count++];
+            int len = tag->size - sizeof(MultibootTagModule);
+
+            m->start = mod->mod_start;
+            m->end = mod->mod_end;
+
+            int i = 0;
+            while (i < len && i < (int)sizeof(m->cmdline) - 1 && mod->cmdline[i])
+            {
+                m->cmdline[i] = mod->cmdline[i];
+                i++;
+            }
+            m->cmdline[i] = '\0';
+        }
+
+        offset += (tag->size + 7) & ~7u;
+    }
+}
+
+int multiboot_module_count(void)
+{
+    return module_count;
+}
+
+const MultibootModule *multiboot_module(int index)
+{
+    if (index < 0 || index >= module_count)
+        return NULL;
+    return &modules[index];
+}
+
+const MultibootModule *multiboot_find_module(const char *cmdline)
+{
+    for (int i = 0; i < module_count; i++)
+    {
+        if (strcmp(modules[i].cmdline, cmdline) == 0)
+            return &modules[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+#define MULTIBOOT_MAX_MODULES 4
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t end;
+    char cmdline[64];
+} MultibootModule;
+
+void multiboot_init(void);
+int multiboot_module_count(void);
+const MultibootModule *multiboot_module(int index);
+const MultibootModule *multiboot_find_module(const char *cmdline);
+
+#endif
@@ -0,0 +1,59 @@
+#include "pci.h"
+#include "ports.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+static uint32_t pci_address(const PciDevice *dev, uint8_t offset)
+{
+    return 0x80000000u | ((uint32_t)dev->bus << 16) | ((uint32_t)dev->slot << 11) |
+           ((uint32_t)dev->func << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read32(const PciDevice *dev, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(const PciDevice *dev, uint8_t offset, uint32_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+/* Brute-force scan of configuration mechanism #1; returns the first
+   function with the given class and subclass. */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice *dev)
+{
+    for (int bus = 0; bus < 256; bus++)
+    {
+        for (int slot = 0; slot < 32; slot++)
+        {
+            for (int func = 0; func < 8; func++)
+            {
+                PciDevice d = {(uint8_t)bus, (uint8_t)slot, (uint8_t)func};
+                uint32_t id = pci_read32(&d, 0);
+
+                if ((id & 0xFFFF) == 0xFFFF)
+                {
+                    if (func == 0)
+                        break;
+                    continue;
+                }
+
+                uint32_t class_reg = pci_read32(&d, PCI_CLASS);
+                if ((class_reg >> 24) == class_code && ((class_reg >> 16) & 0xFF) == subclass)
+                {
+                    *dev = d;
+                    return true;
+                }
+
+                /* Single-function devices only answer on function 0. */
+                if (func == 0 && !(pci_read32(&d, 0x0C) & 0x00800000))
+                    break;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,25 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PCI_COMMAND 0x04
+#define PCI_CLASS 0x08
+#define PCI_BAR4 0x20
+
+#define PCI_COMMAND_IO 0x01
+#define PCI_COMMAND_BUS_MASTER 0x04
+
+typedef struct
+{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+} PciDevice;
+
+uint32_t pci_read32(const PciDevice *dev, uint8_t offset);
+void pci_write32(const PciDevice *dev, uint8_t offset, uint32_t value);
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice *dev);
+
+#endif
@@ -1,6 +1,7 @@
 #include "bootscreen.h"
 #include "keyboard.h"
 #include "vga.h"
+#include "cpu.h"
 
 void load_bootscreen(int isOn)
 {
@@ -22,7 +23,7 @@ void load_bootscreen(int isOn)
         bootscreen_update_progress(55);
     
         bootscreen_add_item("Detecting CPU features", true);
-        delay_ms(500);
+        cpu_detect();
         bootscreen_update_progress(65);
     
         bootscreen_add_item("Configuring interrupt controller", true);
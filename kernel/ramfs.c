@@ -2,19 +2,620 @@
 #include "vga.h"
 #include "string_utils.h"
 #include "commands.h"
+#include "cmdtable.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "multiboot.h"
+#include "bcache.h"
+#include "fat.h"
 
-static File files[100];
-static int file_count = 0;
 static File *current_dir = NULL;
 static File *root = NULL;
 
+/*
+ * One pool of blocks backs everything.  Inodes come from slabs, each a
+ * run of FS_SLAB_BLOCKS blocks cut into Files, so directories cost only
+ * their inode.  File data takes blocks as it grows: the last extent is
+ * extended in place when the following blocks are free, otherwise a new
+ * extent is added, and a file that runs out of extents is moved into a
+ * single one.
+ */
+#define FS_SLAB_BLOCKS 16
+
+typedef struct InodeSlab
+{
+    struct InodeSlab *next;
+    File *free;
+    int used;
+} InodeSlab;
+
+#define SLAB_INODES ((FS_SLAB_BLOCKS * FS_BLOCK_SIZE - sizeof(InodeSlab)) / sizeof(File))
+
+static uint8_t fs_blocks[FS_BLOCK_COUNT][FS_BLOCK_SIZE] __attribute__((aligned(16)));
+static uint32_t block_map[FS_BLOCK_COUNT / 32];
+static uint8_t block_refs[FS_BLOCK_COUNT];
+static InodeSlab *slabs = NULL;
+
+static bool block_used(int block)
+{
+    return block_map[block >> 5] & (1u << (block & 31));
+}
+
+static void blocks_mark(int start, int count, bool used)
+{
+    for (int b = start; b < start + count; b++)
+    {
+        block_refs[b] = used;
+        if (used)
+            block_map[b >> 5] |= 1u << (b & 31);
+        else
+            block_map[b >> 5] &= ~(1u << (b & 31));
+    }
+}
+
+/* Snapshots share blocks with the tree; a block is free once the last
+   holder lets go of it. */
+static void blocks_share(int start, int count)
+{
+    for (int b = start; b < start + count; b++)
+        block_refs[b]++;
+}
+
+static void blocks_release(int start, int count)
+{
+    for (int b = start; b < start + count; b++)
+    {
+        if (--block_refs[b] == 0)
+            blocks_mark(b, 1, false);
+    }
+}
+
+/* First run of exactly want free blocks, or failing that the longest run
+   there is.  Returns the start, or -1 when the pool is full. */
+static int blocks_find(int want, int *got)
+{
+    int best = -1;
+    int best_len = 0;
+    int b = 0;
+
+    while (b < FS_BLOCK_COUNT)
+    {
+        if (block_map[b >> 5] == 0xFFFFFFFFu && !(b & 31))
+        {
+            b += 32;
+            continue;
+        }
+        if (block_used(b))
+        {
+            b++;
+            continue;
+        }
+
+        int start = b;
+        while (b < FS_BLOCK_COUNT && !block_used(b) && b - start < want)
+            b++;
+
+        if (b - start == want)
+        {
+            *got = want;
+            return start;
+        }
+        if (b - start > best_len)
+        {
+            best = start;
+            best_len = b - start;
+        }
+    }
+
+    *got = best_len;
+    return best;
+}
+
+static File *inode_alloc(void)
+{
+    InodeSlab *slab = slabs;
+
+    while (slab && !slab->free)
+        slab = slab->next;
+
+    if (!slab)
+    {
+        int got;
+        int start = blocks_find(FS_SLAB_BLOCKS, &got);
+        if (start < 0 || got < FS_SLAB_BLOCKS)
+            return NULL;
+        blocks_mark(start, FS_SLAB_BLOCKS, true);
+
+        slab = (InodeSlab *)fs_blocks[start];
+        slab->next = slabs;
+        slab->free = NULL;
+        slab->used = 0;
+        slabs = slab;
+
+        File *inodes = (File *)(slab + 1);
+        for (int i = SLAB_INODES - 1; i >= 0; i--)
+        {
+            inodes[i].next = slab->free;
+            slab->free = &inodes[i];
+        }
+    }
+
+    File *f = slab->free;
+    slab->free = f->next;
+    slab->used++;
+    return f;
+}
+
+static void inode_free(File *f)
+{
+    for (InodeSlab *slab = slabs; slab; slab = slab->next)
+    {
+        File *inodes = (File *)(slab + 1);
+
+        if (f >= inodes && f < inodes + SLAB_INODES)
+        {
+            f->next = slab->free;
+            slab->free = f;
+            slab->used--;
+            return;
+        }
+    }
+}
+
+static int file_blocks(const File *file)
+{
+    int blocks = 0;
+    for (int i = 0; i < file->extent_count; i++)
+        blocks += file->extents[i].count;
+    return blocks;
+}
+
+static void file_shrink(File *file, int keep)
+{
+    int blocks = file_blocks(file);
+
+    while (blocks > keep && file->extent_count)
+    {
+        FsExtent *last = &file->extents[file->extent_count - 1];
+        int drop = blocks - keep;
+
+        if (drop > last->count)
+            drop = last->count;
+
+        blocks_release(last->start + last->count - drop, drop);
+        last->count -= drop;
+        blocks -= drop;
+        if (!last->count)
+            file->extent_count--;
+    }
+}
+
+/* Moves the first len bytes into one extent of blocks blocks. */
+static bool file_relocate(File *file, int blocks, int len)
+{
+    int got;
+    int start = blocks_find(blocks, &got);
+    if (start < 0 || got < blocks)
+        return false;
+    blocks_mark(start, blocks, true);
+
+    fs_read(file, 0, (char *)fs_blocks[start], len);
+    file_shrink(file, 0);
+
+    file->extents[0].start = start;
+    file->extents[0].count = blocks;
+    file->extent_count = 1;
+    return true;
+}
+
+static bool file_grow(File *file, int need, int len)
+{
+    int blocks = file_blocks(file);
+
+    while (blocks < need)
+    {
+        int want = need - blocks;
+
+        if (file->extent_count)
+        {
+            FsExtent *last = &file->extents[file->extent_count - 1];
+            int next = last->start + last->count;
+            int n = 0;
+
+            while (n < want && next + n < FS_BLOCK_COUNT && !block_used(next + n))
+                n++;
+
+            if (n)
+            {
+                blocks_mark(next, n, true);
+                last->count += n;
+                blocks += n;
+                continue;
+            }
+        }
+
+        if (file->extent_count == FS_MAX_EXTENTS)
+            return file_relocate(file, need * 2, len) || file_relocate(file, need, len);
+
+        /* New extents at least double the file, so appends rarely
+           need another one. */
+        int got;
+        int start = blocks_find(want < blocks ? blocks : want, &got);
+        if (start < 0)
+            return false;
+
+        blocks_mark(start, got, true);
+        file->extents[file->extent_count].start = start;
+        file->extents[file->extent_count].count = got;
+        file->extent_count++;
+        blocks += got;
+    }
+    return true;
+}
+
+/* Copies len bytes at offset to or from the file's blocks, which must
+   already cover the range.  Files still backed by the initrd or a FAT
+   volume are only ever read here; writers call file_unshare first. */
+static void file_io(File *file, int offset, char *buf, int len, bool write)
+{
+    int done = 0;
+    int base = 0;
+
+    if (file->backing)
+    {
+        memcpy(buf, file->backing + offset, len);
+        return;
+    }
+    if (file->flags & FS_F_FAT_DATA)
+    {
+        int n = fat_read(file->volume, file->cluster, offset, buf, len);
+        if (n < len)
+            memset(buf + n, 0, len - n);
+        return;
+    }
+
+    for (int i = 0; i < file->extent_count && done < len; i++)
+    {
+        int extent_len = file->extents[i].count * FS_BLOCK_SIZE;
+
+        if (offset + done < base + extent_len)
+        {
+            int from = offset + done - base;
+            int chunk = extent_len - from;
+            if (chunk > len - done)
+                chunk = len - done;
+
+            uint8_t *data = fs_blocks[file->extents[i].start] + from;
+            if (write)
+                memcpy(data, buf + done, chunk);
+            else
+                memcpy(buf + done, data, chunk);
+            done += chunk;
+        }
+        base += extent_len;
+    }
+}
+
+static void file_zero(File *file, int from, int to)
+{
+    static char zeros[FS_BLOCK_SIZE];
+
+    while (from < to)
+    {
+        int chunk = to - from < FS_BLOCK_SIZE ? to - from : FS_BLOCK_SIZE;
+        file_io(file, from, zeros, chunk, true);
+        from += chunk;
+    }
+}
+
+/* Makes the file's blocks cover size bytes, keeping its data. */
+static bool file_reserve(File *file, int size)
+{
+    int need = (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    int blocks = file_blocks(file);
+
+    if (need <= blocks)
+        return true;
+
+    if (!file_grow(file, need, file->size))
+    {
+        file_shrink(file, blocks);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Snapshots kept in memory.  Taking one only starts a new epoch.  The
+ * first change to a file after that copies its inode into the undo log,
+ * which takes a share of the file's blocks, and writes then copy only
+ * the shared blocks they land on.  Files created since are logged as
+ * well.  Restoring plays the log back from the end, handing each file
+ * its old blocks and unlinking the new files.
+ */
+#define FS_SNAPSHOTS 4
+#define FS_SNAPSHOT_NAME 16
+#define FS_UNDO_RECORDS 256
+
+typedef struct
+{
+    File *file;
+    bool created;
+    uint8_t flags;
+    uint8_t extent_count;
+    int size;
+    const char *backing;
+    FsExtent extents[FS_MAX_EXTENTS];
+} UndoRecord;
+
+typedef struct
+{
+    char name[FS_SNAPSHOT_NAME];
+    int undo_start;
+} Snapshot;
+
+static UndoRecord undo_log[FS_UNDO_RECORDS];
+static int undo_len = 0;
+static Snapshot snapshots[FS_SNAPSHOTS];
+static int snapshot_count = 0;
+static uint32_t fs_epoch = 1;
+
+/* Logs the file's inode before its first change since the newest
+   snapshot.  Fails when the undo log is full. */
+static bool file_preserve(File *file)
+{
+    if (!snapshot_count || file->epoch == fs_epoch)
+        return true;
+    if (undo_len == FS_UNDO_RECORDS)
+        return false;
+
+    UndoRecord *r = &undo_log[undo_len++];
+
+    r->file = file;
+    r->created = false;
+    r->flags = file->flags;
+    r->extent_count = file->extent_count;
+    r->size = file->size;
+    r->backing = file->backing;
+    memcpy(r->extents, file->extents, sizeof(r->extents));
+
+    for (int i = 0; i < file->extent_count; i++)
+        blocks_share(file->extents[i].start, file->extents[i].count);
+    file->epoch = fs_epoch;
+    return true;
+}
+
+/* Gives the file its own copies of the blocks under [from, to) that a
+   snapshot still shares, so a write there leaves the snapshot alone. */
+static bool file_cow(File *file, int from, int to)
+{
+    int first = from / FS_BLOCK_SIZE;
+    int end = (to + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    int base = 0;
+
+    if (!snapshot_count || from >= to)
+        return true;
+
+    for (int i = 0; i < file->extent_count; i++)
+    {
+        FsExtent *e = &file->extents[i];
+        int count = e->count;
+        int lo = first > base ? first - base : 0;
+        int hi = end - base < count ? end - base : count;
+
+        base += count;
+        while (lo < hi && block_refs[e->start + lo] == 1)
+            lo++;
+        while (hi > lo && block_refs[e->start + hi - 1] == 1)
+            hi--;
+        if (lo >= hi)
+            continue;
+
+        /* The copied run splits the extent in up to three; a file out of
+           extents is moved into one instead, which copies all of it. */
+        int n = hi - lo;
+        int parts = 1 + (lo > 0) + (hi < count);
+        int got = 0;
+        int start = file->extent_count + parts - 1 <= FS_MAX_EXTENTS ? blocks_find(n, &got) : -1;
+
+        if (start < 0 || got < n)
+            return file_relocate(file, file_blocks(file), file->size);
+
+        FsExtent split[3];
+        int k = 0;
+
+        if (lo > 0)
+            split[k++] = (FsExtent){e->start, lo};
+        split[k++] = (FsExtent){start, n};
+        if (hi < count)
+            split[k++] = (FsExtent){e->start + hi, count - hi};
+
+        blocks_mark(start, n, true);
+        memcpy(fs_blocks[start], fs_blocks[e->start + lo], n * FS_BLOCK_SIZE);
+        blocks_release(e->start + lo, n);
+
+        memmove(&file->extents[i + k], &file->extents[i + 1], (file->extent_count - i - 1) * sizeof(FsExtent));
+        memcpy(&file->extents[i], split, k * sizeof(FsExtent));
+        file->extent_count += k - 1;
+        i += k - 1;
+    }
+    return true;
+}
+
+/* Gives a file backed by the initrd or a FAT volume blocks of its own,
+   copying its data. */
+static bool file_unshare(File *file)
+{
+    const char *backing = file->backing;
+    uint8_t flags = file->flags;
+
+    if (!backing && !(flags & FS_F_FAT_DATA))
+        return true;
+
+    file->backing = NULL;
+    file->flags &= ~FS_F_FAT_DATA;
+    if (!file_reserve(file, file->size))
+    {
+        file->backing = backing;
+        file->flags = flags;
+        return false;
+    }
+
+    if (backing)
+    {
+        file_io(file, 0, (char *)backing, file->size, true);
+        return true;
+    }
+
+    char chunk[FS_BLOCK_SIZE];
+
+    for (int offset = 0; offset < file->size; offset += FS_BLOCK_SIZE)
+    {
+        int n = file->size - offset < FS_BLOCK_SIZE ? file->size - offset : FS_BLOCK_SIZE;
+        int got = fat_read(file->volume, file->cluster, offset, chunk, n);
+
+        memset(chunk + got, 0, n - got);
+        file_io(file, offset, chunk, n, true);
+    }
+    return true;
+}
+
+/* Replaces the file's data.  On failure the file is left as it was. */
+bool fs_set_content(File *file, const char *data, int len)
+{
+    if (!file_preserve(file) || !file_cow(file, 0, len))
+        return false;
+
+    const char *backing = file->backing;
+    uint8_t flags = file->flags;
+
+    file->backing = NULL;
+    file->flags &= ~FS_F_FAT_DATA;
+    if (!file_reserve(file, len))
+    {
+        file->backing = backing;
+        file->flags = flags;
+        return false;
+    }
+
+    file_io(file, 0, (char *)data, len, true);
+    file->size = len;
+    file_shrink(file, (len + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+    fs_touch(file);
+    return true;
+}
+
+/* Writes len bytes at offset, growing the file and zero-filling any gap
+   past the old end.  Returns len, or -1 when the pool is full. */
+int fs_write_at(File *file, int offset, const char *data, int len)
+{
+    if (offset < 0 || len < 0 || !file_preserve(file) || !file_unshare(file))
+        return -1;
+
+    int end = offset + len;
+    if (!file_cow(file, offset < file->size ? offset : file->size, end))
+        return -1;
+    if (end > file->size)
+    {
+        if (!file_reserve(file, end))
+            return -1;
+        if (offset > file->size)
+            file_zero(file, file->size, offset);
+        file->size = end;
+    }
+
+    file_io(file, offset, (char *)data, len, true);
+    fs_touch(file);
+    return len;
+}
+
+int fs_append(File *file, const char *data, int len)
+{
+    return fs_write_at(file, file->size, data, len);
+}
+
+bool fs_truncate(File *file, int size)
+{
+    if (size < 0 || !file_preserve(file))
+        return false;
+
+    if ((file->backing || (file->flags & FS_F_FAT_DATA)) && size <= file->size)
+    {
+        file->size = size;
+        fs_touch(file);
+        return true;
+    }
+
+    if (!file_unshare(file))
+        return false;
+
+    if (size > file->size)
+    {
+        if (!file_cow(file, file->size, size) || !file_reserve(file, size))
+            return false;
+        file_zero(file, file->size, size);
+    }
+    else
+    {
+        file_shrink(file, (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+    }
+
+    file->size = size;
+    fs_touch(file);
+    return true;
+}
+
+int fs_read(File *file, int offset, char *buf, int len)
+{
+    if (offset < 0 || offset >= file->size || len <= 0)
+        return 0;
+    if (len > file->size - offset)
+        len = file->size - offset;
+
+    file_io(file, offset, buf, len, false);
+    return len;
+}
+
+/* Reads the line at *pos without its newline, cut to max - 1 bytes, and
+   moves *pos past it.  Returns the length, or -1 at end of file. */
+int fs_read_line(File *file, int *pos, char *line, int max)
+{
+    if (*pos >= file->size)
+        return -1;
+
+    int len = 0;
+    char chunk[64];
+
+    while (*pos < file->size)
+    {
+        int n = fs_read(file, *pos, chunk, sizeof(chunk));
+        int i = 0;
+
+        while (i < n && chunk[i] != '\n')
+        {
+            if (len < max - 1)
+                line[len++] = chunk[i];
+            i++;
+        }
+        *pos += i;
+
+        if (i < n)
+        {
+            (*pos)++;
+            break;
+        }
+    }
+
+    line[len] = '\0';
+    return len;
+}
+
 static File *create_file(const char *name, char type)
 {
-    if (file_count >= 100)
+    File *f = inode_alloc();
+    if (!f)
         return NULL;
 
-    File *f = &files[file_count++];
-
     int i = 0;
     while (name[i] && i < 31)
     {
@@ -25,181 +626,1089 @@ static File *create_file(const char *name, char type)
 
     f->type = type;
     f->size = 0;
-    f->content[0] = '\0';
+    f->backing = NULL;
+    f->extent_count = 0;
+    f->flags = 0;
+    f->volume = 0;
+    f->cluster = 0;
+    f->epoch = 0;
     f->parent = NULL;
     f->child = NULL;
     f->next = NULL;
+    f->hash = 0;
+    f->hash_next = NULL;
+    f->version = 0;
+    f->script = NULL;
+
+    return f;
+}
+
+/*
+ * Directory entries are indexed in one table keyed by (parent, name), so
+ * finding a name in a directory of any size is a single bucket walk.
+ * Whole paths that resolved recently are remembered in a small dentry
+ * cache.  Entries go stale only when files are removed, which happens
+ * when fs_init rebuilds the tree or a snapshot restore unlinks the files
+ * created since (undo_apply); both clear the whole cache.
+ */
+#define DIR_HASH_BUCKETS 1024
+#define DCACHE_SLOTS 32
+#define DCACHE_PATH_MAX 64
+
+typedef struct
+{
+    File *base;
+    File *file;
+    uint32_t hash;
+    char path[DCACHE_PATH_MAX];
+} Dentry;
+
+static File *dir_hash[DIR_HASH_BUCKETS];
+static Dentry dcache[DCACHE_SLOTS];
+static spinlock_t dcache_lock = SPINLOCK_INIT;
+
+static uint32_t name_hash(File *dir, const char *name, int len)
+{
+    uint32_t hash = 2166136261u ^ ((uint32_t)dir * 2654435761u);
+
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static File *dir_lookup(File *dir, const char *name, int len)
+{
+    uint32_t hash = name_hash(dir, name, len);
+    File *f = dir_hash[hash & (DIR_HASH_BUCKETS - 1)];
+
+    while (f)
+    {
+        if (f->hash == hash && f->parent == dir &&
+            strncmp(f->name, name, len) == 0 && f->name[len] == '\0')
+        {
+            return f;
+        }
+        f = f->hash_next;
+    }
+    return NULL;
+}
+
+/* Adds f to dir, at the front of the listing or at the end. */
+static void dir_link(File *dir, File *f, bool first)
+{
+    f->parent = dir;
+
+    if (first || !dir->child)
+    {
+        f->next = dir->child;
+        dir->child = f;
+    }
+    else
+    {
+        File *last = dir->child;
+        while (last->next)
+        {
+            last = last->next;
+        }
+        last->next = f;
+    }
 
+    f->hash = name_hash(dir, f->name, strlen(f->name));
+    File **bucket = &dir_hash[f->hash & (DIR_HASH_BUCKETS - 1)];
+    f->hash_next = *bucket;
+    *bucket = f;
+}
+
+/* Links a FAT directory entry into dir, an imported directory. */
+static File *fat_attach(File *dir, const FatEntry *entry)
+{
+    File *f = create_file(entry->name, entry->dir ? 'D' : 'F');
+    if (!f)
+        return NULL;
+
+    f->flags = FS_F_FAT | (entry->dir ? FS_F_UNREAD : FS_F_FAT_DATA);
+    f->volume = dir->volume;
+    f->cluster = entry->cluster;
+    f->size = entry->size;
+    dir_link(dir, f, false);
     return f;
 }
 
+/* Links every entry of an imported directory that is not linked yet. */
+static void dir_populate(File *dir)
+{
+    FatDir fd;
+    FatEntry entry;
+
+    if (!(dir->flags & FS_F_UNREAD))
+        return;
+
+    fat_dir_open(dir->volume, dir->cluster, &fd);
+    while (fat_dir_next(&fd, &entry))
+    {
+        if (!dir_lookup(dir, entry.name, strlen(entry.name)) && !fat_attach(dir, &entry))
+            return;
+    }
+    dir->flags &= ~FS_F_UNREAD;
+}
+
+/*
+ * dir_lookup, plus what imported directories need: FAT names match in
+ * any case, and a name that is not linked yet is looked up on the volume
+ * without reading in the rest of the directory.
+ */
+static File *dir_find(File *dir, const char *name, int len)
+{
+    File *f = dir_lookup(dir, name, len);
+    char canon[FAT_NAME_MAX];
+    FatEntry entry;
+
+    if (f || !(dir->flags & FS_F_FAT) || len >= FAT_NAME_MAX || !fat_canonical_name(name, len, canon))
+        return f;
+
+    f = dir_lookup(dir, canon, len);
+    if (!f && (dir->flags & FS_F_UNREAD) && fat_lookup(dir->volume, dir->cluster, canon, len, &entry))
+        f = fat_attach(dir, &entry);
+    return f;
+}
+
+static File *dcache_get(File *base, const char *path, uint32_t hash)
+{
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    Dentry *d = &dcache[hash % DCACHE_SLOTS];
+    File *file = NULL;
+
+    if (d->file && d->hash == hash && d->base == base && strcmp(d->path, path) == 0)
+        file = d->file;
+
+    spin_unlock_irqrestore(&dcache_lock, flags);
+    return file;
+}
+
+static void dcache_put(File *base, const char *path, uint32_t hash, File *file)
+{
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    Dentry *d = &dcache[hash % DCACHE_SLOTS];
+
+    d->base = base;
+    d->file = file;
+    d->hash = hash;
+    strcpy(d->path, path);
+    spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+/* Walks the first len bytes of path from base.  Empty components and "."
+   are skipped, ".." stops at the root. */
+static File *namei_walk(File *base, const char *path, int len)
+{
+    File *cur = base;
+    int i = 0;
+
+    while (i < len && cur)
+    {
+        while (i < len && path[i] == '/')
+            i++;
+
+        int start = i;
+        while (i < len && path[i] != '/')
+            i++;
+
+        int n = i - start;
+        if (n == 0 || (n == 1 && path[start] == '.'))
+            continue;
+
+        if (cur->type != 'D')
+            return NULL;
+
+        if (n == 2 && path[start] == '.' && path[start + 1] == '.')
+            cur = cur->parent ? cur->parent : root;
+        else
+            cur = dir_find(cur, &path[start], n);
+    }
+    return cur;
+}
+
+/* Resolves an absolute path or one relative to the current directory. */
+File *fs_namei(const char *path)
+{
+    if (!path || !*path)
+        return NULL;
+
+    File *base = path[0] == '/' ? root : current_dir;
+    int len = strlen(path);
+    bool cacheable = len < DCACHE_PATH_MAX;
+    uint32_t hash = 0;
+
+    if (cacheable)
+    {
+        hash = name_hash(base, path, len);
+        File *hit = dcache_get(base, path, hash);
+        if (hit)
+            return hit;
+    }
+
+    File *file = namei_walk(base, path, len);
+
+    if (file && cacheable)
+        dcache_put(base, path, hash, file);
+    return file;
+}
+
+/* Resolves every component but the last, which is copied to name. */
+static File *namei_parent(const char *path, char *name)
+{
+    int len = strlen(path);
+    int slash = len - 1;
+
+    while (slash >= 0 && path[slash] != '/')
+        slash--;
+
+    const char *last = &path[slash + 1];
+    if (!*last || strlen(last) > 31 || strcmp(last, ".") == 0 || strcmp(last, "..") == 0)
+        return NULL;
+    strcpy(name, last);
+
+    if (slash < 0)
+        return current_dir;
+
+    File *dir = namei_walk(path[0] == '/' ? root : current_dir, path, slash);
+    return dir && dir->type == 'D' ? dir : NULL;
+}
+
+static void script_cache_reset(void);
+static void handle_table_reset(void);
+static void handle_forget(File *file);
+static int snap_load(void);
+
+/* Each FAT volume shows up as /mnt/<name>; its entries are linked in as
+   they are looked up or listed. */
+static void fat_mount_all(void)
+{
+    fat_init();
+    if (!fat_volume_count())
+        return;
+
+    File *mnt = dir_lookup(root, "mnt", 3);
+    if (!mnt)
+    {
+        mnt = create_file("mnt", 'D');
+        if (!mnt)
+            return;
+        dir_link(root, mnt, false);
+    }
+    if (mnt->type != 'D')
+        return;
+
+    for (int i = 0; i < fat_volume_count(); i++)
+    {
+        File *dir = create_file(fat_volume_name(i), 'D');
+        if (!dir)
+            break;
+
+        dir->flags = FS_F_FAT | FS_F_UNREAD;
+        dir->volume = i;
+        dir_link(mnt, dir, false);
+    }
+}
+
 void fs_init(void)
 {
-    file_count = 0;
+    memset(block_map, 0, sizeof(block_map));
+    memset(block_refs, 0, sizeof(block_refs));
+    slabs = NULL;
+    snapshot_count = 0;
+    undo_len = 0;
+    fs_epoch++;
+    memset(dir_hash, 0, sizeof(dir_hash));
+    memset(dcache, 0, sizeof(dcache));
+    handle_table_reset();
+    script_cache_reset();
 
     root = create_file("", 'D');
     current_dir = root;
 
     File *home = create_file("home", 'D');
-    home->parent = root;
-    root->child = home;
+    dir_link(root, home, false);
 
     File *user = create_file("user", 'D');
-    user->parent = home;
-    home->child = user;
+    dir_link(home, user, false);
+
+    const MultibootModule *initrd = multiboot_find_module("initrd");
+    if (!initrd && multiboot_module_count() > 0)
+        initrd = multiboot_module(0);
+    if (initrd)
+        fs_mount_tar((const char *)initrd->start, initrd->end - initrd->start);
+    fat_mount_all();
+    snap_load();
+
+    current_dir = user;
+}
 
-    File *hello = create_file("Hello.T", 'F');
-    if (hello)
+/*
+ * The initrd is a ustar archive.  Its files are not copied: each inode
+ * points at its data inside the archive and only gets blocks of its own
+ * on the first write, so mounting costs one inode per entry.
+ */
+#define TAR_BLOCK 512
+
+static uint32_t tar_octal(const char *field, int len)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+/* Finds or makes each directory along path; returns the last. */
+static File *tar_make_dirs(const char *path, int len)
+{
+    File *dir = root;
+    int i = 0;
+
+    while (i < len && dir)
     {
+        int start = i;
+        while (i < len && path[i] != '/')
+            i++;
 
-        const char *hello_content =
-            "schar name = \"\"\n"
-            "write(\"Type your name: \")\n"
-            "input(name)\n"
-            "line()\n"
-            "write(\"Hello! \", name)\n";
+        int n = i - start;
+        i++;
+        if (n == 0 || (n == 1 && path[start] == '.'))
+            continue;
+        if (n > 31)
+            return NULL;
 
-        int i = 0;
-        while (hello_content[i] && i < 1023)
+        File *next = dir_find(dir, &path[start], n);
+        if (!next)
         {
-            hello->content[i] = hello_content[i];
-            i++;
+            char name[32];
+            memcpy(name, &path[start], n);
+            name[n] = '\0';
+
+            next = create_file(name, 'D');
+            if (next)
+                dir_link(dir, next, false);
         }
-        hello->content[i] = '\0';
-        hello->size = i;
-
-        hello->parent = user;
-        hello->next = user->child;
-        user->child = hello;
-    }
-
-    File *calc = create_file("Calculator.T", 'F');
-    if (calc)
-    {
-        const char *calc_content =
-            "# T84 Calculator - Interactive Calculator\n"
-            "# Usage: tlang Calculator.T\n"
-            "\n"
-            "int n1 = 0\n"
-            "int n2 = 0\n"
-            "schar op = \"\"\n"
-            "line()\n"
-            "write(\"== Welcome to the T84 Calculator ==\")\n"
-            "line()\n"
-            "write(\"Type the first number: \")\n"
-            "input(n1)\n"
-            "write(\"Type the second number: \")\n"
-            "input(n2)\n"
-            "write(\"Type the operation (+, -, *, /): \")\n"
-            "input(op)\n"
-            "if op == \"+\":\n"
-            "    line()\n"
-            "    write(\"Result: \", n1 + n2)\n"
-            "elif op == \"-\":\n"
-            "    line()\n"
-            "    write(\"Result: \", n1 - n2)\n"
-            "elif op == \"*\":\n"
-            "    line()\n"
-            "    write(\"Result: \", n1 * n2)\n"
-            "elif op == \"/\":\n"
-            "    line()\n"
-            "    write(\"Result: \", n1 / n2)\n"
-            "line()\n"
-            "write(\"Thank you for using T84 Calculator!\")\n"
-            "line()\n";
+        dir = next && next->type == 'D' ? next : NULL;
+    }
+    return dir;
+}
 
-        int i = 0;
-        while (calc_content[i] && i < 1023)
+int fs_mount_tar(const char *image, uint32_t size)
+{
+    uint32_t offset = 0;
+    int count = 0;
+
+    while (offset + TAR_BLOCK <= size)
+    {
+        const char *header = image + offset;
+
+        if (!header[0])
+            break;
+        if (strncmp(header + 257, "ustar", 5) != 0)
+            break;
+
+        char path[FS_PATH_MAX];
+        int len = 0;
+        const char *prefix = header + 345;
+
+        for (int i = 0; i < 155 && prefix[i] && len < FS_PATH_MAX - 2; i++)
+            path[len++] = prefix[i];
+        if (len)
+            path[len++] = '/';
+        for (int i = 0; i < 100 && header[i] && len < FS_PATH_MAX - 1; i++)
+            path[len++] = header[i];
+        path[len] = '\0';
+
+        uint32_t data_size = tar_octal(header + 124, 12);
+        char type = header[156];
+        uint32_t data = offset + TAR_BLOCK;
+
+        offset = data + ((data_size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+        if (offset > size)
+            break;
+
+        while (len > 0 && path[len - 1] == '/')
+            path[--len] = '\0';
+
+        if (type == '5')
         {
-            calc->content[i] = calc_content[i];
-            i++;
+            tar_make_dirs(path, len);
+            continue;
         }
-        calc->content[i] = '\0';
-        calc->size = i;
+        if (type != '0' && type != '\0')
+            continue;
+
+        int slash = len - 1;
+        while (slash >= 0 && path[slash] != '/')
+            slash--;
+
+        const char *name = &path[slash + 1];
+        File *dir = slash < 0 ? root : tar_make_dirs(path, slash);
+        if (!dir || strlen(name) > 31 || dir_lookup(dir, name, strlen(name)))
+            continue;
+
+        File *f = create_file(name, 'F');
+        if (!f)
+            break;
+
+        f->backing = image + data;
+        f->size = data_size;
+        dir_link(dir, f, false);
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Snapshots of the tree on the first ATA disk.  Sector 0 holds a label
+ * and the rest is split into two slots, each a header sector followed by
+ * a stream of records (header, path, data) in pre-order, so directories
+ * come before what they contain.  A sync fills the slot that does not
+ * hold the newest snapshot and writes its header last, so a sync that is
+ * cut short leaves the previous snapshot loadable.
+ */
+#define SNAP_DRIVE 0
+#define SNAP_VERSION 1
+#define SNAP_MAX_SLOT_SECTORS 8192
+#define SNAP_BUF_SECTORS 8
+
+typedef enum
+{
+    DISK_NONE,
+    DISK_FOREIGN,
+    DISK_BLANK,
+    DISK_LABELLED
+} DiskState;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_sectors;
+} DiskLabel;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t generation;
+    uint32_t entries;
+    uint32_t bytes;
+    uint32_t checksum;
+} SnapHeader;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t path_len;
+    uint16_t reserved;
+    uint32_t size;
+} SnapRecord;
+
+typedef struct
+{
+    uint32_t lba;
+    uint32_t end;
+    int pos;
+    int len;
+    uint32_t bytes;
+    uint32_t checksum;
+    bool ok;
+} SnapStream;
+
+static uint8_t snap_buf[SNAP_BUF_SECTORS * ATA_SECTOR_SIZE] __attribute__((aligned(16)));
+static spinlock_t snap_lock = SPINLOCK_INIT;
+
+/* What is on the disk outlives fs_init, so it is only scanned once. */
+static bool snap_scanned = false;
+static DiskState disk_state = DISK_NONE;
+static uint32_t slot_sectors = 0;
+static int snap_slot = -1;
+static SnapHeader snap_head;
+
+static uint32_t slot_lba(int slot)
+{
+    return 1 + slot * slot_sectors;
+}
+
+static void snap_open(SnapStream *s, int slot)
+{
+    s->lba = slot_lba(slot) + 1;
+    s->end = slot_lba(slot) + slot_sectors;
+    s->pos = 0;
+    s->len = 0;
+    s->bytes = 0;
+    s->checksum = 2166136261u;
+    s->ok = true;
+}
 
-        calc->parent = user;
-        calc->next = user->child;
-        user->child = calc;
+static void snap_sum(SnapStream *s, const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        s->checksum ^= data[i];
+        s->checksum *= 16777619u;
     }
+    s->bytes += len;
+}
 
-    File *benchmark = create_file("Benchmark.T", 'F');
-    if (benchmark)
+static void snap_flush(SnapStream *s)
+{
+    if (!s->pos || !s->ok)
+        return;
+
+    uint32_t sectors = (s->pos + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE;
+
+    memset(snap_buf + s->pos, 0, sectors * ATA_SECTOR_SIZE - s->pos);
+    if (s->lba + sectors > s->end || !bcache_write(SNAP_DRIVE, s->lba, sectors, snap_buf))
+        s->ok = false;
+
+    s->lba += sectors;
+    s->pos = 0;
+}
+
+static void snap_put(SnapStream *s, const void *data, int len)
+{
+    const uint8_t *p = data;
+
+    while (len > 0 && s->ok)
     {
-        const char *benchmark_content =
-            "# Execute this with tparse Benchmark.T !\n"
-            "FOR i = 0 TO 1000 DO &i";
+        int n = sizeof(snap_buf) - s->pos;
+        if (n > len)
+            n = len;
+
+        memcpy(snap_buf + s->pos, p, n);
+        snap_sum(s, p, n);
+        s->pos += n;
+        p += n;
+        len -= n;
+
+        if (s->pos == (int)sizeof(snap_buf))
+            snap_flush(s);
+    }
+}
 
-        int i = 0;
-        while (benchmark_content[i] && i < 1023)
+/* Reads len bytes, or skips them when data is NULL. */
+static bool snap_get(SnapStream *s, void *data, int len)
+{
+    uint8_t *p = data;
+
+    while (len > 0 && s->ok)
+    {
+        if (s->pos == s->len)
         {
-            benchmark->content[i] = benchmark_content[i];
-            i++;
+            uint32_t sectors = s->end - s->lba;
+            if (sectors > SNAP_BUF_SECTORS)
+                sectors = SNAP_BUF_SECTORS;
+
+            if (!sectors || !bcache_read(SNAP_DRIVE, s->lba, sectors, snap_buf))
+            {
+                s->ok = false;
+                break;
+            }
+            s->lba += sectors;
+            s->pos = 0;
+            s->len = sectors * ATA_SECTOR_SIZE;
+        }
+
+        int n = s->len - s->pos;
+        if (n > len)
+            n = len;
+
+        if (p)
+        {
+            memcpy(p, snap_buf + s->pos, n);
+            p += n;
+        }
+        snap_sum(s, snap_buf + s->pos, n);
+        s->pos += n;
+        len -= n;
+    }
+    return s->ok;
+}
+
+/* Picks the newest slot whose header and checksum hold up. */
+static void snap_scan(void)
+{
+    if (snap_scanned)
+        return;
+    snap_scanned = true;
+
+    const AtaDrive *disk = ata_drive(SNAP_DRIVE);
+    if (!disk || !bcache_read(SNAP_DRIVE, 0, 1, snap_buf))
+        return;
+
+    DiskLabel *label = (DiskLabel *)snap_buf;
+    if (memcmp(label->magic, "T84DISK", 8) != 0 || label->version != SNAP_VERSION)
+    {
+        disk_state = DISK_BLANK;
+        for (int i = 0; i < ATA_SECTOR_SIZE; i++)
+        {
+            if (snap_buf[i])
+                disk_state = DISK_FOREIGN;
         }
-        benchmark->content[i] = '\0';
-        benchmark->size = i;
+        return;
+    }
+
+    slot_sectors = label->slot_sectors;
+    if (slot_sectors < 2 || 1 + 2 * slot_sectors > disk->sectors)
+    {
+        disk_state = DISK_FOREIGN;
+        return;
+    }
+    disk_state = DISK_LABELLED;
+
+    for (int slot = 0; slot < 2; slot++)
+    {
+        SnapHeader head;
+        SnapStream s;
+
+        if (!bcache_read(SNAP_DRIVE, slot_lba(slot), 1, snap_buf))
+            continue;
+        memcpy(&head, snap_buf, sizeof(head));
 
-        benchmark->parent = user;
-        benchmark->next = user->child;
-        user->child = benchmark;
+        if (memcmp(head.magic, "T84SNAP", 8) != 0 || head.version != SNAP_VERSION)
+            continue;
+        if (snap_slot >= 0 && head.generation <= snap_head.generation)
+            continue;
+
+        snap_open(&s, slot);
+        if (!snap_get(&s, NULL, head.bytes) || s.checksum != head.checksum)
+            continue;
+
+        snap_slot = slot;
+        snap_head = head;
+    }
+}
+
+/* Lays the newest snapshot over the tree; files it names replace the
+   initrd's copies.  Returns the number of entries. */
+static int snap_load(void)
+{
+    if (!spin_trylock(&snap_lock))
+        return 0;
+    task_kill_hold();
+
+    snap_scan();
+    if (snap_slot < 0)
+    {
+        spin_unlock(&snap_lock);
+        task_kill_release();
+        return 0;
+    }
+
+    SnapStream s;
+    uint32_t i;
+
+    snap_open(&s, snap_slot);
+
+    for (i = 0; i < snap_head.entries; i++)
+    {
+        SnapRecord rec;
+        char path[FS_PATH_MAX];
+
+        if (!snap_get(&s, &rec, sizeof(rec)) || !rec.path_len || rec.path_len >= FS_PATH_MAX ||
+            !snap_get(&s, path, rec.path_len))
+            break;
+
+        int len = rec.path_len;
+        path[len] = '\0';
+
+        if (rec.type == 'D')
+        {
+            tar_make_dirs(path, len);
+            continue;
+        }
+
+        int slash = len - 1;
+        while (slash >= 0 && path[slash] != '/')
+            slash--;
+
+        const char *name = &path[slash + 1];
+        int name_len = len - slash - 1;
+        File *dir = slash < 0 ? root : tar_make_dirs(path, slash);
+        File *f = dir && name_len <= 31 ? dir_find(dir, name, name_len) : NULL;
+
+        if (!f && dir && name_len <= 31)
+        {
+            f = create_file(name, 'F');
+            if (f)
+                dir_link(dir, f, false);
+        }
+        if (f && f->type != 'F')
+            f = NULL;
+        if (f)
+            fs_truncate(f, 0);
+
+        uint32_t offset = 0;
+        char chunk[FS_BLOCK_SIZE];
+
+        while (offset < rec.size && s.ok)
+        {
+            int n = rec.size - offset > sizeof(chunk) ? (int)sizeof(chunk) : (int)(rec.size - offset);
+
+            if (snap_get(&s, chunk, n) && f)
+                fs_write_at(f, offset, chunk, n);
+            offset += n;
+        }
+    }
+
+    spin_unlock(&snap_lock);
+    task_kill_release();
+    return i;
+}
+
+static void snap_save_dir(SnapStream *s, File *dir, char *path, int len, uint32_t *entries)
+{
+    for (File *f = dir->child; f && s->ok; f = f->next)
+    {
+        int name_len = strlen(f->name);
+        int path_len = len + (len ? 1 : 0) + name_len;
+
+        if (path_len >= FS_PATH_MAX || (f->flags & FS_F_FAT_DATA))
+            continue;
+
+        if (len)
+            path[len] = '/';
+        memcpy(&path[path_len - name_len], f->name, name_len);
+
+        SnapRecord rec = {(uint8_t)f->type, (uint8_t)path_len, 0, f->type == 'F' ? (uint32_t)f->size : 0};
+        snap_put(s, &rec, sizeof(rec));
+        snap_put(s, path, path_len);
+        (*entries)++;
+
+        if (f->type == 'D')
+        {
+            snap_save_dir(s, f, path, path_len, entries);
+            continue;
+        }
+
+        char chunk[FS_BLOCK_SIZE];
+        int offset = 0;
+        int n;
+
+        while ((n = fs_read(f, offset, chunk, sizeof(chunk))) > 0 && s->ok)
+        {
+            snap_put(s, chunk, n);
+            offset += n;
+        }
+    }
+}
+
+static bool snap_label(void)
+{
+    const AtaDrive *disk = ata_drive(SNAP_DRIVE);
+
+    slot_sectors = (disk->sectors - 1) / 2;
+    if (slot_sectors > SNAP_MAX_SLOT_SECTORS)
+        slot_sectors = SNAP_MAX_SLOT_SECTORS;
+    if (slot_sectors < 2)
+        return false;
+
+    DiskLabel *label = (DiskLabel *)snap_buf;
+    memset(snap_buf, 0, ATA_SECTOR_SIZE);
+    memcpy(label->magic, "T84DISK", 8);
+    label->version = SNAP_VERSION;
+    label->slot_sectors = slot_sectors;
+
+    /* Old headers past the label would describe a different layout. */
+    if (!bcache_write(SNAP_DRIVE, 0, 1, snap_buf))
+        return false;
+    memset(snap_buf, 0, ATA_SECTOR_SIZE);
+    if (!bcache_write(SNAP_DRIVE, slot_lba(0), 1, snap_buf) ||
+        !bcache_write(SNAP_DRIVE, slot_lba(1), 1, snap_buf))
+        return false;
+
+    disk_state = DISK_LABELLED;
+    snap_slot = -1;
+    return true;
+}
+
+void fs_sync(bool format)
+{
+    if (!spin_trylock(&snap_lock))
+    {
+        terminal_writestring("Sync already running\n");
+        return;
+    }
+    task_kill_hold();
+
+    snap_scan();
+
+    if (disk_state == DISK_NONE)
+    {
+        terminal_writestring("No disk\n");
+        spin_unlock(&snap_lock);
+        task_kill_release();
+        return;
+    }
+
+    if (disk_state == DISK_FOREIGN && !format)
+    {
+        terminal_writestring("Disk holds other data; 'sync -format' erases it\n");
+        spin_unlock(&snap_lock);
+        task_kill_release();
+        return;
+    }
+
+    if ((disk_state != DISK_LABELLED || format) && !snap_label())
+    {
+        terminal_writestring("Cannot label disk\n");
+        spin_unlock(&snap_lock);
+        task_kill_release();
+        return;
+    }
+
+    int slot = snap_slot == 0 ? 1 : 0;
+    SnapStream s;
+    SnapHeader head;
+    char path[FS_PATH_MAX];
+    uint32_t entries = 0;
+
+    snap_open(&s, slot);
+    snap_save_dir(&s, root, path, 0, &entries);
+    snap_flush(&s);
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, "T84SNAP", 8);
+    head.version = SNAP_VERSION;
+    head.generation = snap_slot >= 0 ? snap_head.generation + 1 : 1;
+    head.entries = entries;
+    head.bytes = s.bytes;
+    head.checksum = s.checksum;
+
+    memset(snap_buf, 0, ATA_SECTOR_SIZE);
+    memcpy(snap_buf, &head, sizeof(head));
+
+    if (!s.ok || !bcache_sync(SNAP_DRIVE) || !bcache_write(SNAP_DRIVE, slot_lba(slot), 1, snap_buf) ||
+        !bcache_sync(SNAP_DRIVE))
+    {
+        terminal_writestring(s.ok ? "Disk write failed\n" : "Sync failed: no room on disk\n");
+        spin_unlock(&snap_lock);
+        task_kill_release();
+        return;
+    }
+
+    snap_slot = slot;
+    snap_head = head;
+    spin_unlock(&snap_lock);
+    task_kill_release();
+
+    char line[64];
+    sprintf(line, "Synced %u entries, %u KB\n", entries, (head.bytes + 1023) / 1024);
+    terminal_writestring(line);
+}
+
+/* Disk size and the space taken by the label and newest snapshot. */
+bool fs_disk_usage(uint32_t *total_kb, uint32_t *used_kb)
+{
+    const AtaDrive *disk = ata_drive(SNAP_DRIVE);
+
+    if (!disk)
+        return false;
+
+    uint32_t sectors = 0;
+    if (disk_state == DISK_LABELLED)
+    {
+        sectors = 1;
+        if (snap_slot >= 0)
+            sectors += 1 + (snap_head.bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE;
+    }
+
+    *total_kb = disk->sectors / 2;
+    *used_kb = (sectors + 1) / 2;
+    return true;
+}
+
+/* Logs a file made since the newest snapshot, for a restore to remove. */
+static bool file_log_created(File *file)
+{
+    file->epoch = fs_epoch;
+    if (!snapshot_count)
+        return true;
+    if (undo_len == FS_UNDO_RECORDS)
+        return false;
+
+    UndoRecord *r = &undo_log[undo_len++];
+    r->file = file;
+    r->created = true;
+    return true;
+}
+
+static File *fs_create(const char *path, char type, bool verbose)
+{
+    char name[32];
+    File *dir = namei_parent(path, name);
+    File *f = NULL;
+
+    if (dir && dir_find(dir, name, strlen(name)))
+    {
+        if (verbose)
+            terminal_writestring("Already exists\n");
+        return NULL;
+    }
+
+    if (dir)
+        f = create_file(name, type);
+    if (f && !file_log_created(f))
+    {
+        inode_free(f);
+        f = NULL;
+    }
+
+    if (!f)
+    {
+        if (verbose)
+            terminal_writestring("Error\n");
+        return NULL;
     }
 
-    current_dir = user;
+    dir_link(dir, f, false);
+    if (verbose)
+        terminal_writestring(type == 'D' ? "Directory created\n" : "File created\n");
+    return f;
 }
 
-void fs_mkdir(const char *name)
+static void file_unlink(File *file)
 {
-    File *new_dir = create_file(name, 'D');
-    if (!new_dir)
+    File *dir = file->parent;
+    File **link = &dir->child;
+
+    while (*link && *link != file)
+        link = &(*link)->next;
+    if (*link)
+        *link = file->next;
+
+    link = &dir_hash[file->hash & (DIR_HASH_BUCKETS - 1)];
+    while (*link && *link != file)
+        link = &(*link)->hash_next;
+    if (*link)
+        *link = file->hash_next;
+
+    if (current_dir == file)
+        current_dir = dir;
+    fs_touch(file);
+    handle_forget(file);
+    inode_free(file);
+}
+
+static void undo_apply(const UndoRecord *r)
+{
+    File *file = r->file;
+
+    file_shrink(file, 0);
+    if (r->created)
     {
-        terminal_writestring("Error\n");
+        file_unlink(file);
         return;
     }
 
-    new_dir->parent = current_dir;
+    /* The record's share of the blocks passes back to the file. */
+    file->flags = r->flags;
+    file->extent_count = r->extent_count;
+    file->size = r->size;
+    file->backing = r->backing;
+    memcpy(file->extents, r->extents, sizeof(file->extents));
+    fs_touch(file);
+}
 
-    if (!current_dir->child)
+static int snapshot_find(const char *name)
+{
+    for (int i = 0; i < snapshot_count; i++)
     {
-        current_dir->child = new_dir;
+        if (strcmp(snapshots[i].name, name) == 0)
+            return i;
     }
-    else
+    return -1;
+}
+
+/* Forgets a snapshot.  Its records still describe older snapshots, so
+   they join the previous one's; only the oldest snapshot's records are
+   dropped, letting go of their blocks. */
+static void snapshot_remove(int index)
+{
+    if (index == 0)
     {
-        File *last = current_dir->child;
-        while (last->next)
+        int end = snapshot_count > 1 ? snapshots[1].undo_start : undo_len;
+
+        for (int i = 0; i < end; i++)
         {
-            last = last->next;
+            for (int j = 0; !undo_log[i].created && j < undo_log[i].extent_count; j++)
+                blocks_release(undo_log[i].extents[j].start, undo_log[i].extents[j].count);
         }
-        last->next = new_dir;
+
+        memmove(undo_log, &undo_log[end], (undo_len - end) * sizeof(UndoRecord));
+        undo_len -= end;
+        for (int i = 1; i < snapshot_count; i++)
+            snapshots[i].undo_start -= end;
     }
 
-    terminal_writestring("Directory created\n");
+    memmove(&snapshots[index], &snapshots[index + 1], (snapshot_count - index - 1) * sizeof(Snapshot));
+    snapshot_count--;
 }
 
-void fs_mkfile(const char *name)
+/* Takes a snapshot of the whole tree in constant time.  A snapshot of
+   the same name is replaced. */
+bool fs_snapshot_save(const char *name)
 {
-    File *new_file = create_file(name, 'F');
-    if (!new_file)
-    {
-        terminal_writestring("Error\n");
-        return;
-    }
+    int old = snapshot_find(name);
+
+    if (!*name || strlen(name) >= FS_SNAPSHOT_NAME || (old < 0 && snapshot_count == FS_SNAPSHOTS))
+        return false;
+    if (old >= 0)
+        snapshot_remove(old);
+
+    Snapshot *snap = &snapshots[snapshot_count++];
+    strcpy(snap->name, name);
+    snap->undo_start = undo_len;
+    fs_epoch++;
+    return true;
+}
 
-    new_file->parent = current_dir;
+/* Puts the tree back as it was when the snapshot was taken.  The
+   snapshot stays, so it can be restored again; newer ones are gone. */
+bool fs_snapshot_restore(const char *name)
+{
+    int index = snapshot_find(name);
+    if (index < 0)
+        return false;
 
-    if (!current_dir->child)
-    {
-        current_dir->child = new_file;
-    }
-    else
-    {
-        File *last = current_dir->child;
-        while (last->next)
-        {
-            last = last->next;
-        }
-        last->next = new_file;
-    }
+    for (int i = undo_len - 1; i >= snapshots[index].undo_start; i--)
+        undo_apply(&undo_log[i]);
+
+    undo_len = snapshots[index].undo_start;
+    snapshot_count = index + 1;
+    fs_epoch++;
+
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    memset(dcache, 0, sizeof(dcache));
+    spin_unlock_irqrestore(&dcache_lock, flags);
+    return true;
+}
+
+bool fs_snapshot_drop(const char *name)
+{
+    int index = snapshot_find(name);
+    if (index < 0)
+        return false;
+
+    snapshot_remove(index);
+    return true;
+}
 
-    terminal_writestring("File created\n");
+void fs_mkdir(const char *name)
+{
+    fs_create(name, 'D', true);
+}
+
+void fs_mkfile(const char *name)
+{
+    fs_create(name, 'F', true);
 }
 
 void fs_cd(const char *path)
@@ -215,21 +1724,6 @@ void fs_cd(const char *path)
         return;
     }
 
-    if (strcmp(path, "..") == 0)
-    {
-        if (current_dir->parent)
-        {
-            current_dir = current_dir->parent;
-        }
-        return;
-    }
-
-    if (strcmp(path, "/") == 0)
-    {
-        current_dir = root;
-        return;
-    }
-
     if (strcmp(path, "home") == 0)
     {
         if (root->child)
@@ -239,15 +1733,11 @@ void fs_cd(const char *path)
         return;
     }
 
-    File *child = current_dir->child;
-    while (child)
+    File *dir = fs_namei(path);
+    if (dir && dir->type == 'D')
     {
-        if (child->type == 'D' && strcmp(child->name, path) == 0)
-        {
-            current_dir = child;
-            return;
-        }
-        child = child->next;
+        current_dir = dir;
+        return;
     }
 
     terminal_writestring("Directory not found\n");
@@ -255,6 +1745,8 @@ void fs_cd(const char *path)
 
 void fs_ls(void)
 {
+    dir_populate(current_dir);
+
     File *child = current_dir->child;
 
     if (!child)
@@ -274,52 +1766,46 @@ void fs_ls(void)
 
 void fs_write(const char *filename, const char *content)
 {
-
-    File *child = current_dir->child;
-    while (child)
+    File *file = fs_find_file(filename);
+    if (!file)
     {
-        if (child->type == 'F' && strcmp(child->name, filename) == 0)
-        {
-
-            int i = 0;
-            while (content[i] && i < 1023)
-            {
-                child->content[i] = content[i];
-                i++;
-            }
-            child->content[i] = '\0';
-            child->size = i;
+        terminal_writestring("File not found\n");
+        return;
+    }
 
-            terminal_writestring("Written\n");
-            return;
-        }
-        child = child->next;
+    if (!fs_set_content(file, content, strlen(content)))
+    {
+        terminal_writestring("No space left\n");
+        return;
     }
 
-    terminal_writestring("File not found\n");
+    terminal_writestring("Written\n");
 }
 
 void fs_cat(const char *filename)
 {
-    File *child = current_dir->child;
-    while (child)
+    File *file = fs_find_file(filename);
+    if (!file)
     {
-        if (child->type == 'F' && strcmp(child->name, filename) == 0)
-        {
-            if (child->size > 0)
-            {
-                terminal_writestring(child->content);
-                if (child->content[child->size - 1] != '\n')
-                {
-                    terminal_writestring("\n");
-                }
-            }
-            return;
-        }
-        child = child->next;
+        terminal_writestring("File not found\n");
+        return;
+    }
+
+    char chunk[FS_BLOCK_SIZE + 1];
+    int offset = 0;
+    int n;
+
+    while ((n = fs_read(file, offset, chunk, FS_BLOCK_SIZE)) > 0)
+    {
+        chunk[n] = '\0';
+        terminal_writestring(chunk);
+        offset += n;
     }
 
-    terminal_writestring("File not found\n");
+    if (offset > 0 && chunk[strlen(chunk) - 1] != '\n')
+    {
+        terminal_writestring("\n");
+    }
 }
 
 void fs_pwd(void)
@@ -330,23 +1816,23 @@ void fs_pwd(void)
         return;
     }
 
-    char *names[10];
-    int depth = 0;
+    char path[FS_PATH_MAX];
+    int pos = FS_PATH_MAX - 1;
     File *cur = current_dir;
 
+    path[pos] = '\0';
     while (cur && cur != root)
     {
-        names[depth++] = cur->name;
+        int len = strlen(cur->name);
+        if (pos < len + 1)
+            break;
+        pos -= len;
+        memcpy(&path[pos], cur->name, len);
+        path[--pos] = '/';
         cur = cur->parent;
     }
 
-    terminal_writestring("/");
-    for (int i = depth - 1; i >= 0; i--)
-    {
-        terminal_writestring(names[i]);
-        if (i > 0)
-            terminal_writestring("/");
-    }
+    terminal_writestring(&path[pos]);
     terminal_writestring("\n");
 }
 
@@ -399,11 +1885,10 @@ void cmd_write(const char *args)
         return;
     }
 
-    char filename[32];
-    for (int i = 0; i < space && i < 31; i++)
-    {
-        filename[i] = args[i];
-    }
+    char filename[FS_PATH_MAX];
+    if (space >= FS_PATH_MAX)
+        space = FS_PATH_MAX - 1;
+    memcpy(filename, args, space);
     filename[space] = '\0';
 
     const char *content = &args[space + 1];
@@ -411,6 +1896,43 @@ void cmd_write(const char *args)
     fs_write(filename, content);
 }
 
+void cmd_append(const char *args)
+{
+    if (!args || !*args)
+    {
+        terminal_writestring("append <file> <text>\n");
+        return;
+    }
+
+    const char *space = strchr(args, ' ');
+    if (!space)
+    {
+        terminal_writestring("Need content\n");
+        return;
+    }
+
+    char filename[FS_PATH_MAX];
+    int len = space - args;
+    if (len >= FS_PATH_MAX)
+        len = FS_PATH_MAX - 1;
+    memcpy(filename, args, len);
+    filename[len] = '\0';
+
+    int fd = fs_open(filename, FS_O_APPEND);
+    if (fd < 0)
+    {
+        terminal_writestring("File not found\n");
+        return;
+    }
+
+    const char *text = space + 1;
+    if (fs_fwrite(fd, text, strlen(text)) < 0 || fs_fwrite(fd, "\n", 1) < 0)
+        terminal_writestring("No space left\n");
+    else
+        terminal_writestring("Appended\n");
+    fs_close(fd);
+}
+
 void cmd_ls(const char *args)
 {
     fs_ls();
@@ -431,83 +1953,268 @@ void cmd_pwd(void)
     fs_pwd();
 }
 
-static void process_t84_line(const char *line)
+void cmd_sync(const char *args)
 {
-    char cmd[256];
-    char *arg = NULL;
-
-    int i;
-    for (i = 0; line[i] && i < 255; i++)
+    if (args && *args && strcmp(args, "-format") != 0)
     {
-        cmd[i] = line[i];
+        terminal_writestring("sync [-format]\n");
+        return;
     }
-    cmd[i] = '\0';
+    fs_sync(args && *args);
+}
 
-    for (i = 0; cmd[i]; i++)
+void cmd_snapshot(const char *args)
+{
+    char op[16];
+    const char *name = args ? args : "";
+    int len = 0;
+
+    while (*name == ' ')
+        name++;
+    while (*name && *name != ' ' && len < (int)sizeof(op) - 1)
+        op[len++] = *name++;
+    op[len] = '\0';
+    while (*name == ' ')
+        name++;
+
+    if (!len)
     {
-        if (cmd[i] == ' ')
+        if (!snapshot_count)
+            terminal_writestring("No snapshots\n");
+
+        for (int i = 0; i < snapshot_count; i++)
         {
-            cmd[i] = '\0';
-            arg = &cmd[i + 1];
-            break;
+            char line[64];
+
+            sprintf(line, "%s  %d changes since\n", snapshots[i].name, undo_len - snapshots[i].undo_start);
+            terminal_writestring(line);
         }
+        return;
     }
 
-    char upper_cmd[256];
-    for (i = 0; cmd[i]; i++)
+    if (!*name)
     {
-        upper_cmd[i] = (cmd[i] >= 'a' && cmd[i] <= 'z') ? cmd[i] - 32 : cmd[i];
+        terminal_writestring("snapshot [save|restore|drop <name>]\n");
+        return;
     }
-    upper_cmd[i] = '\0';
 
-    if (strcmp(cmd, "ECHO") == 0 || strcmp(cmd, "echo") == 0)
-    {
-        cmd_echo(arg);
-    }
-    else if (strcmp(cmd, "INT") == 0 || strcmp(cmd, "int") == 0)
+    if (strcmp(op, "save") == 0)
+        terminal_writestring(fs_snapshot_save(name) ? "Snapshot saved\n" : "Cannot save snapshot\n");
+    else if (strcmp(op, "restore") == 0)
+        terminal_writestring(fs_snapshot_restore(name) ? "Snapshot restored\n" : "No such snapshot\n");
+    else if (strcmp(op, "drop") == 0)
+        terminal_writestring(fs_snapshot_drop(name) ? "Snapshot dropped\n" : "No such snapshot\n");
+    else
+        terminal_writestring("snapshot [save|restore|drop <name>]\n");
+}
+
+/*
+ * tparse compiles a script once into (command, args) records and keeps
+ * them on the File until it is written again.  Records point into the
+ * cache's own copy of the text, so a run is unaffected by later writes.
+ */
+#define SCRIPT_CACHE_SLOTS 8
+#define SCRIPT_MAX_LINES 512
+#define SCRIPT_MAX_USERS 4
+#define SCRIPT_MAX_TEXT 8192
+
+typedef struct
+{
+    const Command *command;
+    const char *args;
+} ScriptRecord;
+
+/* A killed job never releases its slot, so users are checked for life. */
+typedef struct
+{
+    Task *task;
+    int id;
+} ScriptUser;
+
+typedef struct ScriptCache
+{
+    File *file;
+    uint32_t last_used;
+    ScriptUser users[SCRIPT_MAX_USERS];
+    int count;
+    ScriptRecord records[SCRIPT_MAX_LINES];
+    char text[SCRIPT_MAX_TEXT];
+} ScriptCache;
+
+static ScriptCache script_caches[SCRIPT_CACHE_SLOTS];
+static spinlock_t script_lock = SPINLOCK_INIT;
+static uint32_t script_clock = 0;
+
+static void script_cache_reset(void)
+{
+    uint32_t flags = spin_lock_irqsave(&script_lock);
+    memset(script_caches, 0, sizeof(script_caches));
+    spin_unlock_irqrestore(&script_lock, flags);
+}
+
+static bool script_user_alive(const ScriptUser *user)
+{
+    return user->task && user->task->id == user->id && user->task->state != TASK_DEAD;
+}
+
+static bool script_cache_busy(const ScriptCache *cache)
+{
+    for (int i = 0; i < SCRIPT_MAX_USERS; i++)
     {
-        cmd_int(arg);
+        if (script_user_alive(&cache->users[i]))
+            return true;
     }
-    else if (strcmp(cmd, "STRING") == 0 || strcmp(cmd, "string") == 0)
+    return false;
+}
+
+static bool script_cache_acquire(ScriptCache *cache)
+{
+    Task *self = task_current();
+
+    for (int i = 0; i < SCRIPT_MAX_USERS; i++)
     {
-        cmd_string(arg);
+        if (!script_user_alive(&cache->users[i]))
+        {
+            cache->users[i].task = self;
+            cache->users[i].id = self ? self->id : 0;
+            cache->last_used = ++script_clock;
+            return true;
+        }
     }
-    else if (strcmp(cmd, "SCHAR") == 0 || strcmp(cmd, "schar") == 0)
+    return false;
+}
+
+static void script_cache_release(ScriptCache *cache)
+{
+    uint32_t flags = spin_lock_irqsave(&script_lock);
+    Task *self = task_current();
+
+    for (int i = 0; i < SCRIPT_MAX_USERS; i++)
     {
-        cmd_schar(arg);
+        if (cache->users[i].task == self)
+        {
+            cache->users[i].task = NULL;
+            break;
+        }
     }
-    else if (strcmp(cmd, "FOR") == 0 || strcmp(cmd, "for") == 0)
+    spin_unlock_irqrestore(&script_lock, flags);
+}
+
+/* Drops the compiled form; called whenever the content changes. */
+void fs_touch(File *file)
+{
+    uint32_t flags = spin_lock_irqsave(&script_lock);
+
+    file->version++;
+    if (file->script)
     {
-        cmd_for(arg);
+        file->script->file = NULL;
+        file->script = NULL;
     }
-    else if (strcmp(cmd, "IF") == 0 || strcmp(cmd, "if") == 0)
+    spin_unlock_irqrestore(&script_lock, flags);
+}
+
+static void script_compile(ScriptCache *cache, File *file)
+{
+    int size = fs_read(file, 0, cache->text, SCRIPT_MAX_TEXT - 1);
+
+    cache->text[size] = '\0';
+    cache->count = 0;
+
+    int pos = 0;
+    while (pos < size && cache->count < SCRIPT_MAX_LINES)
     {
-        cmd_if(arg);
+        char *line = &cache->text[pos];
+
+        while (pos < size && cache->text[pos] != '\n')
+            pos++;
+        cache->text[pos++] = '\0';
+
+        if (!*line)
+            continue;
+
+        ScriptRecord *record = &cache->records[cache->count++];
+        record->command = cmdtable_prepare(line, CMD_SCRIPT, &record->args);
     }
-    else if (cmd[0] == '&')
+}
+
+/* Returns the file's compiled script, acquired for the caller, or NULL
+   when every cache slot is in use. */
+static ScriptCache *script_get(File *file)
+{
+    uint32_t flags = spin_lock_irqsave(&script_lock);
+
+    ScriptCache *cache = file->script;
+    if (cache && script_cache_acquire(cache))
     {
-        cmd_print_var(cmd);
+        spin_unlock_irqrestore(&script_lock, flags);
+        return cache;
     }
-    else if (strcmp(cmd, "CLEAR") == 0 || strcmp(cmd, "clear") == 0 ||
-             strcmp(cmd, "CLS") == 0 || strcmp(cmd, "cls") == 0)
+
+    cache = NULL;
+    for (int i = 0; i < SCRIPT_CACHE_SLOTS; i++)
     {
-        cmd_clear(1);
+        ScriptCache *slot = &script_caches[i];
+
+        if (script_cache_busy(slot))
+            continue;
+        if (!cache || slot->last_used < cache->last_used)
+            cache = slot;
     }
-    else if (strcmp(cmd, "HELP") == 0 || strcmp(cmd, "help") == 0)
+
+    if (!cache)
     {
-        cmd_help();
+        spin_unlock_irqrestore(&script_lock, flags);
+        return NULL;
     }
-    else if (strcmp(cmd, "SUM") == 0 || strcmp(cmd, "sum") == 0)
+
+    if (cache->file)
     {
-        cmd_sum(arg);
+        cache->file->script = NULL;
+        cache->file = NULL;
     }
-    else if (strcmp(cmd, "SUBTRACT") == 0 || strcmp(cmd, "subtract") == 0)
+    script_cache_acquire(cache);
+    uint32_t version = file->version;
+    spin_unlock_irqrestore(&script_lock, flags);
+
+    script_compile(cache, file);
+
+    flags = spin_lock_irqsave(&script_lock);
+    if (file->version == version && !file->script)
     {
-        cmd_sub(arg);
+        cache->file = file;
+        file->script = cache;
     }
-    else if (strcmp(cmd, "DIVIDE") == 0 || strcmp(cmd, "divide") == 0)
+    spin_unlock_irqrestore(&script_lock, flags);
+
+    return cache;
+}
+
+static void script_line_number(int line_num)
+{
+    terminal_writestring("[");
+    char num_str[8];
+    itoa(line_num, num_str, 10);
+    terminal_writestring(num_str);
+    terminal_writestring("] ");
+}
+
+/* Without a free cache slot, or for scripts too big to cache, the
+   script runs line by line as before. */
+static void script_run_uncached(File *file)
+{
+    char line[256];
+    int pos = 0;
+    int line_num = 1;
+    int line_len;
+
+    while ((line_len = fs_read_line(file, &pos, line, sizeof(line))) >= 0)
     {
-        cmd_div(arg);
+        if (line_len > 0)
+        {
+            script_line_number(line_num++);
+            cmdtable_execute(line, CMD_SCRIPT);
+        }
     }
 }
 
@@ -526,68 +2233,181 @@ void cmd_tparse(const char *args)
         return;
     }
 
-    File *child = current_dir->child;
-    while (child)
+    File *file = fs_find_file(args);
+    if (!file)
     {
-        if (child->type == 'F' && strcmp(child->name, args) == 0)
-        {
-            terminal_writestring("\n=== Executing ");
-            terminal_writestring(args);
-            terminal_writestring(" ===\n\n");
+        terminal_writestring("File not found\n");
+        return;
+    }
+
+    terminal_writestring("\n=== Executing ");
+    terminal_writestring(args);
+    terminal_writestring(" ===\n\n");
 
-            char *content = child->content;
-            int pos = 0;
-            int line_num = 1;
+    ScriptCache *cache = file->size < SCRIPT_MAX_TEXT ? script_get(file) : NULL;
+    if (cache)
+    {
+        for (int i = 0; i < cache->count; i++)
+        {
+            const ScriptRecord *record = &cache->records[i];
 
-            while (pos < child->size)
+            script_line_number(i + 1);
+            if (record->command)
             {
+                record->command->handler(record->args);
+            }
+        }
+        script_cache_release(cache);
+    }
+    else
+    {
+        script_run_uncached(file);
+    }
 
-                char line[256];
-                int line_len = 0;
+    terminal_writestring("\n=== Done ===\n");
+}
+
+File *fs_find_file(const char *filename)
+{
+    File *file = fs_namei(filename);
+    return file && file->type == 'F' ? file : NULL;
+}
 
-                while (pos < child->size && content[pos] != '\n' && line_len < 255)
-                {
-                    line[line_len++] = content[pos++];
-                }
-                line[line_len] = '\0';
+/*
+ * Open files keep their position in a small shared table.  Like script
+ * cache users, a handle whose task has died counts as closed.
+ */
+#define FS_MAX_HANDLES 16
 
-                if (content[pos] == '\n')
-                    pos++;
+typedef struct
+{
+    File *file;
+    int offset;
+    int flags;
+    Task *task;
+    int task_id;
+} FsHandle;
 
-                if (line_len > 0)
-                {
+static FsHandle handles[FS_MAX_HANDLES];
+static spinlock_t handle_lock = SPINLOCK_INIT;
 
-                    terminal_writestring("[");
-                    char num_str[8];
-                    itoa(line_num, num_str, 10);
-                    terminal_writestring(num_str);
-                    terminal_writestring("] ");
+static void handle_table_reset(void)
+{
+    memset(handles, 0, sizeof(handles));
+}
 
-                    process_t84_line(line);
+static bool handle_open(const FsHandle *h)
+{
+    if (!h->file)
+        return false;
+    return !h->task || (h->task->id == h->task_id && h->task->state != TASK_DEAD);
+}
 
-                    line_num++;
-                }
-            }
+/* Closes the handles on a file that a snapshot restore removed. */
+static void handle_forget(File *file)
+{
+    uint32_t irq = spin_lock_irqsave(&handle_lock);
 
-            terminal_writestring("\n=== Done ===\n");
-            return;
-        }
-        child = child->next;
+    for (int i = 0; i < FS_MAX_HANDLES; i++)
+    {
+        if (handles[i].file == file)
+            handles[i].file = NULL;
     }
+    spin_unlock_irqrestore(&handle_lock, irq);
+}
 
-    terminal_writestring("File not found\n");
+static FsHandle *handle_get(int fd)
+{
+    if (fd < 0 || fd >= FS_MAX_HANDLES || !handle_open(&handles[fd]))
+        return NULL;
+    return &handles[fd];
 }
 
-File *fs_find_file(const char *filename)
+int fs_open(const char *path, int flags)
 {
-    File *child = current_dir->child;
-    while (child)
+    File *file = fs_find_file(path);
+
+    if (!file && (flags & FS_O_CREATE))
+        file = fs_create(path, 'F', false);
+    if (!file)
+        return -1;
+
+    uint32_t irq = spin_lock_irqsave(&handle_lock);
+    int fd = -1;
+
+    for (int i = 0; i < FS_MAX_HANDLES; i++)
     {
-        if (child->type == 'F' && strcmp(child->name, filename) == 0)
+        if (!handle_open(&handles[i]))
         {
-            return child;
+            Task *self = task_current();
+
+            handles[i].file = file;
+            handles[i].offset = 0;
+            handles[i].flags = flags;
+            handles[i].task = self;
+            handles[i].task_id = self ? self->id : 0;
+            fd = i;
+            break;
         }
-        child = child->next;
     }
-    return NULL;
-}
\ No newline at end of file
+    spin_unlock_irqrestore(&handle_lock, irq);
+
+    if (fd >= 0 && (flags & FS_O_TRUNC) && !fs_truncate(file, 0))
+    {
+        handles[fd].file = NULL;
+        return -1;
+    }
+    return fd;
+}
+
+void fs_close(int fd)
+{
+    FsHandle *h = handle_get(fd);
+    if (h)
+        h->file = NULL;
+}
+
+int fs_fread(int fd, char *buf, int len)
+{
+    FsHandle *h = handle_get(fd);
+    if (!h || !(h->flags & FS_O_READ))
+        return -1;
+
+    int n = fs_read(h->file, h->offset, buf, len);
+    h->offset += n;
+    return n;
+}
+
+int fs_fwrite(int fd, const char *data, int len)
+{
+    FsHandle *h = handle_get(fd);
+    if (!h || !(h->flags & (FS_O_WRITE | FS_O_APPEND)))
+        return -1;
+
+    if (h->flags & FS_O_APPEND)
+        h->offset = h->file->size;
+
+    int n = fs_write_at(h->file, h->offset, data, len);
+    if (n > 0)
+        h->offset += n;
+    return n;
+}
+
+int fs_seek(int fd, int offset)
+{
+    FsHandle *h = handle_get(fd);
+    if (!h || offset < 0)
+        return -1;
+
+    h->offset = offset;
+    return offset;
+}
+
+bool fs_ftruncate(int fd, int size)
+{
+    FsHandle *h = handle_get(fd);
+    if (!h || !(h->flags & (FS_O_WRITE | FS_O_APPEND)))
+        return false;
+
+    return fs_truncate(h->file, size);
+}
@@ -4,18 +4,61 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* File data lives in FS_BLOCK_SIZE blocks, described by up to
+   FS_MAX_EXTENTS runs of contiguous blocks per file. */
+#define FS_BLOCK_SIZE 256
+#define FS_BLOCK_COUNT 4096
+#define FS_MAX_EXTENTS 6
+#define FS_PATH_MAX 128
+
+/* fs_open flags */
+#define FS_O_READ 1
+#define FS_O_WRITE 2
+#define FS_O_APPEND 4
+#define FS_O_CREATE 8
+#define FS_O_TRUNC 16
+
+/* File flags for entries imported from a FAT volume */
+#define FS_F_FAT 1      /* came from the volume */
+#define FS_F_FAT_DATA 2 /* data is still read from the volume */
+#define FS_F_UNREAD 4   /* directory whose entries are not all linked yet */
+
+struct ScriptCache;
+
+typedef struct
+{
+    uint16_t start;
+    uint16_t count;
+} FsExtent;
+
 typedef struct File
 {
     char name[32];
     char type;
-    char content[1024];
+    uint8_t extent_count;
+    uint8_t flags;
+    uint8_t volume;
     int size;
+    const char *backing;
+    uint32_t cluster;
+    uint32_t epoch;
+    FsExtent extents[FS_MAX_EXTENTS];
     struct File *parent;
     struct File *child;
     struct File *next;
+    uint32_t hash;
+    struct File *hash_next;
+    uint32_t version;
+    struct ScriptCache *script;
 } File;
 
 void fs_init(void);
+int fs_mount_tar(const char *image, uint32_t size);
+void fs_sync(bool format);
+bool fs_disk_usage(uint32_t *total_kb, uint32_t *used_kb);
+bool fs_snapshot_save(const char *name);
+bool fs_snapshot_restore(const char *name);
+bool fs_snapshot_drop(const char *name);
 void fs_mkdir(const char *name);
 void fs_mkfile(const char *name);
 void fs_cd(const char *path);
@@ -29,11 +72,29 @@ void cmd_dir(const char *args);
 void cmd_fs(const char *args);
 void cmd_cd(const char *args);
 void cmd_write(const char *args);
+void cmd_append(const char *args);
 void cmd_ls(const char *args);
 void cmd_cat(const char *args);
 void cmd_pwd(void);
+void cmd_sync(const char *args);
+void cmd_snapshot(const char *args);
 void cmd_tparse(const char *args);
 
+File *fs_namei(const char *path);
 File *fs_find_file(const char *filename);
+void fs_touch(File *file);
+bool fs_set_content(File *file, const char *data, int len);
+int fs_read(File *file, int offset, char *buf, int len);
+int fs_read_line(File *file, int *pos, char *line, int max);
+int fs_write_at(File *file, int offset, const char *data, int len);
+int fs_append(File *file, const char *data, int len);
+bool fs_truncate(File *file, int size);
+
+int fs_open(const char *path, int flags);
+void fs_close(int fd);
+int fs_fread(int fd, char *buf, int len);
+int fs_fwrite(int fd, const char *data, int len);
+int fs_seek(int fd, int offset);
+bool fs_ftruncate(int fd, int size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1196 @@
+#include "sched.h"
+#include "smp.h"
+#include "timer.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "keyboard.h"
+#include "vga.h"
+#include "string_utils.h"
+
+#define SCANCODE_CTRL 0x1D
+#define SCANCODE_C 0x2E
+
+#define BALANCE_INTERVAL 10
+#define USAGE_WINDOW_US 1000000
+#define TICK_US (1000000 / TIMER_HZ)
+
+static Task tasks[MAX_TASKS];
+static uint8_t task_stacks[MAX_TASKS][TASK_STACK_SIZE] __attribute__((aligned(16)));
+static spinlock_t task_table_lock = SPINLOCK_INIT;
+
+static Task *input_owner = NULL;
+
+static bool scheduler_running = false;
+static int next_task_id = 0;
+static uint64_t window_start_us = 0;
+static spinlock_t usage_lock = SPINLOCK_INIT;
+
+static uint32_t quantum[TASK_PRIO_COUNT] = {10, 20, 50, 1};
+
+static const char *priority_names[TASK_PRIO_COUNT] = {
+    "interactive", "normal", "batch", "idle"};
+
+static const char *state_names[] = {
+    "unused", "ready", "running", "waiting", "dead"};
+
+static void sched_keyboard_irq(registers_t *regs);
+
+/* Run queue helpers: the caller holds rq->lock. */
+static void run_queue_push(RunQueue *rq, Task *task)
+{
+    TaskPriority prio = task->priority;
+
+    task->state = TASK_READY;
+    task->next = NULL;
+
+    if (rq->tail[prio])
+    {
+        rq->tail[prio]->next = task;
+    }
+    else
+    {
+        rq->head[prio] = task;
+    }
+    rq->tail[prio] = task;
+    rq->count++;
+}
+
+static bool run_queue_remove(RunQueue *rq, Task *task)
+{
+    TaskPriority prio = task->priority;
+    Task *prev = NULL;
+    Task *cur = rq->head[prio];
+
+    while (cur)
+    {
+        if (cur == task)
+        {
+            if (prev)
+            {
+                prev->next = cur->next;
+            }
+            else
+            {
+                rq->head[prio] = cur->next;
+            }
+
+            if (rq->tail[prio] == cur)
+            {
+                rq->tail[prio] = prev;
+            }
+            cur->next = NULL;
+            rq->count--;
+            return true;
+        }
+        prev = cur;
+        cur = cur->next;
+    }
+
+    return false;
+}
+
+/*
+ * Takes the first runnable task of the highest priority.  A task that is
+ * still on a CPU's stack (it was just switched out and that CPU has not
+ * left sched_switch yet) is skipped unless it is the caller's own.
+ */
+static Task *run_queue_pop(RunQueue *rq, Task *self)
+{
+    for (int prio = 0; prio < TASK_PRIO_IDLE; prio++)
+    {
+        for (Task *task = rq->head[prio]; task; task = task->next)
+        {
+            if (task->on_cpu && task != self)
+                continue;
+
+            run_queue_remove(rq, task);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+/* Locks the run queue of the CPU that currently owns the task. */
+static RunQueue *task_lock_queue(Task *task, uint32_t *flags)
+{
+    while (1)
+    {
+        CPU *cpu = smp_get_cpu(task->cpu);
+        *flags = spin_lock_irqsave(&cpu->run_queue.lock);
+
+        if (task->cpu == cpu->index)
+            return &cpu->run_queue;
+
+        spin_unlock_irqrestore(&cpu->run_queue.lock, *flags);
+    }
+}
+
+/* Must be called without any run queue lock held. */
+void task_wake(Task *task)
+{
+    uint32_t flags;
+    RunQueue *rq = task_lock_queue(task, &flags);
+
+    if (task->state != TASK_WAITING)
+    {
+        task->wakeup_pending = true;
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    task->wait_input = false;
+    task->timed_wait = false;
+    run_queue_push(rq, task);
+
+    CPU *cpu = smp_get_cpu(task->cpu);
+    Task *running = cpu->current;
+    bool kick = running == cpu->idle || task->priority < running->priority;
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (kick)
+    {
+        smp_send_resched(cpu);
+        return;
+    }
+
+    /* The owner is busy; let an idle CPU come and steal the task. */
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        CPU *other = smp_get_cpu(i);
+        if (other != cpu && other->online && other->current == other->idle)
+        {
+            smp_send_resched(other);
+            break;
+        }
+    }
+}
+
+/*
+ * Puts the caller to sleep unless a wakeup already arrived.  Interrupts
+ * must be disabled so the task cannot migrate between the checks.
+ */
+static void task_block(void)
+{
+    Task *self = this_cpu()->current;
+    uint32_t flags;
+    RunQueue *rq = task_lock_queue(self, &flags);
+
+    if (self->wakeup_pending)
+    {
+        self->wakeup_pending = false;
+        self->wait_input = false;
+        self->timed_wait = false;
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    self->state = TASK_WAITING;
+    spin_unlock_irqrestore(&rq->lock, flags);
+    sched_yield();
+}
+
+static void task_trampoline(void)
+{
+    Task *self = task_current();
+
+    self->entry(self->arg);
+    task_exit();
+}
+
+static void idle_entry(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        __asm__ volatile("sti\n\thlt");
+    }
+}
+
+static void task_set_name(Task *task, const char *name)
+{
+    int i = 0;
+    while (name[i] && i < TASK_NAME_LEN - 1)
+    {
+        task->name[i] = name[i];
+        i++;
+    }
+    task->name[i] = '\0';
+}
+
+/* Returns a free slot with task_table_lock held, or -1. */
+static int task_alloc_slot(void)
+{
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        if (tasks[i].state == TASK_UNUSED ||
+            (tasks[i].state == TASK_DEAD && !tasks[i].on_cpu))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Task *task_setup(int slot, const char *name, void (*entry)(void *arg), void *arg, TaskPriority priority)
+{
+    Task *task = &tasks[slot];
+
+    memset(task, 0, sizeof(Task));
+    task->id = next_task_id++;
+    task->slot = slot;
+    task->priority = priority;
+    task->entry = entry;
+    task->arg = arg;
+    task_set_name(task, name);
+    cpu_fpu_init_state(task->fpu_state);
+
+    /* Build the frame irq_common pops on the first switch; the spare
+       words above it stand in for the trampoline's return address. */
+    uint8_t *top = task_stacks[slot] + TASK_STACK_SIZE;
+    registers_t *frame = (registers_t *)(top - 20 - sizeof(registers_t));
+
+    memset(frame, 0, sizeof(registers_t));
+    frame->gs = GDT_KERNEL_DATA;
+    frame->fs = GDT_KERNEL_DATA;
+    frame->es = GDT_KERNEL_DATA;
+    frame->ds = GDT_KERNEL_DATA;
+    frame->eip = (uint32_t)task_trampoline;
+    frame->cs = GDT_KERNEL_CODE;
+    frame->eflags = 0x202;
+
+    task->frame = frame;
+    return task;
+}
+
+void sched_init(void)
+{
+    if (scheduler_running)
+        return;
+
+    CPU *bsp = smp_get_cpu(0);
+
+    memset(tasks, 0, sizeof(tasks));
+    memset(&bsp->run_queue, 0, sizeof(RunQueue));
+
+    /* Slot 0 is the shell that is already running on the boot stack. */
+    Task *shell = &tasks[0];
+    shell->id = next_task_id++;
+    strcpy(shell->name, "shell");
+    shell->priority = TASK_PRIO_INTERACTIVE;
+    shell->state = TASK_RUNNING;
+    shell->on_cpu = true;
+
+    bsp->current = shell;
+    bsp->slice_end_us = timer_get_us() + quantum[TASK_PRIO_INTERACTIVE] * TICK_US;
+    bsp->account_us = timer_get_us();
+    window_start_us = bsp->account_us;
+    input_owner = shell;
+
+    bsp->idle = task_setup(1, "idle0", idle_entry, NULL, TASK_PRIO_IDLE);
+    bsp->idle->state = TASK_READY;
+
+    irq_install_handler(IRQ1, sched_keyboard_irq);
+    scheduler_running = true;
+}
+
+/* Adopts the code already running on an AP's boot stack as its idle task. */
+void sched_init_ap(CPU *cpu)
+{
+    char name[TASK_NAME_LEN];
+
+    strcpy(name, "idle");
+    itoa(cpu->index, name + 4, 10);
+
+    uint32_t flags = spin_lock_irqsave(&task_table_lock);
+
+    int slot = task_alloc_slot();
+    Task *idle = &tasks[slot];
+
+    memset(idle, 0, sizeof(Task));
+    idle->id = next_task_id++;
+    idle->slot = slot;
+    idle->cpu = cpu->index;
+    idle->priority = TASK_PRIO_IDLE;
+    idle->state = TASK_RUNNING;
+    idle->on_cpu = true;
+    task_set_name(idle, name);
+
+    spin_unlock_irqrestore(&task_table_lock, flags);
+
+    memset(&cpu->run_queue, 0, sizeof(RunQueue));
+    cpu->idle = idle;
+    cpu->current = idle;
+    cpu->account_us = timer_get_us();
+}
+
+bool sched_is_running(void)
+{
+    return scheduler_running;
+}
+
+/* New work goes to the CPU with the fewest runnable tasks. */
+static CPU *sched_pick_cpu(void)
+{
+    CPU *best = smp_get_cpu(0);
+    int best_load = 0x7FFFFFFF;
+
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        CPU *cpu = smp_get_cpu(i);
+        if (!cpu->online)
+            continue;
+
+        int load = cpu->run_queue.count + (cpu->current != cpu->idle);
+        if (load < best_load)
+        {
+            best = cpu;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+Task *task_create(const char *name, void (*entry)(void *arg), void *arg, TaskPriority priority)
+{
+    if (!scheduler_running || priority >= TASK_PRIO_IDLE)
+        return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&task_table_lock);
+
+    Task *parent = this_cpu()->current;
+    Task *task = NULL;
+    int slot = task_alloc_slot();
+
+    if (slot >= 0)
+    {
+        task = task_setup(slot, name, entry, arg, priority);
+        task->parent = parent;
+        task->waiter = parent;
+        task->state = TASK_WAITING;
+    }
+
+    spin_unlock_irqrestore(&task_table_lock, flags);
+
+    if (task)
+    {
+        task->cpu = sched_pick_cpu()->index;
+        task_wake(task);
+    }
+
+    return task;
+}
+
+/* Detaches the children of a task that is going away. */
+static void task_orphan_children(Task *task)
+{
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        if (tasks[i].parent == task)
+        {
+            tasks[i].parent = NULL;
+            if (tasks[i].waiter == task)
+            {
+                tasks[i].waiter = NULL;
+            }
+        }
+    }
+}
+
+void task_exit(void)
+{
+    irq_save();
+
+    Task *self = this_cpu()->current;
+    uint32_t flags;
+    RunQueue *rq = task_lock_queue(self, &flags);
+
+    self->state = TASK_DEAD;
+    Task *waiter = self->waiter;
+    self->waiter = NULL;
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    task_orphan_children(self);
+    if (waiter)
+    {
+        task_wake(waiter);
+    }
+
+    sched_yield();
+
+    while (1)
+    {
+        __asm__ volatile("hlt");
+    }
+}
+
+/*
+ * Kills a task and everything it spawned.  A task running on another CPU
+ * is only flagged; that CPU retires it on its next pass through
+ * sched_switch, which the IPI forces.  A task inside a task_kill_hold
+ * section is flagged too, and dies when it leaves the last one.
+ */
+void task_kill(Task *task)
+{
+    if (!task || task->priority == TASK_PRIO_IDLE)
+        return;
+
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        if (tasks[i].parent == task && tasks[i].state != TASK_UNUSED &&
+            tasks[i].state != TASK_DEAD)
+        {
+            task_kill(&tasks[i]);
+        }
+    }
+
+    if (task == task_current())
+    {
+        if (task->no_kill)
+        {
+            task->kill_pending = true;
+            return;
+        }
+        task_exit();
+    }
+
+    uint32_t flags;
+    RunQueue *rq = task_lock_queue(task, &flags);
+    Task *waiter = NULL;
+    bool remote = false;
+
+    if (task->state == TASK_RUNNING || (task->no_kill && task->state != TASK_DEAD))
+    {
+        task->kill_pending = true;
+        remote = task->state == TASK_RUNNING;
+    }
+    else if (task->state != TASK_UNUSED && task->state != TASK_DEAD)
+    {
+        if (task->state == TASK_READY)
+        {
+            run_queue_remove(rq, task);
+        }
+        task->state = TASK_DEAD;
+        waiter = task->waiter;
+        task->waiter = NULL;
+    }
+
+    CPU *cpu = smp_get_cpu(task->cpu);
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (remote)
+    {
+        smp_send_resched(cpu);
+    }
+    else if (task->state == TASK_DEAD)
+    {
+        task_orphan_children(task);
+    }
+
+    if (waiter)
+    {
+        task_wake(waiter);
+    }
+}
+
+/*
+ * Marks a section the current task must not be killed in: one that
+ * holds a lock other tasks wait for, has I/O in flight into its memory,
+ * or leaves shared data half changed.  Sections nest; a kill that comes
+ * in meanwhile takes effect when the last one ends.
+ */
+void task_kill_hold(void)
+{
+    uint32_t flags = irq_save();
+    Task *self = this_cpu()->current;
+
+    if (self)
+        self->no_kill++;
+    irq_restore(flags);
+}
+
+void task_kill_release(void)
+{
+    uint32_t flags = irq_save();
+    Task *self = this_cpu()->current;
+    bool die = false;
+
+    if (self && self->no_kill > 0)
+        die = --self->no_kill == 0 && self->kill_pending;
+    irq_restore(flags);
+
+    if (die)
+        task_exit();
+}
+
+Task *task_current(void)
+{
+    uint32_t flags = irq_save();
+    Task *task = this_cpu()->current;
+    irq_restore(flags);
+    return task;
+}
+
+void task_sleep_ms(uint32_t ms)
+{
+    task_sleep_us(ms * 1000);
+}
+
+void task_sleep_us(uint32_t us)
+{
+    if (!scheduler_running)
+    {
+        for (volatile uint32_t i = 0; i < us * 9; i++)
+            ;
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    Task *self = this_cpu()->current;
+
+    self->wake_us = timer_get_us() + (us ? us : 1);
+    self->timed_wait = true;
+    task_block();
+
+    irq_restore(flags);
+}
+
+/* Waits until the task has finished or was killed. */
+void task_join(Task *task)
+{
+    if (!task)
+        return;
+
+    int id = task->id;
+    uint32_t irq_flags = irq_save();
+    Task *self = this_cpu()->current;
+
+    while (1)
+    {
+        uint32_t flags;
+        RunQueue *rq = task_lock_queue(task, &flags);
+        bool done = task->id != id || task->state == TASK_UNUSED || task->state == TASK_DEAD;
+
+        if (!done)
+        {
+            task->waiter = self;
+        }
+        spin_unlock_irqrestore(&rq->lock, flags);
+
+        if (done)
+            break;
+
+        task_block();
+    }
+
+    irq_restore(irq_flags);
+}
+
+void sched_yield(void)
+{
+    if (scheduler_running)
+    {
+        __asm__ volatile("int $0x30" : : : "memory");
+    }
+}
+
+/* Charges the time since the last call to the CPU's running task.
+   The caller holds the CPU's run queue lock. */
+static void sched_account(CPU *cpu, uint64_t now)
+{
+    Task *running = cpu->current;
+
+    if (running && now > cpu->account_us)
+    {
+        uint32_t delta = (uint32_t)(now - cpu->account_us);
+        running->cpu_time_us += delta;
+        running->window_us += delta;
+    }
+    cpu->account_us = now;
+}
+
+/*
+ * Turns the time charged during the last window into per-task usage.
+ * Without a periodic tick a quiet system may not get here for a while,
+ * so readers call it as well.
+ */
+static void sched_update_usage(uint64_t now)
+{
+    if (now - window_start_us < USAGE_WINDOW_US)
+        return;
+
+    uint32_t flags = irq_save();
+
+    if (!spin_trylock(&usage_lock))
+    {
+        irq_restore(flags);
+        return;
+    }
+
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        CPU *cpu = smp_get_cpu(i);
+        if (!cpu->online)
+            continue;
+
+        spin_lock(&cpu->run_queue.lock);
+        sched_account(cpu, now);
+        spin_unlock(&cpu->run_queue.lock);
+    }
+
+    uint32_t per_percent = (uint32_t)div64_32(now - window_start_us, 100);
+
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        tasks[i].usage = tasks[i].window_us / per_percent;
+        tasks[i].window_us = 0;
+    }
+    window_start_us = now;
+
+    spin_unlock(&usage_lock);
+    irq_restore(flags);
+}
+
+/* Wakes sleepers whose deadline has passed. */
+static void sched_wake_expired(uint64_t now, bool input_ready)
+{
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        Task *task = &tasks[i];
+        if (task->state != TASK_WAITING)
+            continue;
+
+        if ((task->wait_input && input_ready) ||
+            (task->timed_wait && now >= task->wake_us))
+        {
+            task_wake(task);
+        }
+    }
+}
+
+static uint64_t sched_next_wakeup(void)
+{
+    uint64_t next = TIMER_NO_DEADLINE;
+
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        Task *task = &tasks[i];
+        if (task->state == TASK_WAITING && task->timed_wait && task->wake_us < next)
+        {
+            next = task->wake_us;
+        }
+    }
+
+    return next;
+}
+
+/*
+ * Tickless mode: the next interrupt on this CPU is the end of the running
+ * task's slice or the earliest sleeper, whichever comes first.  An idle
+ * CPU with nothing to wake stops its timer entirely.
+ */
+static void sched_arm_timer(CPU *cpu)
+{
+    if (!timer_is_tickless())
+        return;
+
+    uint64_t deadline = sched_next_wakeup();
+
+    if (cpu->current != cpu->idle && cpu->slice_end_us < deadline)
+    {
+        deadline = cpu->slice_end_us;
+    }
+
+    if (deadline == TIMER_NO_DEADLINE)
+    {
+        timer_disarm();
+    }
+    else
+    {
+        timer_arm(deadline);
+    }
+}
+
+static void sched_keyboard_irq(registers_t *regs)
+{
+    (void)regs;
+
+    if (input_owner && input_owner->state == TASK_WAITING && input_owner->wait_input)
+    {
+        task_wake(input_owner);
+    }
+}
+
+/*
+ * Runs from IRQ0 on the BSP with interrupts off while the PIT is the
+ * scheduling clock.  It does the bookkeeping for every CPU and preempts
+ * the others by IPI when their slice runs out.
+ */
+void sched_tick(void)
+{
+    if (!scheduler_running)
+        return;
+
+    uint64_t now = timer_get_us();
+    bool input_ready = (inb(0x64) & 0x01) != 0;
+    int cpu_count = smp_cpu_count();
+    CPU *idle_cpu = NULL;
+    CPU *busy_cpu = NULL;
+
+    for (int i = 0; i < cpu_count; i++)
+    {
+        CPU *cpu = smp_get_cpu(i);
+        Task *running = cpu->current;
+
+        if (!cpu->online || !running)
+            continue;
+
+        if (running == cpu->idle)
+        {
+            idle_cpu = cpu;
+        }
+        else if ((running->kill_pending && !running->no_kill) || now >= cpu->slice_end_us)
+        {
+            smp_send_resched(cpu);
+        }
+
+        if (cpu->run_queue.count > 0)
+        {
+            busy_cpu = cpu;
+        }
+    }
+
+    sched_wake_expired(now, input_ready);
+
+    /* An idle CPU steals on its next switch; make sure it has one. */
+    if (idle_cpu && busy_cpu && idle_cpu != busy_cpu &&
+        timer_get_ticks() % BALANCE_INTERVAL == 0)
+    {
+        smp_send_resched(idle_cpu);
+    }
+
+    sched_update_usage(now);
+}
+
+/* Tickless mode: this CPU's local timer fired. */
+registers_t *sched_timer_event(registers_t *regs)
+{
+    CPU *cpu = this_cpu();
+    uint64_t now = timer_get_us();
+
+    if (!scheduler_running)
+        return regs;
+
+    sched_wake_expired(now, false);
+
+    if (cpu->current != cpu->idle && now >= cpu->slice_end_us)
+    {
+        cpu->run_queue.need_resched = true;
+    }
+
+    sched_update_usage(now);
+
+    registers_t *next = sched_switch(regs, false);
+    sched_arm_timer(cpu);
+    return next;
+}
+
+/* Takes work from the busiest other queue.  Called with own lock held. */
+static Task *sched_steal(CPU *self)
+{
+    CPU *victim = NULL;
+    int most = 0;
+
+    for (int i = 0; i < smp_cpu_count(); i++)
+    {
+        CPU *cpu = smp_get_cpu(i);
+        if (cpu != self && cpu->online && cpu->run_queue.count > most)
+        {
+            victim = cpu;
+            most = cpu->run_queue.count;
+        }
+    }
+
+    if (!victim || !spin_trylock(&victim->run_queue.lock))
+        return NULL;
+
+    Task *task = run_queue_pop(&victim->run_queue, NULL);
+    if (task)
+    {
+        task->cpu = self->index;
+    }
+
+    spin_unlock(&victim->run_queue.lock);
+    return task;
+}
+
+registers_t *sched_switch(registers_t *regs, bool yielding)
+{
+    if (!scheduler_running)
+        return regs;
+
+    CPU *cpu = this_cpu();
+    RunQueue *rq = &cpu->run_queue;
+    Task *prev = cpu->current;
+    bool kill = prev->kill_pending && !prev->no_kill;
+
+    if (!yielding && !rq->need_resched && !kill)
+        return regs;
+
+    Task *waiter = NULL;
+
+    uint64_t now = timer_get_us();
+
+    spin_lock(&rq->lock);
+    rq->need_resched = false;
+    prev->frame = regs;
+    sched_account(cpu, now);
+
+    if (kill)
+    {
+        if (prev->state == TASK_READY)
+        {
+            run_queue_remove(rq, prev);
+        }
+        if (prev->state != TASK_DEAD)
+        {
+            waiter = prev->waiter;
+            prev->waiter = NULL;
+        }
+        prev->kill_pending = false;
+        prev->state = TASK_DEAD;
+    }
+
+    if (prev == cpu->idle)
+    {
+        prev->state = TASK_READY;
+    }
+    else if (prev->state == TASK_RUNNING)
+    {
+        run_queue_push(rq, prev);
+    }
+
+    Task *next = run_queue_pop(rq, prev);
+    if (!next)
+    {
+        next = sched_steal(cpu);
+    }
+    if (!next)
+    {
+        next = cpu->idle;
+    }
+
+    next->state = TASK_RUNNING;
+    next->on_cpu = true;
+    cpu->slice_end_us = now + quantum[next->priority] * TICK_US;
+    cpu->current = next;
+
+    if (next != prev)
+    {
+        cpu->prev = prev;
+    }
+
+    spin_unlock(&rq->lock);
+
+    if (waiter)
+    {
+        task_orphan_children(prev);
+        task_wake(waiter);
+    }
+
+    /* Eager FPU switch; prev stays on_cpu until the stack has moved. */
+    if (next != prev && cpu_sse_enabled())
+    {
+        fxsave(prev->fpu_state);
+        fxrstor(next->fpu_state);
+    }
+
+    sched_arm_timer(cpu);
+    return next->frame;
+}
+
+/* Called by irq_common once it runs on the new task's stack. */
+void sched_switch_done(void)
+{
+    CPU *cpu = this_cpu();
+
+    if (cpu->prev)
+    {
+        cpu->prev->on_cpu = false;
+        cpu->prev = NULL;
+    }
+}
+
+/*
+ * Blocks the caller until a scancode is pending (input owner only) or
+ * the timeout expires.  Tasks that do not own the keyboard read the
+ * queue fed by the owner, so they just give up the CPU for a tick.
+ */
+void sched_wait_input(uint32_t timeout_ms)
+{
+    if (!scheduler_running)
+        return;
+
+    uint32_t flags = irq_save();
+    Task *self = this_cpu()->current;
+
+    if (self == input_owner)
+    {
+        if (inb(0x64) & 0x01)
+        {
+            irq_restore(flags);
+            return;
+        }
+        self->wait_input = true;
+    }
+    else if (timeout_ms == 0)
+    {
+        timeout_ms = 1;
+    }
+
+    if (timeout_ms)
+    {
+        self->wake_us = timer_get_us() + timeout_ms * 1000;
+        self->timed_wait = true;
+    }
+
+    task_block();
+
+    irq_restore(flags);
+}
+
+bool sched_is_input_owner(void)
+{
+    return !scheduler_running || task_current() == input_owner;
+}
+
+/*
+ * Runs a script-like command as a batch task while the shell keeps the
+ * keyboard: Ctrl+C kills the job, every other scancode is forwarded to
+ * it.  Returns -1 if the job was interrupted.
+ */
+int sched_run_foreground(const char *name, void (*entry)(void *arg), void *arg)
+{
+    if (!scheduler_running || task_current() != input_owner)
+    {
+        entry(arg);
+        return 0;
+    }
+
+    /* The job reports back to its parent, the shell, when it ends. */
+    Task *job = task_create(name, entry, arg, TASK_PRIO_BATCH);
+    if (!job)
+    {
+        entry(arg);
+        return 0;
+    }
+
+    int job_id = job->id;
+    bool ctrl_down = false;
+    int result = 0;
+
+    keyboard_clear_queue();
+
+    while (job->id == job_id && job->state != TASK_DEAD)
+    {
+        sched_wait_input(0);
+
+        while (job->id == job_id && job->state != TASK_DEAD && (inb(0x64) & 0x01))
+        {
+            uint8_t scancode = inb(0x60);
+
+            if (scancode == SCANCODE_CTRL)
+            {
+                ctrl_down = true;
+            }
+            else if (scancode == (0x80 | SCANCODE_CTRL))
+            {
+                ctrl_down = false;
+            }
+
+            if (ctrl_down && scancode == SCANCODE_C)
+            {
+                task_kill(job);
+                terminal_writestring("^C\n");
+                result = -1;
+                break;
+            }
+
+            keyboard_push_scancode(scancode);
+        }
+    }
+
+    keyboard_clear_queue();
+    return result;
+}
+
+void sched_set_quantum(TaskPriority priority, uint32_t ticks)
+{
+    if (priority >= TASK_PRIO_IDLE || ticks == 0)
+        return;
+
+    quantum[priority] = ticks;
+}
+
+uint32_t sched_get_quantum(TaskPriority priority)
+{
+    if (priority >= TASK_PRIO_COUNT)
+        return 0;
+
+    return quantum[priority];
+}
+
+int sched_cpu_usage_of(int index)
+{
+    CPU *cpu = smp_get_cpu(index);
+
+    if (!scheduler_running || !cpu || !cpu->online || !cpu->idle)
+        return 0;
+
+    int idle = cpu->idle->usage;
+    return idle > 100 ? 0 : 100 - idle;
+}
+
+/* Average over all online CPUs. */
+int sched_cpu_usage(void)
+{
+    int count = smp_cpu_count();
+    int total = 0;
+
+    if (scheduler_running)
+    {
+        sched_update_usage(timer_get_us());
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        total += sched_cpu_usage_of(i);
+    }
+
+    return count ? total / count : 0;
+}
+
+Task *sched_get_task(int index)
+{
+    if (index < 0 || index >= MAX_TASKS)
+        return NULL;
+
+    if (tasks[index].state == TASK_UNUSED || tasks[index].state == TASK_DEAD)
+        return NULL;
+
+    return &tasks[index];
+}
+
+const char *sched_priority_name(TaskPriority priority)
+{
+    if (priority >= TASK_PRIO_COUNT)
+        return "?";
+
+    return priority_names[priority];
+}
+
+static void write_column(const char *text, int width)
+{
+    int len = strlen(text);
+
+    terminal_writestring(text);
+    while (len++ < width)
+    {
+        terminal_putchar(' ');
+    }
+}
+
+void cmd_tasks(const char *args)
+{
+    (void)args;
+
+    if (!scheduler_running)
+    {
+        terminal_writestring("\nScheduler not running\n");
+        return;
+    }
+
+    sched_update_usage(timer_get_us());
+
+    terminal_writestring("\n=== Tasks ===\n");
+    write_column("ID", 4);
+    write_column("NAME", 16);
+    write_column("PRIO", 13);
+    write_column("STATE", 9);
+    write_column("CORE", 5);
+    write_column("CPU", 6);
+    terminal_writestring("TIME(ms)\n");
+
+    for (int i = 0; i < MAX_TASKS; i++)
+    {
+        Task *task = sched_get_task(i);
+        if (!task)
+            continue;
+
+        char num_str[16];
+
+        itoa(task->id, num_str, 10);
+        write_column(num_str, 4);
+        write_column(task->name, 16);
+        write_column(priority_names[task->priority], 13);
+        write_column(state_names[task->state], 9);
+
+        itoa(task->cpu, num_str, 10);
+        write_column(num_str, 5);
+
+        itoa(task->usage, num_str, 10);
+        strcat(num_str, "%");
+        write_column(num_str, 6);
+
+        terminal_writeall("%u\n", (uint32_t)div64_32(task->cpu_time_us, 1000));
+    }
+
+    terminal_writeall("\nCPU usage: %d%% across %d CPU(s)\n", sched_cpu_usage(), smp_cpu_count());
+}
+
+void cmd_sched(const char *args)
+{
+    if (args && strncmp(args, "quantum ", 8) == 0)
+    {
+        char level[16];
+        int ticks = 0;
+
+        if (sscanf(args + 8, "%s %d", level, &ticks) != 2 || ticks <= 0)
+        {
+            terminal_writestring("\nUsage: sched quantum <interactive|normal|batch> <ticks>\n");
+            return;
+        }
+
+        for (int prio = 0; prio < TASK_PRIO_IDLE; prio++)
+        {
+            if (strcmp(level, priority_names[prio]) == 0)
+            {
+                sched_set_quantum((TaskPriority)prio, ticks);
+                terminal_writeall("\nQuantum for %s set to %d ticks\n", level, ticks);
+                return;
+            }
+        }
+
+        terminal_writestring("\nUnknown priority level\n");
+        return;
+    }
+
+    terminal_writestring("\n=== Scheduler ===\n");
+    terminal_writeall("Timer: %s", timer_mode_name());
+    if (timer_is_tickless())
+    {
+        terminal_writestring(" (tickless)");
+    }
+    terminal_writeall("\nTSC: %u kHz\n", timer_get_tsc_khz());
+    terminal_writeall("Slice tick: %d us\n", TICK_US);
+    for (int prio = 0; prio < TASK_PRIO_IDLE; prio++)
+    {
+        write_column(priority_names[prio], 13);
+        terminal_writeall("%u ticks\n", quantum[prio]);
+    }
+    terminal_writestring("\nUsage: sched quantum <interactive|normal|batch> <ticks>\n");
+}
@@ -0,0 +1,123 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "isr.h"
+#include "spinlock.h"
+#include "cpu.h"
+
+#define MAX_TASKS 24
+#define TASK_STACK_SIZE 16384
+#define TASK_NAME_LEN 16
+
+typedef enum
+{
+    TASK_PRIO_INTERACTIVE,
+    TASK_PRIO_NORMAL,
+    TASK_PRIO_BATCH,
+    TASK_PRIO_IDLE,
+    TASK_PRIO_COUNT
+} TaskPriority;
+
+typedef enum
+{
+    TASK_UNUSED,
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_WAITING,
+    TASK_DEAD
+} TaskState;
+
+typedef struct Task
+{
+    int id;
+    char name[TASK_NAME_LEN];
+    TaskState state;
+    TaskPriority priority;
+    registers_t *frame;
+    uint64_t cpu_time_us;
+    uint32_t window_us;
+    uint32_t usage;
+    uint64_t wake_us;
+    bool timed_wait;
+    bool wait_input;
+    bool wakeup_pending;
+    volatile bool on_cpu;
+    volatile bool kill_pending;
+    int no_kill;
+    int slot;
+    int cpu;
+    void (*entry)(void *arg);
+    void *arg;
+    struct Task *parent;
+    struct Task *waiter;
+    struct Task *next;
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+} Task;
+
+typedef struct
+{
+    spinlock_t lock;
+    Task *head[TASK_PRIO_COUNT];
+    Task *tail[TASK_PRIO_COUNT];
+    int count;
+    volatile bool need_resched;
+} RunQueue;
+
+struct CPU;
+
+void sched_init(void);
+void sched_init_ap(struct CPU *cpu);
+bool sched_is_running(void);
+
+Task *task_create(const char *name, void (*entry)(void *arg), void *arg, TaskPriority priority);
+void task_exit(void);
+void task_kill(Task *task);
+void task_kill_hold(void);
+void task_kill_release(void);
+Task *task_current(void);
+void task_sleep_ms(uint32_t ms);
+void task_sleep_us(uint32_t us);
+void task_join(Task *task);
+void task_wake(Task *task);
+
+void sched_yield(void);
+void sched_tick(void);
+
+/* Takes a lock that is held across work that may sleep, such as disk
+   I/O, yielding to other tasks instead of spinning while it is taken.
+   The holder cannot be killed until spin_unlock_yield, so the lock is
+   always given back. */
+static inline void spin_lock_yield(spinlock_t *lock)
+{
+    task_kill_hold();
+    while (!spin_trylock(lock))
+        sched_yield();
+}
+
+static inline void spin_unlock_yield(spinlock_t *lock)
+{
+    spin_unlock(lock);
+    task_kill_release();
+}
+
+registers_t *sched_switch(registers_t *regs, bool yielding);
+void sched_switch_done(void);
+registers_t *sched_timer_event(registers_t *regs);
+
+void sched_wait_input(uint32_t timeout_ms);
+bool sched_is_input_owner(void);
+int sched_run_foreground(const char *name, void (*entry)(void *arg), void *arg);
+
+void sched_set_quantum(TaskPriority priority, uint32_t ticks);
+uint32_t sched_get_quantum(TaskPriority priority);
+int sched_cpu_usage(void);
+int sched_cpu_usage_of(int cpu);
+Task *sched_get_task(int index);
+const char *sched_priority_name(TaskPriority priority);
+
+void cmd_tasks(const char *args);
+void cmd_sched(const char *args);
+
+#endif
@@ -0,0 +1,172 @@
+#include "smp.h"
+#include "apic.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "isr.h"
+#include "timer.h"
+#include "vga.h"
+#include "string_utils.h"
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+
+static CPU cpus[MAX_CPUS];
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+static uint8_t apic_to_cpu[256];
+
+static volatile int cpu_count = 1;
+static bool smp_started = false;
+
+/* Read by the trampoline and ap_main() while a single AP is starting. */
+volatile uint32_t ap_boot_stack = 0;
+static volatile int ap_boot_index = 0;
+
+void ap_main(void);
+
+static void smp_delay_ms(uint32_t ms)
+{
+    uint64_t end = timer_get_us() + (ms + 1) * 1000;
+
+    while (timer_get_us() < end)
+    {
+        __asm__ volatile("pause");
+    }
+}
+
+void ap_main(void)
+{
+    CPU *cpu = &cpus[ap_boot_index];
+
+    gdt_load();
+    idt_load();
+    cpu_enable_sse();
+    lapic_init(acpi_lapic_address());
+
+    sched_init_ap(cpu);
+    __sync_fetch_and_add(&cpu_count, 1);
+    cpu->online = true;
+
+    /* This loop is the CPU's idle task from now on. */
+    while (1)
+    {
+        __asm__ volatile("sti\n\thlt");
+    }
+}
+
+static bool smp_start_ap(int index, uint8_t apic_id)
+{
+    CPU *cpu = &cpus[index];
+
+    cpu->index = index;
+    cpu->apic_id = apic_id;
+    cpu->online = false;
+    apic_to_cpu[apic_id] = index;
+
+    ap_boot_index = index;
+    ap_boot_stack = (uint32_t)(ap_stacks[index] + AP_STACK_SIZE);
+
+    lapic_send_ipi(apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+    smp_delay_ms(10);
+
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++)
+    {
+        lapic_send_ipi(apic_id, ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        smp_delay_ms(1);
+    }
+
+    for (int waited = 0; waited < 200 && !cpu->online; waited++)
+    {
+        smp_delay_ms(1);
+    }
+
+    return cpu->online;
+}
+
+/*
+ * Brings up every processor listed in the MADT.  Needs the PIT running
+ * and interrupts enabled for the INIT/SIPI delays.
+ */
+void smp_init(void)
+{
+    if (smp_started)
+        return;
+    smp_started = true;
+
+    cpus[0].online = true;
+
+    /* The BSP's local APIC is wanted for its timer even on one CPU. */
+    bool have_acpi = acpi_init();
+    if (!lapic_init(have_acpi ? acpi_lapic_address() : 0))
+        return;
+
+    uint8_t bsp_id = lapic_id();
+    cpus[0].apic_id = bsp_id;
+    apic_to_cpu[bsp_id] = 0;
+
+    if (acpi_cpu_count() <= 1)
+        return;
+
+    memcpy((void *)SMP_TRAMPOLINE_ADDR, smp_trampoline_start,
+           smp_trampoline_end - smp_trampoline_start);
+
+    for (int i = 0; i < acpi_cpu_count() && cpu_count < MAX_CPUS; i++)
+    {
+        uint8_t apic_id = acpi_cpu_apic_id(i);
+        if (apic_id == bsp_id)
+            continue;
+
+        smp_start_ap(cpu_count, apic_id);
+    }
+}
+
+int smp_cpu_count(void)
+{
+    return cpu_count;
+}
+
+CPU *smp_get_cpu(int index)
+{
+    if (index < 0 || index >= MAX_CPUS)
+        return NULL;
+
+    return &cpus[index];
+}
+
+CPU *this_cpu(void)
+{
+    if (cpu_count <= 1)
+        return &cpus[0];
+
+    return &cpus[apic_to_cpu[lapic_id()]];
+}
+
+void smp_send_resched(CPU *cpu)
+{
+    if (cpu == this_cpu())
+    {
+        cpu->run_queue.need_resched = true;
+        return;
+    }
+
+    if (cpu->online)
+    {
+        lapic_send_ipi(cpu->apic_id, ICR_FIXED | SCHED_IPI_VECTOR);
+    }
+}
+
+void cmd_cpus(const char *args)
+{
+    (void)args;
+
+    terminal_writeall("\n=== CPUs (%d online) ===\n", cpu_count);
+
+    for (int i = 0; i < cpu_count; i++)
+    {
+        CPU *cpu = &cpus[i];
+        Task *current = cpu->current;
+
+        terminal_writeall("CPU%d  apic %u  usage %d%%  queued %d  running %s\n",
+                          i, cpu->apic_id, sched_cpu_usage_of(i),
+                          cpu->run_queue.count, current ? current->name : "-");
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "acpi.h"
+#include "sched.h"
+
+#define MAX_CPUS ACPI_MAX_CPUS
+#define AP_STACK_SIZE 16384
+#define SMP_TRAMPOLINE_ADDR 0x8000
+
+typedef struct CPU
+{
+    int index;
+    uint8_t apic_id;
+    volatile bool online;
+    Task *current;
+    Task *idle;
+    Task *prev;
+    uint64_t slice_end_us;
+    uint64_t account_us;
+    bool timer_ready;
+    RunQueue run_queue;
+} CPU;
+
+void smp_init(void);
+int smp_cpu_count(void);
+CPU *smp_get_cpu(int index);
+CPU *this_cpu(void);
+void smp_send_resched(CPU *cpu);
+
+void cmd_cpus(const char *args);
+
+#endif
@@ -0,0 +1,165 @@
+#include "strbench.h"
+#include "string_utils.h"
+#include "cpu.h"
+#include "vga.h"
+
+#define BENCH_MAX_LEN 512
+#define BENCH_BYTES 2000000
+
+/* The byte-at-a-time versions the word routines replaced, kept as the
+   baseline to measure against. */
+static size_t ref_strlen(const char *str)
+{
+    size_t len = 0;
+    while (str[len])
+        len++;
+    return len;
+}
+
+static int ref_strcmp(const char *str1, const char *str2)
+{
+    while (*str1 && (*str1 == *str2))
+    {
+        str1++;
+        str2++;
+    }
+    return *(const unsigned char *)str1 - *(const unsigned char *)str2;
+}
+
+static int ref_strncmp(const char *str1, const char *str2, size_t n)
+{
+    while (n && *str1 && (*str1 == *str2))
+    {
+        str1++;
+        str2++;
+        n--;
+    }
+    if (n == 0)
+        return 0;
+    return *(const unsigned char *)str1 - *(const unsigned char *)str2;
+}
+
+static char *ref_strchr(const char *str, int c)
+{
+    while (*str)
+    {
+        if (*str == c)
+            return (char *)str;
+        str++;
+    }
+    return NULL;
+}
+
+typedef enum
+{
+    BENCH_STRLEN,
+    BENCH_STRCMP,
+    BENCH_STRNCMP,
+    BENCH_STRCHR
+} BenchOp;
+
+static const char *op_names[] = {"strlen", "strcmp", "strncmp", "strchr"};
+static const int bench_lengths[] = {8, 64, 512};
+
+static char buf_a[BENCH_MAX_LEN + 8];
+static char buf_b[BENCH_MAX_LEN + 8];
+static volatile uint32_t bench_sink;
+
+static uint32_t run_op(BenchOp op, bool reference, const char *a, const char *b, int len)
+{
+    switch (op)
+    {
+    case BENCH_STRLEN:
+        return reference ? ref_strlen(a) : strlen(a);
+    case BENCH_STRCMP:
+        return reference ? ref_strcmp(a, b) : strcmp(a, b);
+    case BENCH_STRNCMP:
+        return reference ? ref_strncmp(a, b, len) : strncmp(a, b, len);
+    case BENCH_STRCHR:
+        return (uint32_t)(reference ? ref_strchr(a, '#') : strchr(a, '#'));
+    }
+    return 0;
+}
+
+static uint32_t time_op(BenchOp op, bool reference, const char *a, const char *b, int len, uint32_t iterations)
+{
+    uint64_t start = rdtsc();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        bench_sink += run_op(op, reference, a, b, len);
+    }
+
+    return (uint32_t)div64_32(rdtsc() - start, iterations);
+}
+
+/* Compares the word routines with the byte baseline across alignments. */
+static bool self_check(void)
+{
+    for (int len = 0; len < 40; len++)
+    {
+        for (int off = 0; off < 4; off++)
+        {
+            char *a = buf_a + off;
+            char *b = buf_b + ((off + len) & 3);
+
+            for (int i = 0; i < len; i++)
+            {
+                a[i] = b[i] = 'a' + (i % 26);
+            }
+            a[len] = b[len] = '\0';
+
+            if (strlen(a) != ref_strlen(a) || strcmp(a, b) != 0 ||
+                strchr(a, 'c') != ref_strchr(a, 'c'))
+                return false;
+
+            if (len)
+            {
+                b[len / 2] = 'Z';
+                if ((strcmp(a, b) > 0) != (ref_strcmp(a, b) > 0) ||
+                    (strncmp(a, b, len / 2) != 0) ||
+                    (strncmp(a, b, len) > 0) != (ref_strncmp(a, b, len) > 0))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+void cmd_strbench(const char *args)
+{
+    (void)args;
+
+    if (!cpu_has(CPU_FEATURE_TSC))
+    {
+        terminal_writestring("\nstrbench needs a CPU with a TSC\n");
+        return;
+    }
+
+    terminal_writestring("\n=== String benchmark (cycles per call) ===\n");
+    terminal_writeall("Self check: %s\n", self_check() ? "ok" : "MISMATCH");
+    terminal_writestring("byte loop -> word-at-a-time\n");
+
+    for (int op = BENCH_STRLEN; op <= BENCH_STRCHR; op++)
+    {
+        for (int l = 0; l < 3; l++)
+        {
+            int len = bench_lengths[l];
+            uint32_t iterations = BENCH_BYTES / len;
+
+            /* Misaligned by one to exercise the unaligned head. */
+            char *a = buf_a + 1;
+            char *b = buf_b + 2;
+            memset(a, 'x', len);
+            memset(b, 'x', len);
+            a[len] = b[len] = '\0';
+            a[len - 1] = '#';
+            b[len - 1] = '#';
+
+            uint32_t old_cycles = time_op(op, true, a, b, len, iterations);
+            uint32_t new_cycles = time_op(op, false, a, b, len, iterations);
+
+            terminal_writeall("%s %d bytes: %u -> %u\n", op_names[op], len, old_cycles, new_cycles);
+        }
+    }
+}
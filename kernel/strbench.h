@@ -0,0 +1,6 @@
+#ifndef STRBENCH_H
+#define STRBENCH_H
+
+void cmd_strbench(const char *args);
+
+#endif
@@ -1,12 +1,40 @@
 #include "string_utils.h"
+#include "cpu.h"
+#include "isr.h"
 #include <stdint.h>
 
+/*
+ * The str* routines below read a 32-bit word at a time.  Aligned words
+ * never cross a page, so reading past the terminator is safe; the second
+ * string of a compare may be misaligned, and then a word is only read
+ * when it stays inside its page.
+ */
+typedef uint32_t __attribute__((may_alias)) mem_word_t;
+
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+#define PAGE_TAIL(p) (((uint32_t)(p) & 0xFFF) > 0xFFC)
+
 size_t strlen(const char *str)
 {
-    size_t len = 0;
-    while (str[len])
-        len++;
-    return len;
+    const char *p = str;
+
+    while ((uint32_t)p & 3)
+    {
+        if (!*p)
+            return p - str;
+        p++;
+    }
+
+    const mem_word_t *w = (const mem_word_t *)p;
+    while (!HAS_ZERO(*w))
+        w++;
+
+    p = (const char *)w;
+    while (*p)
+        p++;
+    return p - str;
 }
 
 char *strcpy(char *dest, const char *src)
@@ -27,32 +55,106 @@ char *strcat(char *dest, const char *src)
 
 int strcmp(const char *str1, const char *str2)
 {
-    while (*str1 && (*str1 == *str2))
+    const unsigned char *s1 = (const unsigned char *)str1;
+    const unsigned char *s2 = (const unsigned char *)str2;
+
+    while ((uint32_t)s1 & 3)
+    {
+        if (!*s1 || *s1 != *s2)
+            return *s1 - *s2;
+        s1++;
+        s2++;
+    }
+
+    for (;;)
+    {
+        if (PAGE_TAIL(s2))
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                if (!*s1 || *s1 != *s2)
+                    return *s1 - *s2;
+                s1++;
+                s2++;
+            }
+            continue;
+        }
+
+        uint32_t w = *(const mem_word_t *)s1;
+        if (w != *(const mem_word_t *)s2 || HAS_ZERO(w))
+            break;
+        s1 += 4;
+        s2 += 4;
+    }
+
+    while (*s1 && *s1 == *s2)
     {
-        str1++;
-        str2++;
+        s1++;
+        s2++;
     }
-    return *(const unsigned char *)str1 - *(const unsigned char *)str2;
+    return *s1 - *s2;
 }
 
 int strncmp(const char *str1, const char *str2, size_t n)
 {
-    while (n && *str1 && (*str1 == *str2))
+    const unsigned char *s1 = (const unsigned char *)str1;
+    const unsigned char *s2 = (const unsigned char *)str2;
+
+    while (n && ((uint32_t)s1 & 3))
     {
-        str1++;
-        str2++;
+        if (!*s1 || *s1 != *s2)
+            return *s1 - *s2;
+        s1++;
+        s2++;
+        n--;
+    }
+
+    while (n >= 4 && !PAGE_TAIL(s2))
+    {
+        uint32_t w = *(const mem_word_t *)s1;
+        if (w != *(const mem_word_t *)s2 || HAS_ZERO(w))
+            break;
+        s1 += 4;
+        s2 += 4;
+        n -= 4;
+    }
+
+    while (n && *s1 && *s1 == *s2)
+    {
+        s1++;
+        s2++;
         n--;
     }
     if (n == 0)
         return 0;
-    return *(const unsigned char *)str1 - *(const unsigned char *)str2;
+    return *s1 - *s2;
 }
 
 char *strchr(const char *str, int c)
 {
+    char ch = (char)c;
+
+    if (!ch)
+        return NULL;
+
+    while ((uint32_t)str & 3)
+    {
+        if (!*str)
+            return NULL;
+        if (*str == ch)
+            return (char *)str;
+        str++;
+    }
+
+    uint32_t mask = (uint8_t)ch * ONES;
+    const mem_word_t *w = (const mem_word_t *)str;
+    while (!HAS_ZERO(*w) && !HAS_ZERO(*w ^ mask))
+        w++;
+
+    str = (const char *)w;
     while (*str)
     {
-        if (*str == c)
+        if (*str == ch)
             return (char *)str;
         str++;
     }
@@ -91,27 +193,62 @@ char *strtok(char *str, const char *delim)
     return token;
 }
 
-void *memset(void *ptr, int value, size_t num)
-{
-    unsigned char *p = ptr;
-    while (num--)
-        *p++ = (unsigned char)value;
-    return ptr;
-}
-
-void *memcpy(void *dest, const void *src, size_t num)
+/*
+ * mem* pick an implementation by size and CPU features.  Short runs use
+ * word loops, since rep and SSE setup cost more than they save there.
+ * Longer runs dispatch through the pointers below, which
+ * string_select_impl() points at SSE2, rep movsd/stosd or ERMS code.
+ * Forward copies must stay correct for overlapping buffers with
+ * dest < src, which memmove relies on.
+ */
+#define MEM_SMALL 64
+#define MEM_ERMS_MIN 512
+#define MEM_SSE_CHUNK 4096
+
+static void *memcpy_small(void *dest, const void *src, size_t num)
 {
     unsigned char *d = dest;
     const unsigned char *s = src;
+
+    while (num >= 4)
+    {
+        *(mem_word_t *)d = *(const mem_word_t *)s;
+        d += 4;
+        s += 4;
+        num -= 4;
+    }
     while (num--)
         *d++ = *s++;
     return dest;
 }
 
-int memcmp(const void *ptr1, const void *ptr2, size_t num)
+static void *memset_small(void *ptr, int value, size_t num)
+{
+    unsigned char *p = ptr;
+    uint32_t pattern = (uint8_t)value * ONES;
+
+    while (num >= 4)
+    {
+        *(mem_word_t *)p = pattern;
+        p += 4;
+        num -= 4;
+    }
+    while (num--)
+        *p++ = (unsigned char)value;
+    return ptr;
+}
+
+static int memcmp_small(const void *ptr1, const void *ptr2, size_t num)
 {
     const unsigned char *p1 = ptr1;
     const unsigned char *p2 = ptr2;
+
+    while (num >= 4 && *(const mem_word_t *)p1 == *(const mem_word_t *)p2)
+    {
+        p1 += 4;
+        p2 += 4;
+        num -= 4;
+    }
     while (num--)
     {
         if (*p1 != *p2)
@@ -122,6 +259,281 @@ int memcmp(const void *ptr1, const void *ptr2, size_t num)
     return 0;
 }
 
+static void memset16_words(void *ptr, uint16_t value, size_t count)
+{
+    uint16_t *p = ptr;
+    while (count--)
+        *p++ = value;
+}
+
+static void *memset_stosd(void *ptr, int value, size_t num)
+{
+    void *dest = ptr;
+    uint32_t pattern = (uint8_t)value * ONES;
+    size_t dwords = num >> 2;
+
+    __asm__ volatile("rep stosl\n\t"
+                     "mov %3, %%ecx\n\t"
+                     "rep stosb"
+                     : "+D"(dest), "+c"(dwords)
+                     : "a"(pattern), "r"(num & 3)
+                     : "memory");
+    return ptr;
+}
+
+static void *memcpy_movsd(void *dest, const void *src, size_t num)
+{
+    void *d = dest;
+    size_t dwords = num >> 2;
+
+    __asm__ volatile("rep movsl\n\t"
+                     "mov %3, %%ecx\n\t"
+                     "rep movsb"
+                     : "+D"(d), "+S"(src), "+c"(dwords)
+                     : "r"(num & 3)
+                     : "memory");
+    return dest;
+}
+
+static void memset16_stosd(void *ptr, uint16_t value, size_t count)
+{
+    uint32_t pattern = value | ((uint32_t)value << 16);
+    size_t dwords = count >> 1;
+
+    __asm__ volatile("rep stosl\n\t"
+                     "test $1, %3\n\t"
+                     "jz 1f\n\t"
+                     "stosw\n"
+                     "1:"
+                     : "+D"(ptr), "+c"(dwords)
+                     : "a"(pattern), "r"(count)
+                     : "memory", "cc");
+}
+
+/* Enhanced REP MOVSB/STOSB: the microcode picks the widest moves itself. */
+static void *memset_erms(void *ptr, int value, size_t num)
+{
+    void *dest = ptr;
+
+    __asm__ volatile("rep stosb"
+                     : "+D"(dest), "+c"(num)
+                     : "a"(value)
+                     : "memory");
+    return ptr;
+}
+
+static void *memcpy_erms(void *dest, const void *src, size_t num)
+{
+    void *d = dest;
+
+    __asm__ volatile("rep movsb"
+                     : "+D"(d), "+S"(src), "+c"(num)
+                     :
+                     : "memory");
+    return dest;
+}
+
+/*
+ * Interrupt handlers may call mem* too, and xmm registers are not part of
+ * the interrupt frame, so SSE runs in interrupts-off stretches of at most
+ * MEM_SSE_CHUNK bytes and never leaves live state behind.  The kernel is
+ * built without SSE code generation, so the xmm registers used here need
+ * no clobbers.
+ */
+static void *memcpy_sse2(void *dest, const void *src, size_t num)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+
+    while (num >= 64)
+    {
+        size_t chunk = num > MEM_SSE_CHUNK ? MEM_SSE_CHUNK : (num & ~(size_t)63);
+        size_t blocks = chunk / 64;
+        uint32_t flags = irq_save();
+
+        __asm__ volatile("1:\n\t"
+                         "movdqu (%1), %%xmm0\n\t"
+                         "movdqu 16(%1), %%xmm1\n\t"
+                         "movdqu 32(%1), %%xmm2\n\t"
+                         "movdqu 48(%1), %%xmm3\n\t"
+                         "movdqu %%xmm0, (%0)\n\t"
+                         "movdqu %%xmm1, 16(%0)\n\t"
+                         "movdqu %%xmm2, 32(%0)\n\t"
+                         "movdqu %%xmm3, 48(%0)\n\t"
+                         "add $64, %0\n\t"
+                         "add $64, %1\n\t"
+                         "dec %2\n\t"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(s), "+r"(blocks)
+                         :
+                         : "cc", "memory");
+
+        irq_restore(flags);
+        num -= chunk;
+    }
+
+    memcpy_small(d, s, num);
+    return dest;
+}
+
+static void *memset_sse2(void *ptr, int value, size_t num)
+{
+    unsigned char *p = ptr;
+    uint32_t pattern = (uint8_t)value * ONES;
+
+    while (num >= 64)
+    {
+        size_t chunk = num > MEM_SSE_CHUNK ? MEM_SSE_CHUNK : (num & ~(size_t)63);
+        size_t blocks = chunk / 64;
+        uint32_t flags = irq_save();
+
+        __asm__ volatile("movd %2, %%xmm0\n\t"
+                         "pshufd $0, %%xmm0, %%xmm0\n"
+                         "1:\n\t"
+                         "movdqu %%xmm0, (%0)\n\t"
+                         "movdqu %%xmm0, 16(%0)\n\t"
+                         "movdqu %%xmm0, 32(%0)\n\t"
+                         "movdqu %%xmm0, 48(%0)\n\t"
+                         "add $64, %0\n\t"
+                         "dec %1\n\t"
+                         "jnz 1b"
+                         : "+r"(p), "+r"(blocks)
+                         : "r"(pattern)
+                         : "cc", "memory");
+
+        irq_restore(flags);
+        num -= chunk;
+    }
+
+    memset_small(p, value, num);
+    return ptr;
+}
+
+static int memcmp_sse2(const void *ptr1, const void *ptr2, size_t num)
+{
+    const unsigned char *p1 = ptr1;
+    const unsigned char *p2 = ptr2;
+
+    while (num >= 16)
+    {
+        size_t blocks = (num > MEM_SSE_CHUNK ? MEM_SSE_CHUNK : num) / 16;
+        size_t left = blocks;
+        uint32_t flags = irq_save();
+
+        __asm__ volatile("1:\n\t"
+                         "movdqu (%0), %%xmm0\n\t"
+                         "movdqu (%1), %%xmm1\n\t"
+                         "pcmpeqb %%xmm1, %%xmm0\n\t"
+                         "pmovmskb %%xmm0, %%eax\n\t"
+                         "cmp $0xFFFF, %%eax\n\t"
+                         "jne 2f\n\t"
+                         "add $16, %0\n\t"
+                         "add $16, %1\n\t"
+                         "dec %2\n\t"
+                         "jnz 1b\n"
+                         "2:"
+                         : "+r"(p1), "+r"(p2), "+r"(left)
+                         :
+                         : "eax", "cc", "memory");
+
+        irq_restore(flags);
+
+        /* Stopped early: the difference is inside the next 16 bytes. */
+        if (left)
+            return memcmp_small(p1, p2, 16);
+        num -= blocks * 16;
+    }
+
+    return memcmp_small(p1, p2, num);
+}
+
+static void *(*memset_mid)(void *, int, size_t) = memset_small;
+static void *(*memset_large)(void *, int, size_t) = memset_small;
+static void *(*memcpy_mid)(void *, const void *, size_t) = memcpy_small;
+static void *(*memcpy_large)(void *, const void *, size_t) = memcpy_small;
+static int (*memcmp_mid)(const void *, const void *, size_t) = memcmp_small;
+static void (*memset16_impl)(void *, uint16_t, size_t) = memset16_words;
+static const char *impl_name = "word loops";
+
+void string_select_impl(void)
+{
+    cpu_detect();
+
+    bool sse2 = cpu_sse_enabled() && cpu_has(CPU_FEATURE_SSE2);
+    bool erms = cpu_has(CPU_FEATURE_ERMS);
+
+    memset_mid = sse2 ? memset_sse2 : memset_stosd;
+    memcpy_mid = sse2 ? memcpy_sse2 : memcpy_movsd;
+    memcmp_mid = sse2 ? memcmp_sse2 : memcmp_small;
+    memset_large = erms ? memset_erms : memset_mid;
+    memcpy_large = erms ? memcpy_erms : memcpy_mid;
+    memset16_impl = memset16_stosd;
+
+    if (sse2 && erms)
+        impl_name = "SSE2, rep movsb/stosb (ERMS) from 512 B";
+    else if (sse2)
+        impl_name = "SSE2";
+    else if (erms)
+        impl_name = "rep movsd/stosd, rep movsb/stosb (ERMS) from 512 B";
+    else
+        impl_name = "rep movsd/stosd";
+}
+
+const char *string_impl_name(void)
+{
+    return impl_name;
+}
+
+void *memset(void *ptr, int value, size_t num)
+{
+    if (num < MEM_SMALL)
+        return memset_small(ptr, value, num);
+    if (num < MEM_ERMS_MIN)
+        return memset_mid(ptr, value, num);
+    return memset_large(ptr, value, num);
+}
+
+void *memcpy(void *dest, const void *src, size_t num)
+{
+    if (num < MEM_SMALL)
+        return memcpy_small(dest, src, num);
+    if (num < MEM_ERMS_MIN)
+        return memcpy_mid(dest, src, num);
+    return memcpy_large(dest, src, num);
+}
+
+void *memmove(void *dest, const void *src, size_t num)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+
+    if (d <= s || d >= s + num)
+        return memcpy(dest, src, num);
+
+    /* Overlap with dest above src: copy from the end, a word at a time. */
+    while (num >= 4)
+    {
+        num -= 4;
+        *(mem_word_t *)(d + num) = *(const mem_word_t *)(s + num);
+    }
+    while (num--)
+        d[num] = s[num];
+    return dest;
+}
+
+/* Fills count 16-bit cells, e.g. VGA text attributes and characters. */
+void memset16(void *ptr, uint16_t value, size_t count)
+{
+    memset16_impl(ptr, value, count);
+}
+
+int memcmp(const void *ptr1, const void *ptr2, size_t num)
+{
+    if (num < MEM_SMALL)
+        return memcmp_small(ptr1, ptr2, num);
+    return memcmp_mid(ptr1, ptr2, num);
+}
+
 int atoi(const char *str)
 {
     int result = 0;
@@ -15,7 +15,12 @@ char *strtok(char *str, const char *delim);
 
 void *memset(void *ptr, int value, size_t num);
 void *memcpy(void *dest, const void *src, size_t num);
+void *memmove(void *dest, const void *src, size_t num);
 int memcmp(const void *ptr1, const void *ptr2, size_t num);
+void memset16(void *ptr, uint16_t value, size_t count);
+
+void string_select_impl(void);
+const char *string_impl_name(void);
 
 int atoi(const char *str);
 char *itoa(int value, char *str, int base);
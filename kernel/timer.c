@@ -0,0 +1,248 @@
+#include "timer.h"
+#include "isr.h"
+#include "ports.h"
+#include "apic.h"
+#include "cpu.h"
+#include "smp.h"
+#include "sched.h"
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+
+#define LAPIC_DIVIDE_BY_16 0x3
+#define LVT_MASKED 0x10000
+#define LVT_TIMER_ONESHOT 0x00000
+#define LVT_TIMER_TSC_DEADLINE 0x40000
+#define IA32_TSC_DEADLINE 0x6E0
+
+#define CALIBRATE_MS 50
+#define MAX_ONESHOT_US 1000000
+#define SPIN_SLEEP_US 50
+
+static volatile uint32_t timer_ticks = 0;
+static TimerMode timer_mode = TIMER_MODE_PIT;
+
+static bool tsc_ready = false;
+static uint64_t tsc_base = 0;
+static uint32_t tsc_khz = 0;
+static uint32_t tsc_us_mult = 0;
+static uint32_t lapic_khz = 0;
+
+static const char *mode_names[] = {
+    "PIT periodic", "LAPIC one-shot", "TSC-deadline"};
+
+static void timer_callback(registers_t *regs)
+{
+    (void)regs;
+
+    timer_ticks++;
+    sched_tick();
+}
+
+void timer_init(void)
+{
+    uint32_t divisor = PIT_FREQUENCY / TIMER_HZ;
+
+    outb(PIT_COMMAND, 0x36);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+    irq_install_handler(IRQ0, timer_callback);
+}
+
+/*
+ * Counts TSC cycles and LAPIC timer ticks across CALIBRATE_MS PIT
+ * interrupts.  Needs IRQ0 running and interrupts enabled.
+ */
+static void timer_calibrate(void)
+{
+    uint32_t start = timer_ticks;
+    while (timer_ticks == start)
+    {
+        __asm__ volatile("pause");
+    }
+
+    if (lapic_available())
+    {
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_BY_16);
+        lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+        lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    }
+
+    uint64_t tsc_start = rdtsc();
+    start = timer_ticks;
+    while (timer_ticks - start < CALIBRATE_MS)
+    {
+        __asm__ volatile("pause");
+    }
+    uint64_t tsc_elapsed = rdtsc() - tsc_start;
+
+    if (lapic_available())
+    {
+        lapic_khz = (0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT)) / CALIBRATE_MS;
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+    }
+
+    tsc_khz = (uint32_t)div64_32(tsc_elapsed, CALIBRATE_MS);
+}
+
+/*
+ * Moves timekeeping to the TSC and, with a local APIC, scheduling to
+ * per-CPU one-shot timers.  The PIT interrupt is switched off afterwards,
+ * so idle CPUs only wake for real events.
+ */
+void timer_enable_lapic(void)
+{
+    if (tsc_ready || !cpu_has(CPU_FEATURE_TSC))
+        return;
+
+    timer_calibrate();
+    if (tsc_khz < 1000)
+        return;
+
+    /* A TSC that follows P-states drifts; hypervisors keep theirs constant. */
+    if (!cpu_has(CPU_FEATURE_INVARIANT_TSC) && !cpu_has(CPU_FEATURE_HYPERVISOR))
+        return;
+
+    uint32_t flags = irq_save();
+
+    /* us = tsc * 1000 / khz, done as a 32.32 fixed point multiply. */
+    tsc_us_mult = (uint32_t)div64_32(1000ULL << 32, tsc_khz);
+    tsc_base = rdtsc() - div64_32((uint64_t)(timer_ticks * (1000000 / TIMER_HZ)) * tsc_khz, 1000);
+    tsc_ready = true;
+
+    if (lapic_available() && lapic_khz)
+    {
+        timer_mode = cpu_has(CPU_FEATURE_TSC_DEADLINE) ? TIMER_MODE_TSC_DEADLINE : TIMER_MODE_LAPIC;
+        irq_uninstall_handler(IRQ0);
+    }
+
+    irq_restore(flags);
+
+    /* Every CPU arms its own timer on its next pass through the scheduler. */
+    if (timer_mode != TIMER_MODE_PIT)
+    {
+        for (int i = 1; i < smp_cpu_count(); i++)
+        {
+            smp_send_resched(smp_get_cpu(i));
+        }
+        sched_yield();
+    }
+}
+
+TimerMode timer_get_mode(void)
+{
+    return timer_mode;
+}
+
+const char *timer_mode_name(void)
+{
+    return mode_names[timer_mode];
+}
+
+bool timer_is_tickless(void)
+{
+    return timer_mode != TIMER_MODE_PIT;
+}
+
+uint32_t timer_get_tsc_khz(void)
+{
+    return tsc_khz;
+}
+
+uint64_t timer_get_us(void)
+{
+    if (!tsc_ready)
+        return (uint64_t)timer_ticks * (1000000 / TIMER_HZ);
+
+    uint64_t delta = rdtsc() - tsc_base;
+    uint32_t high = delta >> 32;
+    uint32_t low = (uint32_t)delta;
+
+    return (uint64_t)high * tsc_us_mult + (((uint64_t)low * tsc_us_mult) >> 32);
+}
+
+uint32_t timer_get_ticks(void)
+{
+    if (!tsc_ready)
+        return timer_ticks;
+
+    return (uint32_t)div64_32(timer_get_us(), 1000000 / TIMER_HZ);
+}
+
+uint32_t timer_get_uptime_seconds(void)
+{
+    return (uint32_t)div64_32(timer_get_us(), 1000000);
+}
+
+void timer_sleep_ms(uint32_t ms)
+{
+    task_sleep_us(ms * 1000);
+}
+
+/* Very short waits spin; everything else sleeps on a timer deadline. */
+void timer_sleep_us(uint32_t us)
+{
+    bool coarse = !timer_is_tickless() && us < 1000000 / TIMER_HZ;
+
+    if (tsc_ready && (us < SPIN_SLEEP_US || coarse))
+    {
+        uint64_t end = timer_get_us() + us;
+        while (timer_get_us() < end)
+        {
+            __asm__ volatile("pause");
+        }
+        return;
+    }
+
+    task_sleep_us(us);
+}
+
+/* Programs this CPU's timer to fire at deadline_us.  Interrupts must be off. */
+void timer_arm(uint64_t deadline_us)
+{
+    if (timer_mode == TIMER_MODE_PIT)
+        return;
+
+    CPU *cpu = this_cpu();
+    uint32_t lvt = timer_mode == TIMER_MODE_TSC_DEADLINE ? LVT_TIMER_TSC_DEADLINE : LVT_TIMER_ONESHOT;
+
+    if (!cpu->timer_ready)
+    {
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_BY_16);
+        lapic_write(LAPIC_LVT_TIMER, lvt | LAPIC_TIMER_VECTOR);
+        __asm__ volatile("mfence" : : : "memory");
+        cpu->timer_ready = true;
+    }
+
+    uint64_t now = timer_get_us();
+    uint32_t delta = 1;
+
+    if (deadline_us > now)
+    {
+        delta = deadline_us - now > MAX_ONESHOT_US ? MAX_ONESHOT_US : (uint32_t)(deadline_us - now);
+    }
+
+    if (timer_mode == TIMER_MODE_TSC_DEADLINE)
+    {
+        wrmsr(IA32_TSC_DEADLINE, rdtsc() + div64_32((uint64_t)delta * tsc_khz, 1000));
+    }
+    else
+    {
+        uint32_t count = (uint32_t)div64_32((uint64_t)delta * lapic_khz, 1000);
+        lapic_write(LAPIC_TIMER_INITIAL, count ? count : 1);
+    }
+}
+
+void timer_disarm(void)
+{
+    if (timer_mode == TIMER_MODE_TSC_DEADLINE)
+    {
+        wrmsr(IA32_TSC_DEADLINE, 0);
+    }
+    else if (timer_mode == TIMER_MODE_LAPIC)
+    {
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+    }
+}
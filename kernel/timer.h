@@ -0,0 +1,33 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_HZ 1000
+#define TIMER_NO_DEADLINE 0xFFFFFFFFFFFFFFFFULL
+
+typedef enum
+{
+    TIMER_MODE_PIT,
+    TIMER_MODE_LAPIC,
+    TIMER_MODE_TSC_DEADLINE
+} TimerMode;
+
+void timer_init(void);
+void timer_enable_lapic(void);
+TimerMode timer_get_mode(void);
+const char *timer_mode_name(void);
+bool timer_is_tickless(void);
+uint32_t timer_get_tsc_khz(void);
+
+uint64_t timer_get_us(void);
+uint32_t timer_get_ticks(void);
+uint32_t timer_get_uptime_seconds(void);
+void timer_sleep_ms(uint32_t ms);
+void timer_sleep_us(uint32_t us);
+
+void timer_arm(uint64_t deadline_us);
+void timer_disarm(void);
+
+#endif
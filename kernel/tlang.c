@@ -2,6 +2,7 @@
 #include "../kernel/vga.h"
 #include "../kernel/string_utils.h"
 #include "../kernel/ramfs.h"
+#include "../kernel/sched.h"
 #include "../T84_OS/api/kernel_api.h"
 #include "stddef.h"
 #include <stdbool.h>
@@ -13,7 +14,14 @@
 bool keyboard_available(void);
 char keyboard_getchar(void);
 
-static TLANG_Interpreter interpreter;
+static TLANG_Interpreter interpreters[MAX_TASKS];
+
+static TLANG_Interpreter *tlang_current(void)
+{
+    Task *task = task_current();
+
+    return &interpreters[task ? task->slot : 0];
+}
 
 static void tlang_error(const char *msg);
 static void tlang_warning(const char *msg);
@@ -50,14 +58,16 @@ static void process_random_command(const char **ptr);
 
 void tlang_run_line(const char *line);
 
-static uint32_t rng_state = 123456789;
+#define TLANG_RNG_SEED 123456789
 
 static uint32_t rng_next(void)
 {
-    rng_state ^= rng_state << 13;
-    rng_state ^= rng_state >> 17;
-    rng_state ^= rng_state << 5;
-    return rng_state;
+    uint32_t *state = &tlang_current()->rng_state;
+
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
 }
 
 static void process_seed_command(const char **ptr)
@@ -85,7 +95,7 @@ static void process_seed_command(const char **ptr)
 
     (*ptr)++;
 
-    rng_state = (seed_value == 0) ? 123456789 : (uint32_t)seed_value;
+    tlang_current()->rng_state = (seed_value == 0) ? TLANG_RNG_SEED : (uint32_t)seed_value;
 }
 
 static int random_int(int min, int max)
@@ -98,10 +108,12 @@ static int random_int(int min, int max)
 
 static void tlang_error(const char *msg)
 {
+    TLANG_Interpreter *interp = tlang_current();
+
     terminal_writestring("[TLANG ERROR] ");
     terminal_writestring(msg);
     terminal_writestring("\n");
-    interpreter.had_error = true;
+    interp->had_error = true;
 }
 
 static void process_random_command(const char **ptr)
@@ -140,9 +152,9 @@ static void process_random_command(const char **ptr)
                 if (string_count < 20)
                 {
 
-                    static char string_buffer[20][256];
-                    strcpy(string_buffer[string_count], str);
-                    strings[string_count] = string_buffer[string_count];
+                    char *slot = tlang_current()->random_strings[string_count];
+                    strcpy(slot, str);
+                    strings[string_count] = slot;
                     string_count++;
                 }
                 else
@@ -212,7 +224,7 @@ static void process_random_command(const char **ptr)
                 return;
             }
 
-            static char result_buffer[256];
+            char *result_buffer = tlang_current()->random_result;
             strcpy(result_buffer, strings[index]);
             var->value.str_value = result_buffer;
         }
@@ -370,11 +382,13 @@ static char *simple_strstr(const char *haystack, const char *needle)
 
 static TLANG_Variable *find_variable(const char *name)
 {
-    for (int i = 0; i < interpreter.var_count; i++)
+    TLANG_Interpreter *interp = tlang_current();
+
+    for (int i = 0; i < interp->var_count; i++)
     {
-        if (strcmp(interpreter.variables[i].name, name) == 0)
+        if (strcmp(interp->variables[i].name, name) == 0)
         {
-            return &interpreter.variables[i];
+            return &interp->variables[i];
         }
     }
     return NULL;
@@ -382,13 +396,15 @@ static TLANG_Variable *find_variable(const char *name)
 
 static TLANG_Variable *create_variable(const char *name, TLANG_Type type)
 {
-    if (interpreter.var_count >= 100)
+    TLANG_Interpreter *interp = tlang_current();
+
+    if (interp->var_count >= 100)
     {
         tlang_error("Too many variables");
         return NULL;
     }
 
-    TLANG_Variable *var = &interpreter.variables[interpreter.var_count++];
+    TLANG_Variable *var = &interp->variables[interp->var_count++];
     strcpy(var->name, name);
     var->type = type;
 
@@ -434,7 +450,7 @@ static int parse_int_expression(const char **ptr)
 
 static char *parse_string_literal(const char **ptr)
 {
-    static char buffer[256];
+    char *buffer = tlang_current()->literal_buffer;
     int i = 0;
 
     if (**ptr != '"')
@@ -1203,7 +1219,7 @@ static void process_schar_declaration(const char **ptr)
 
     if (var)
     {
-        static char string_buffer[256];
+        char *string_buffer = tlang_current()->schar_buffer;
         strcpy(string_buffer, value);
         var->value.str_value = string_buffer;
     }
@@ -1456,6 +1472,10 @@ static void process_input_command(const char **ptr)
                 terminal_putchar(c);
             }
         }
+        else
+        {
+            sched_wait_input(0);
+        }
     }
 
     input_buffer[pos] = '\0';
@@ -1639,7 +1659,9 @@ static void process_for_loop(const char **ptr)
 
 void tlang_run_line(const char *line)
 {
-    interpreter.line_number++;
+    TLANG_Interpreter *interp = tlang_current();
+
+    interp->line_number++;
     const char *ptr = line;
 
     skip_whitespace(&ptr);
@@ -1668,13 +1690,9 @@ void tlang_run_line(const char *line)
         return;
     }
 
-    static bool skip_mode = false;
-    static int if_depth = 0;
-    static bool else_found = false;
-
     if (strncmp(ptr, "line", 4) == 0 && (ptr[4] == '\0' || is_whitespace(ptr[4]) || ptr[4] == ';' || ptr[4] == '('))
     {
-        if (!skip_mode)
+        if (!interp->skip_mode)
         {
             if (ptr[4] == '(')
             {
@@ -1695,12 +1713,12 @@ void tlang_run_line(const char *line)
         strncmp(ptr, "schar ", 6) == 0 ||
         strncmp(ptr, "bool ", 5) == 0)
     {
-        skip_mode = false;
-        if_depth = 0;
-        else_found = false;
+        interp->skip_mode = false;
+        interp->if_depth = 0;
+        interp->else_found = false;
     }
 
-    if (skip_mode)
+    if (interp->skip_mode)
     {
 
         if (strncmp(ptr, "elif ", 5) == 0)
@@ -1716,7 +1734,7 @@ void tlang_run_line(const char *line)
             if (condition_result)
             {
 
-                skip_mode = false;
+                interp->skip_mode = false;
             }
 
             return;
@@ -1724,14 +1742,14 @@ void tlang_run_line(const char *line)
         else if (strncmp(ptr, "else", 4) == 0)
         {
 
-            skip_mode = false;
-            else_found = true;
+            interp->skip_mode = false;
+            interp->else_found = true;
             return;
         }
         else if (strncmp(ptr, "if ", 3) == 0)
         {
 
-            if_depth++;
+            interp->if_depth++;
         }
 
         return;
@@ -1786,9 +1804,9 @@ void tlang_run_line(const char *line)
         if (!condition_result)
         {
 
-            skip_mode = true;
-            if_depth = 1;
-            else_found = false;
+            interp->skip_mode = true;
+            interp->if_depth = 1;
+            interp->else_found = false;
         }
 
         return;
@@ -1806,12 +1824,12 @@ void tlang_run_line(const char *line)
         if (!condition_result)
         {
 
-            skip_mode = true;
+            interp->skip_mode = true;
         }
         else
         {
 
-            skip_mode = false;
+            interp->skip_mode = false;
         }
         return;
     }
@@ -1823,8 +1841,8 @@ void tlang_run_line(const char *line)
         if (*ptr == ':')
             ptr++;
 
-        skip_mode = false;
-        else_found = true;
+        interp->skip_mode = false;
+        interp->else_found = true;
         return;
     }
     else if (strncmp(ptr, "for ", 4) == 0)
@@ -1888,13 +1906,14 @@ void tlang_run_line(const char *line)
     char error_msg[64];
     strcpy(error_msg, "Unknown command at line ");
     char line_num[8];
-    itoa(interpreter.line_number, line_num, 10);
+    itoa(interp->line_number, line_num, 10);
     strcat(error_msg, line_num);
     tlang_error(error_msg);
 }
 
 void tlang_run_file(const char *filename)
 {
+    TLANG_Interpreter *interp = tlang_current();
     File *file = fs_find_file(filename);
 
     if (!file || file->type != 'F')
@@ -1909,40 +1928,21 @@ void tlang_run_file(const char *filename)
     terminal_writestring(filename);
     terminal_writestring(" ===\n\n");
 
-    interpreter.var_count = 0;
-    interpreter.line_number = 0;
-    interpreter.had_error = false;
+    interp->var_count = 0;
+    interp->line_number = 0;
+    interp->had_error = false;
 
-    char *content = file->content;
+    char line[256];
     int pos = 0;
-    int line_start = 0;
 
-    while (pos < file->size)
+    while (fs_read_line(file, &pos, line, sizeof(line)) >= 0)
     {
-        if (content[pos] == '\n' || pos == file->size - 1)
-        {
-            int line_len = pos - line_start;
-            if (pos == file->size - 1 && content[pos] != '\n')
-                line_len++;
-
-            char line[256];
-            int i;
-            for (i = 0; i < line_len && i < 255; i++)
-            {
-                line[i] = content[line_start + i];
-            }
-            line[i] = '\0';
-
-            tlang_run_line(line);
-
-            line_start = pos + 1;
-        }
-        pos++;
+        tlang_run_line(line);
     }
 
     terminal_writestring("\n=== ");
 
-    if (interpreter.had_error)
+    if (interp->had_error)
     {
         terminal_writestring("Finished with errors ===\n");
     }
@@ -1954,14 +1954,90 @@ void tlang_run_file(const char *filename)
 
 void tlang_init(void)
 {
-    interpreter.var_count = 0;
-    interpreter.line_number = 0;
-    interpreter.had_error = false;
+    TLANG_Interpreter *interp = tlang_current();
+
+    interp->var_count = 0;
+    interp->line_number = 0;
+    interp->had_error = false;
+    interp->skip_mode = false;
+    interp->if_depth = 0;
+    interp->else_found = false;
+    interp->rng_state = TLANG_RNG_SEED;
 }
 
 void tlang_cleanup(void)
 {
-    interpreter.var_count = 0;
+    TLANG_Interpreter *interp = tlang_current();
+
+    interp->var_count = 0;
+}
+
+#define TLANG_MAX_PARALLEL 8
+
+static bool tlang_has_extension(const char *filename)
+{
+    int len = strlen(filename);
+    return len >= 3 && filename[len - 2] == '.' && filename[len - 1] == 'T';
+}
+
+static void tlang_task_entry(void *arg)
+{
+    tlang_init();
+    tlang_run_file((const char *)arg);
+    tlang_cleanup();
+}
+
+/*
+ * Runs every listed script in its own batch task; the scheduler spreads
+ * them over the available CPUs.  Returns once all of them have finished.
+ */
+static void tlang_run_parallel(const char *args)
+{
+    char names[TLANG_MAX_PARALLEL][64];
+    Task *jobs[TLANG_MAX_PARALLEL];
+    int count = 0;
+
+    while (*args && count < TLANG_MAX_PARALLEL)
+    {
+        while (*args == ' ')
+            args++;
+
+        int len = 0;
+        while (*args && *args != ' ' && len < 63)
+        {
+            names[count][len++] = *args++;
+        }
+        names[count][len] = '\0';
+
+        while (*args && *args != ' ')
+            args++;
+
+        if (len == 0)
+            continue;
+
+        if (!tlang_has_extension(names[count]))
+        {
+            terminal_writestring("Error: File must have .T extension: ");
+            terminal_writestring(names[count]);
+            terminal_writestring("\n");
+            continue;
+        }
+        count++;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        jobs[i] = task_create(names[i], tlang_task_entry, names[i], TASK_PRIO_BATCH);
+        if (!jobs[i])
+        {
+            tlang_task_entry(names[i]);
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        task_join(jobs[i]);
+    }
 }
 
 void cmd_tlang(const char *args)
@@ -1972,6 +2048,13 @@ void cmd_tlang(const char *args)
         terminal_writestring("Examples:\n");
         terminal_writestring("  tlang script.T          - Run a .T file\n");
         terminal_writestring("  tlang run int x = 10    - Run single line\n");
+        terminal_writestring("  tlang -p a.T b.T        - Run files in parallel\n");
+        return;
+    }
+
+    if (strncmp(args, "-p ", 3) == 0)
+    {
+        tlang_run_parallel(args + 3);
         return;
     }
 
@@ -1984,8 +2067,7 @@ void cmd_tlang(const char *args)
     }
     else
     {
-        int len = strlen(args);
-        if (len < 3 || !(args[len - 2] == '.' && args[len - 1] == 'T'))
+        if (!tlang_has_extension(args))
         {
             terminal_writestring("Error: File must have .T extension\n");
             return;
@@ -24,12 +24,21 @@ typedef struct
     } value;
 } TLANG_Variable;
 
+/* One per task, so scripts running on different CPUs do not share state. */
 typedef struct
 {
     TLANG_Variable variables[100];
     int var_count;
     int line_number;
     bool had_error;
+    bool skip_mode;
+    int if_depth;
+    bool else_found;
+    char literal_buffer[256];
+    char schar_buffer[256];
+    char random_strings[20][256];
+    char random_result[256];
+    uint32_t rng_state;
 } TLANG_Interpreter;
 
 void tlang_init(void);
@@ -2,6 +2,8 @@
 #include "variables.h"
 #include "string_utils.h"
 #include "vga.h"
+#include "floatfmt.h"
+#include "sched.h"
 
 int local_atoi(const char *str)
 {
@@ -23,28 +25,197 @@ int local_atoi(const char *str)
     return result * sign;
 }
 
-#define MAX_VARIABLES 50
+/*
+ * Variables live in a fixed array and are found through a chained hash
+ * table (the next field).  Each keeps its name's hash, so a lookup only
+ * runs strcmp on a real match.  Deleted slots go on a free list and are
+ * reused first, and Variable pointers stay valid while the name exists.
+ */
+#define VAR_BUCKETS 128
 
 static Variable variables[MAX_VARIABLES];
 static int var_count = 0;
-static char string_pool[4096];
-static int string_pool_used = 0;
+static Variable *buckets[VAR_BUCKETS];
+static Variable *free_list = NULL;
+
+/*
+ * String values are blocks in string_pool, each headed by a StrBlock
+ * naming the variable that owns it.  A new value that fits the current
+ * block is copied in place; otherwise the old block is released and a
+ * new one is taken from the top of the pool.  When the top runs out,
+ * live blocks are slid down over the released ones and their owners'
+ * pointers fixed up, so freed space is always reusable.
+ */
+#define STRING_POOL_SIZE 4096
+#define STR_ALIGN 8
+
+typedef struct
+{
+    uint16_t size;
+    uint16_t len;
+    Variable *owner;
+} StrBlock;
+
+static char string_pool[STRING_POOL_SIZE] __attribute__((aligned(STR_ALIGN)));
+static uint32_t string_pool_used = 0;
+static uint32_t string_live = 0;
+static uint32_t string_count = 0;
+static uint32_t string_compactions = 0;
+
+static StrBlock *str_block(const char *str)
+{
+    return (StrBlock *)(str - sizeof(StrBlock));
+}
+
+static uint32_t str_block_size(uint32_t len)
+{
+    return (sizeof(StrBlock) + len + 1 + STR_ALIGN - 1) & ~(STR_ALIGN - 1);
+}
+
+static void str_release(Variable *var)
+{
+    if (var->type != VAR_STRING || !var->value.string_value)
+        return;
+
+    StrBlock *block = str_block(var->value.string_value);
+    block->owner = NULL;
+    string_live -= block->size;
+    string_count--;
+
+    if ((char *)block + block->size == string_pool + string_pool_used)
+        string_pool_used -= block->size;
+
+    var->value.string_value = NULL;
+}
+
+static void str_compact(void)
+{
+    uint32_t src = 0;
+    uint32_t dst = 0;
+
+    while (src < string_pool_used)
+    {
+        StrBlock *block = (StrBlock *)&string_pool[src];
+        uint32_t size = block->size;
+
+        if (block->owner)
+        {
+            if (dst != src)
+            {
+                memmove(&string_pool[dst], block, size);
+                block = (StrBlock *)&string_pool[dst];
+                block->owner->value.string_value = (char *)(block + 1);
+            }
+            dst += size;
+        }
+        src += size;
+    }
+
+    string_pool_used = dst;
+    string_compactions++;
+}
+
+static bool str_assign(Variable *var, const char *value)
+{
+    uint32_t len = strlen(value);
+    uint32_t need = str_block_size(len);
+    uint32_t held = 0;
+
+    if (var->type == VAR_STRING && var->value.string_value)
+    {
+        StrBlock *block = str_block(var->value.string_value);
+
+        if (len + 1 <= block->size - sizeof(StrBlock))
+        {
+            memmove(var->value.string_value, value, len + 1);
+            block->len = len;
+            return true;
+        }
+        held = block->size;
+    }
+
+    if (string_live - held + need > STRING_POOL_SIZE)
+        return false;
+
+    str_release(var);
+
+    /* A job killed halfway through would leave strings half moved. */
+    if (string_pool_used + need > STRING_POOL_SIZE)
+    {
+        task_kill_hold();
+        str_compact();
+        task_kill_release();
+    }
+
+    StrBlock *block = (StrBlock *)&string_pool[string_pool_used];
+    block->size = need;
+    block->len = len;
+    block->owner = var;
+    memcpy(block + 1, value, len + 1);
+
+    string_pool_used += need;
+    string_live += need;
+    string_count++;
+
+    var->type = VAR_STRING;
+    var->value.string_value = (char *)(block + 1);
+    return true;
+}
+
+static uint32_t var_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
 void vars_init(void)
 {
     var_count = 0;
+    free_list = NULL;
     string_pool_used = 0;
+    string_live = 0;
+    string_count = 0;
+    string_compactions = 0;
+    memset(buckets, 0, sizeof(buckets));
 }
 
 Variable *var_create(const char *name, VarType type)
 {
-    if (var_count >= MAX_VARIABLES)
+    Variable *var;
+
+    if (free_list)
+    {
+        var = free_list;
+        free_list = var->next;
+    }
+    else if (var_count < MAX_VARIABLES)
+    {
+        var = &variables[var_count++];
+    }
+    else
+    {
         return NULL;
+    }
 
-    Variable *var = &variables[var_count++];
-    strcpy(var->name, name);
+    int i = 0;
+    while (name[i] && i < 31)
+    {
+        var->name[i] = name[i];
+        i++;
+    }
+    var->name[i] = '\0';
+    var->hash = var_hash(var->name);
     var->type = type;
-    var->next = NULL;
+
+    Variable **bucket = &buckets[var->hash & (VAR_BUCKETS - 1)];
+    var->next = *bucket;
+    *bucket = var;
 
     switch (type)
     {
@@ -69,12 +240,16 @@ Variable *var_create(const char *name, VarType type)
 
 Variable *var_get(const char *name)
 {
-    for (int i = 0; i < var_count; i++)
+    uint32_t hash = var_hash(name);
+    Variable *var = buckets[hash & (VAR_BUCKETS - 1)];
+
+    while (var)
     {
-        if (strcmp(variables[i].name, name) == 0)
+        if (var->hash == hash && strcmp(var->name, name) == 0)
         {
-            return &variables[i];
+            return var;
         }
+        var = var->next;
     }
     return NULL;
 }
@@ -89,6 +264,7 @@ bool var_set_int(const char *name, int32_t value)
             return false;
     }
 
+    str_release(var);
     var->type = VAR_INT;
     var->value.int_value = value;
     return true;
@@ -97,26 +273,21 @@ bool var_set_int(const char *name, int32_t value)
 bool var_set_string(const char *name, const char *value)
 {
     Variable *var = var_get(name);
+    bool created = false;
     if (!var)
     {
         var = var_create(name, VAR_STRING);
         if (!var)
             return false;
+        created = true;
     }
 
-    var->type = VAR_STRING;
-
-    int len = strlen(value);
-    if (string_pool_used + len + 1 > sizeof(string_pool))
+    if (!str_assign(var, value))
     {
+        if (created)
+            var_delete(name);
         return false;
     }
-
-    char *str = &string_pool[string_pool_used];
-    strcpy(str, value);
-    var->value.string_value = str;
-    string_pool_used += len + 1;
-
     return true;
 }
 
@@ -130,6 +301,7 @@ bool var_set_float(const char *name, float value)
             return false;
     }
 
+    str_release(var);
     var->type = VAR_FLOAT;
     var->value.float_value = value;
     return true;
@@ -145,6 +317,7 @@ bool var_set_bool(const char *name, bool value)
             return false;
     }
 
+    str_release(var);
     var->type = VAR_BOOL;
     var->value.bool_value = value;
     return true;
@@ -152,11 +325,24 @@ bool var_set_bool(const char *name, bool value)
 
 void var_delete(const char *name)
 {
+    uint32_t hash = var_hash(name);
+    Variable **link = &buckets[hash & (VAR_BUCKETS - 1)];
 
-    Variable *var = var_get(name);
-    if (var)
+    while (*link)
     {
-        var->type = VAR_NULL;
+        Variable *var = *link;
+
+        if (var->hash == hash && strcmp(var->name, name) == 0)
+        {
+            str_release(var);
+            *link = var->next;
+            var->type = VAR_NULL;
+            var->name[0] = '\0';
+            var->next = free_list;
+            free_list = var;
+            return;
+        }
+        link = &var->next;
     }
 }
 
@@ -191,12 +377,9 @@ void vars_list(void)
 
         case VAR_FLOAT:
             terminal_writestring("FLOAT = ");
-            char float_str[32];
-
-            int int_part = (int)variables[i].value.float_value;
-            itoa(int_part, float_str, 10);
+            char float_str[FLOAT_STR_MAX];
+            float_format(variables[i].value.float_value, float_str);
             terminal_writestring(float_str);
-            terminal_writestring(".0");
             break;
 
         case VAR_BOOL:
@@ -224,6 +407,24 @@ void vars_list(void)
         terminal_writestring(count_str);
         terminal_writestring(" variable(s)\n");
     }
+
+    char num[16];
+    terminal_writestring("String pool: ");
+    itoa(string_count, num, 10);
+    terminal_writestring(num);
+    terminal_writestring(" string(s), ");
+    itoa(string_live, num, 10);
+    terminal_writestring(num);
+    terminal_writestring("/");
+    itoa(STRING_POOL_SIZE, num, 10);
+    terminal_writestring(num);
+    terminal_writestring(" bytes live, ");
+    itoa(string_pool_used - string_live, num, 10);
+    terminal_writestring(num);
+    terminal_writestring(" reclaimable, ");
+    itoa(string_compactions, num, 10);
+    terminal_writestring(num);
+    terminal_writestring(" compaction(s)\n");
 }
 
 void print_var(Variable *var)
@@ -248,11 +449,9 @@ void print_var(Variable *var)
         break;
     case VAR_FLOAT:
     {
-        char buffer[32];
-        int int_part = (int)var->value.float_value;
-        itoa(int_part, buffer, 10);
+        char buffer[FLOAT_STR_MAX];
+        float_format(var->value.float_value, buffer);
         terminal_writestring(buffer);
-        terminal_writestring(".0");
         break;
     }
     case VAR_BOOL:
@@ -281,11 +480,9 @@ void print_var_by_name(const char *name)
             break;
         case VAR_FLOAT:
         {
-            char buffer[32];
-            int int_part = (int)var->value.float_value;
-            itoa(int_part, buffer, 10);
+            char buffer[FLOAT_STR_MAX];
+            float_format(var->value.float_value, buffer);
             terminal_writestring(buffer);
-            terminal_writestring(".0");
             break;
         }
         case VAR_BOOL:
@@ -300,4 +497,200 @@ void print_var_by_name(const char *name)
     {
         terminal_writestring("[undefined]");
     }
-}
\ No newline at end of file
+}
+
+/*
+ * Arithmetic for INT/DEC and IF: + - * / % and parentheses over numbers
+ * and &variables.  An operation stays integer while both sides are INT
+ * and becomes FLOAT as soon as either side is.
+ */
+static bool eval_sum(const char **p, VarNumber *out);
+
+static void eval_skip(const char **p)
+{
+    while (**p == ' ')
+        (*p)++;
+}
+
+static float number_float(const VarNumber *n)
+{
+    return n->type == VAR_FLOAT ? n->value.float_value : (float)n->value.int_value;
+}
+
+/* Integer operations wrap and INT_MIN / -1 gives INT_MIN, so no valid
+   input can fault. */
+bool number_apply(VarNumber *out, char op, const VarNumber *rhs)
+{
+    if (out->type == VAR_INT && rhs->type == VAR_INT)
+    {
+        uint32_t a = (uint32_t)out->value.int_value;
+        uint32_t b = (uint32_t)rhs->value.int_value;
+
+        switch (op)
+        {
+        case '+':
+            out->value.int_value = (int32_t)(a + b);
+            return true;
+        case '-':
+            out->value.int_value = (int32_t)(a - b);
+            return true;
+        case '*':
+            out->value.int_value = (int32_t)(a * b);
+            return true;
+        }
+
+        if (b == 0)
+            return false;
+        if ((int32_t)b == -1)
+            out->value.int_value = op == '/' ? (int32_t)(0u - a) : 0;
+        else
+            out->value.int_value = op == '/' ? (int32_t)a / (int32_t)b : (int32_t)a % (int32_t)b;
+        return true;
+    }
+
+    float a = number_float(out);
+    float b = number_float(rhs);
+
+    if (op == '%' || (op == '/' && b == 0.0f))
+        return false;
+
+    out->type = VAR_FLOAT;
+    out->value.float_value = op == '+' ? a + b : op == '-' ? a - b : op == '*' ? a * b : a / b;
+    return true;
+}
+
+static bool eval_primary(const char **p, VarNumber *out)
+{
+    eval_skip(p);
+
+    if (**p == '(')
+    {
+        (*p)++;
+        if (!eval_sum(p, out))
+            return false;
+        eval_skip(p);
+        if (**p != ')')
+            return false;
+        (*p)++;
+        return true;
+    }
+
+    if (**p == '-' || **p == '+')
+    {
+        bool negative = *(*p)++ == '-';
+        if (!eval_primary(p, out))
+            return false;
+        if (negative)
+        {
+            if (out->type == VAR_FLOAT)
+                out->value.float_value = -out->value.float_value;
+            else
+                out->value.int_value = (int32_t)(0u - (uint32_t)out->value.int_value);
+        }
+        return true;
+    }
+
+    if (**p == '&')
+    {
+        char name[32];
+        int len = 0;
+
+        (*p)++;
+        while (**p && **p != ' ' && !strchr("+-*/%()", **p))
+        {
+            if (len < 31)
+                name[len++] = **p;
+            (*p)++;
+        }
+        name[len] = '\0';
+
+        Variable *var = var_get(name);
+        if (!var)
+            return false;
+
+        switch (var->type)
+        {
+        case VAR_INT:
+            out->type = VAR_INT;
+            out->value.int_value = var->value.int_value;
+            return true;
+        case VAR_FLOAT:
+            out->type = VAR_FLOAT;
+            out->value.float_value = var->value.float_value;
+            return true;
+        case VAR_BOOL:
+            out->type = VAR_INT;
+            out->value.int_value = var->value.bool_value;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    const char *start = *p;
+    uint32_t value = 0;
+
+    while (**p >= '0' && **p <= '9')
+        value = value * 10 + (uint32_t)(*(*p)++ - '0');
+
+    if (**p == '.' || **p == 'e' || **p == 'E')
+    {
+        out->type = VAR_FLOAT;
+        return float_parse(start, &out->value.float_value, p);
+    }
+
+    if (*p == start)
+        return false;
+
+    out->type = VAR_INT;
+    out->value.int_value = (int32_t)value;
+    return true;
+}
+
+static bool eval_product(const char **p, VarNumber *out)
+{
+    if (!eval_primary(p, out))
+        return false;
+
+    for (;;)
+    {
+        eval_skip(p);
+        char op = **p;
+        if (op != '*' && op != '/' && op != '%')
+            return true;
+        (*p)++;
+
+        VarNumber rhs;
+        if (!eval_primary(p, &rhs) || !number_apply(out, op, &rhs))
+            return false;
+    }
+}
+
+static bool eval_sum(const char **p, VarNumber *out)
+{
+    if (!eval_product(p, out))
+        return false;
+
+    for (;;)
+    {
+        eval_skip(p);
+        char op = **p;
+        if (op != '+' && op != '-')
+            return true;
+        (*p)++;
+
+        VarNumber rhs;
+        if (!eval_product(p, &rhs) || !number_apply(out, op, &rhs))
+            return false;
+    }
+}
+
+bool eval_expression(const char *expr, VarNumber *out)
+{
+    const char *p = expr;
+
+    if (!eval_sum(&p, out))
+        return false;
+    eval_skip(&p);
+    return *p == '\0';
+}
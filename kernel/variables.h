@@ -13,9 +13,12 @@ typedef enum
     VAR_NULL
 } VarType;
 
+#define MAX_VARIABLES 256
+
 typedef struct Variable
 {
     char name[32];
+    uint32_t hash;
     VarType type;
     union
     {
@@ -27,6 +30,17 @@ typedef struct Variable
     struct Variable *next;
 } Variable;
 
+/* Result of eval_expression: VAR_INT or VAR_FLOAT. */
+typedef struct
+{
+    VarType type;
+    union
+    {
+        int32_t int_value;
+        float float_value;
+    } value;
+} VarNumber;
+
 void vars_init(void);
 Variable *var_create(const char *name, VarType type);
 Variable *var_get(const char *name);
@@ -40,7 +54,8 @@ void vars_list(void);
 void print_var(Variable *var);
 void print_var_by_name(const char *name);
 
-int32_t eval_expression(const char *expr);
+bool eval_expression(const char *expr, VarNumber *out);
+bool number_apply(VarNumber *out, char op, const VarNumber *rhs);
 bool eval_condition(const char *cond);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "vga.h"
 #include "string_utils.h"
 #include "kernel.h"
+#include "spinlock.h"
 #include <stdarg.h>
 
 size_t terminal_row = 0;
@@ -8,6 +9,9 @@ size_t terminal_column = 0;
 uint8_t terminal_color = 0;
 uint16_t *terminal_buffer = (uint16_t *)VGA_BUFFER;
 
+/* Keeps output from tasks on different CPUs from interleaving mid-line. */
+static spinlock_t terminal_lock = SPINLOCK_INIT;
+
 void terminal_initialize(void)
 {
     terminal_row = 0;
@@ -30,22 +34,10 @@ void terminal_setcolor(uint8_t color)
 
 void terminal_scroll(void)
 {
-
-    for (size_t y = 0; y < VGA_HEIGHT - 1; y++)
-    {
-        for (size_t x = 0; x < VGA_WIDTH; x++)
-        {
-            const size_t current_index = (y + 1) * VGA_WIDTH + x;
-            const size_t new_index = y * VGA_WIDTH + x;
-            terminal_buffer[new_index] = terminal_buffer[current_index];
-        }
-    }
-
-    for (size_t x = 0; x < VGA_WIDTH; x++)
-    {
-        const size_t index = (VGA_HEIGHT - 1) * VGA_WIDTH + x;
-        terminal_buffer[index] = vga_entry(' ', terminal_color);
-    }
+    memmove(terminal_buffer, terminal_buffer + VGA_WIDTH,
+            (VGA_HEIGHT - 1) * VGA_WIDTH * sizeof(uint16_t));
+    memset16(terminal_buffer + (VGA_HEIGHT - 1) * VGA_WIDTH,
+             vga_entry(' ', terminal_color), VGA_WIDTH);
 }
 
 void terminal_newline(void)
@@ -58,7 +50,7 @@ void terminal_newline(void)
     }
 }
 
-void terminal_putchar(char c)
+static void terminal_putchar_unlocked(char c)
 {
     if (c == '\n')
     {
@@ -99,12 +91,23 @@ void terminal_putchar(char c)
     }
 }
 
+void terminal_putchar(char c)
+{
+    uint32_t flags = spin_lock_irqsave(&terminal_lock);
+    terminal_putchar_unlocked(c);
+    spin_unlock_irqrestore(&terminal_lock, flags);
+}
+
 void terminal_write(const char *data, size_t size)
 {
+    uint32_t flags = spin_lock_irqsave(&terminal_lock);
+
     for (size_t i = 0; i < size; i++)
     {
-        terminal_putchar(data[i]);
+        terminal_putchar_unlocked(data[i]);
     }
+
+    spin_unlock_irqrestore(&terminal_lock, flags);
 }
 
 void terminal_writestring(const char *data)
@@ -210,12 +213,7 @@ void draw_line(int x, int y, int length, uint8_t color, bool horizontal)
 
 void terminal_clear_color(uint8_t color)
 {
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            terminal_buffer[index] = vga_entry(' ', color);
-        }
-    }
+    memset16(terminal_buffer, vga_entry(' ', color), VGA_WIDTH * VGA_HEIGHT);
     terminal_row = 0;
     terminal_column = 0;
 }
\ No newline at end of file
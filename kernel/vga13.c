@@ -13,10 +13,7 @@ void vga13_init(void)
 
 void vga13_clear(uint8_t color)
 {
-    for (int i = 0; i < VGA13_WIDTH * VGA13_HEIGHT; i++)
-    {
-        vga_mem[i] = color;
-    }
+    memset(vga_mem, color, VGA13_WIDTH * VGA13_HEIGHT);
 }
 
 void vga13_put_pixel(int x, int y, uint8_t color)
@@ -39,21 +36,17 @@ static void draw_scanlines(int cx, int x, int y, int current_y, uint8_t color)
         start_x = 0;
     if (end_x >= VGA13_WIDTH)
         end_x = VGA13_WIDTH - 1;
+    if (end_x < start_x)
+        return;
 
     if (current_y + y >= 0 && current_y + y < VGA13_HEIGHT)
     {
-        for (int px = start_x; px <= end_x; px++)
-        {
-            vga_mem[(current_y + y) * VGA13_WIDTH + px] = color;
-        }
+        memset(vga_mem + (current_y + y) * VGA13_WIDTH + start_x, color, end_x - start_x + 1);
     }
 
     if (current_y - y >= 0 && current_y - y < VGA13_HEIGHT)
     {
-        for (int px = start_x; px <= end_x; px++)
-        {
-            vga_mem[(current_y - y) * VGA13_WIDTH + px] = color;
-        }
+        memset(vga_mem + (current_y - y) * VGA13_WIDTH + start_x, color, end_x - start_x + 1);
     }
 }
 
@@ -1,5 +1,6 @@
 #include "vga_direct.h"
 #include "ports.h"
+#include "string_utils.h"
 
 #define VGA13_MEMORY 0xA0000
 #define VGA13_WIDTH 320
@@ -80,11 +81,7 @@ void vga_mode_13h(void)
 
 void vga_clear(uint8_t color)
 {
-    volatile uint8_t *vga = (volatile uint8_t *)VGA13_MEMORY;
-    for (int i = 0; i < VGA13_WIDTH * VGA13_HEIGHT; i++)
-    {
-        vga[i] = color;
-    }
+    memset((void *)VGA13_MEMORY, color, VGA13_WIDTH * VGA13_HEIGHT);
 }
 
 void vga_put_pixel(int x, int y, uint8_t color)